@@ -2,10 +2,14 @@
 #define GEOINDEX_AABB_INDEX
 
 #include <vector>
-#include <algorithm> // Or #include <parallel/algorithm>.
+#include <algorithm>
 #include <iterator>
+#include <utility>
 
 #include "Common.hpp"
+#include "DistanceKernels.hpp"
+#include "RadixSort.hpp"
+#include "WorkerPool.hpp"
 
 namespace geoIndex {
     
@@ -18,8 +22,17 @@ namespace geoIndex {
    *  all the indexes in the box limit.
    * 
    *  At each query it builds the AABB centered on the reference point and work on what is inside.
+   *  Each axis has its own copy of all the points (coordinates and indices), sorted along that axis. A lookup finds 
+   *  the three slabs with binary searches, then scans only the narrowest one: its points come with all their 
+   *  coordinates, so the distance is tested right away and the other two slabs are never read. 
+   *  The lookup costs as much as the smallest slab, not as much as all three.
    * 
-   *  The user must call complete() between modifications and lookups. But this is a costly operation.
+   *  Points can be added at any time, a la LSM tree. New points go to a small delta, in insertion order, that the 
+   *  lookups scan from end to end. When the delta is full it becomes a sorted run (the three sorted axes above), 
+   *  and runs of similar size are merged with linear passes, like the digits of a binary counter: each point is 
+   *  moved a logarithmic number of times, and a lookup visits a logarithmic number of runs.
+   *  completed() merges everything in a single run, for the fastest lookups. It is no longer needed between
+   *  batches of points.
    * 
    */
 template <typename POINT>
@@ -29,58 +42,48 @@ public:
     /** If you know how many points you are going to use, tell it to this constructor to 
     *  reserve memory. */
     AabbIndex(const size_t expectedCollectionSize = 0) {
-        indexX.reserve(expectedCollectionSize);
-        indexY.reserve(expectedCollectionSize);
-        indexZ.reserve(expectedCollectionSize);
-        
-        #ifdef GEO_INDEX_SAFETY_CHECKS
-            // There is nothing in the index, so it is sorted (you can't misplace... nothing). You can do lookups.
-            readyForLookups = true;
-        #endif
+        const size_t deltaCapacity = expectedCollectionSize < maximumDeltaSize ? expectedCollectionSize : maximumDeltaSize;
+        deltaX.reserve(deltaCapacity);
+        deltaY.reserve(deltaCapacity);
+        deltaZ.reserve(deltaCapacity);
+        deltaIndices.reserve(deltaCapacity);
     }
     
     
-    /** Adds a point to the index. Remember its name too. */
+    /** Adds a point to the index. Remember its name too. The point can be found right away. */
     void index(const POINT& p, const typename PointTraits<POINT>::index index){
         #ifdef GEO_INDEX_SAFETY_CHECKS
-            // Adding points probably breaks the order.
-            readyForLookups = false;
-            
-            if (std::find_if(begin(indexX),
-                             end(indexX),
-                             [index](const IndexAndCoordinate<POINT>& indexEntry) {
-                                return indexEntry.pointIndex == index; }
-                ) != end(indexX))
+            if (contains(index))
                 throw std::runtime_error("Point indexed twice");
         #endif
-            
-       indexX.push_back({index, p.x});
-       indexY.push_back({index, p.y});
-       indexZ.push_back({index, p.z});
+        
+       deltaX.push_back(p.x);
+       deltaY.push_back(p.y);
+       deltaZ.push_back(p.z);
+       deltaIndices.push_back(index);
+       
+       if (deltaIndices.size() >= maximumDeltaSize) {
+           WorkerPool justThisThread(1);
+           mergeRuns(false, justThisThread);
+       }
     }
     
     
-    /** "Close" the index and allows lookups.
-     *   Basically, sort its entries. It is best done "once and forever" as testing proves it can be a significant bottleneck.
-     *   If the user forgets to call it he will get garbage results.
+    /** Merges all the points in one sorted run: the lookups do not have to visit several runs and the delta.
+     *   Lookups are correct without it too, just slower. It is best done after the last of many points.
      */
     void completed() {
-        std::sort(std::begin(indexX), std::end(indexX), SortByGeometry<POINT>);
-        std::sort(std::begin(indexY), std::end(indexY), SortByGeometry<POINT>);
-        std::sort(std::begin(indexZ), std::end(indexZ), SortByGeometry<POINT>);
-        
-        /* The latest STL (C++17) has a parallel sort that could be useful...
-         * In the meanwhile, there is this nice thing from GNU.
-            __gnu_parallel::sort(indexX.begin(), indexX.end());
-            __gnu_parallel::sort(indexY.begin(), indexY.end());
-            __gnu_parallel::sort(indexZ.begin(), indexZ.end());
-            ...but depends on openMP (libgomp) - for the moment I don't do it, to keep deps simple.
-            The speedup we can get here should be tested.
-        */
-        #ifdef GEO_INDEX_SAFETY_CHECKS
-            readyForLookups = true;
-        #endif
-        
+        WorkerPool justThisThread(1);
+        completed(justThisThread);
+    }
+    
+    /** Same as above, with the help of some threads.
+     *   The delta is sorted with a radix sort on the bits of the coordinates (no OpenMP needed, unlike
+     *   __gnu_parallel::sort). The three axes are sorted in the same passes, sharing all the workers, then
+     *   merged one axis per worker.
+     */
+    void completed(WorkerPool& workers) {
+        mergeRuns(true, workers);
     }
     
     /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
@@ -97,37 +100,8 @@ public:
     {
         #ifdef GEO_INDEX_SAFETY_CHECKS
             CheckMeaningfulDistance(d);
-            if (! readyForLookups)
-                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
         #endif
         
-
-        std::vector<IndexAndCoordinate<POINT> > candidatesX;
-        std::vector<IndexAndCoordinate<POINT> > candidatesY;
-        std::vector<IndexAndCoordinate<POINT> > candidatesZ;
-        
-        candidatesOnDimension(indexX, d, p.x, candidatesX);
-        candidatesOnDimension(indexY, d, p.y, candidatesY);
-        candidatesOnDimension(indexZ, d, p.z, candidatesZ);
-        
-        std::vector<IndexAndCoordinate<POINT> > insideAabbXY;
-        std::set_intersection(std::begin(candidatesX),
-                              std::end(candidatesX),
-                              std::begin(candidatesY),
-                              std::end(candidatesY),
-                              std::back_inserter(insideAabbXY),
-                              SortByPointIndex<POINT>
-                             );
-        
-        std::vector<IndexAndCoordinate<POINT> > insideAabb;
-        std::set_intersection(std::begin(insideAabbXY),
-                              std::end(insideAabbXY),
-                              std::begin(candidatesZ),
-                              std::end(candidatesZ),
-                              std::back_inserter(insideAabb),
-                              SortByPointIndex<POINT>
-                             );
-        
         const typename PointTraits<POINT>::coordinate referenceSquareDistance = d * d;
         
         #ifdef GEO_INDEX_SAFETY_CHECKS
@@ -135,89 +109,234 @@ public:
         #endif
             
         output.clear();
-        for (const auto& candidate : insideAabb) {
-            const auto candidateIndex = candidate.pointIndex;
-            const typename PointTraits<POINT>::coordinate candidateX = findCoordinateOf(candidateIndex, candidatesX);
-            const typename PointTraits<POINT>::coordinate candidateY = findCoordinateOf(candidateIndex, candidatesY);
-            const typename PointTraits<POINT>::coordinate candidateZ = findCoordinateOf(candidateIndex, candidatesZ);
-            
-            const auto candidateSquareDistance = SquaredDistance(p, POINT{candidateX, candidateY, candidateZ});
-            
-            if (candidateSquareDistance < referenceSquareDistance)
-                output.push_back({candidateIndex, candidateSquareDistance});
+        for (const SortedRun& run : runs) {
+            const Slab slab = narrowestSlab(run, p, d);
+            appendPointsInSlab(p, referenceSquareDistance, slab, slab.begin, slab.end, output);
         }
+        appendPointsInDelta(p, referenceSquareDistance, 0, deltaIndices.size(), output);
         
         // Don't forget we have to give the closests point first.
         std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
     }
     
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements, without sorting all the points in the AABB.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p, 
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const 
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+        
+        const typename PointTraits<POINT>::coordinate referenceSquareDistance = d * d;
+        
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(referenceSquareDistance);
+        #endif
+        
+        KNearestCandidates<POINT> nearest(k, referenceSquareDistance, output);
+        
+        // A block at a time, so the limit gets tighter as the candidates get closer.
+        static const size_t blockSize = 256;
+        std::vector<IndexAndSquaredDistance<POINT> > hitsInBlock;
+        for (const SortedRun& run : runs) {
+            const Slab slab = narrowestSlab(run, p, d);
+            for (size_t blockBegin = slab.begin; blockBegin < slab.end; blockBegin += blockSize) {
+                hitsInBlock.clear();
+                appendPointsInSlab(p, nearest.squaredLimit(), slab, blockBegin, std::min(blockBegin + blockSize, slab.end), hitsInBlock);
+                for (const auto& hit : hitsInBlock)
+                    nearest.offer(hit.pointIndex, hit.geometricValue);
+            }
+        }
+        for (size_t blockBegin = 0; blockBegin < deltaIndices.size(); blockBegin += blockSize) {
+            hitsInBlock.clear();
+            appendPointsInDelta(p, nearest.squaredLimit(), blockBegin, std::min(blockBegin + blockSize, deltaIndices.size()), hitsInBlock);
+            for (const auto& hit : hitsInBlock)
+                nearest.offer(hit.pointIndex, hit.geometricValue);
+        }
+        nearest.sort();
+    }
+    
 private:
-    std::vector<IndexAndCoordinate<POINT> > indexX;
-    std::vector<IndexAndCoordinate<POINT> > indexY;
-    std::vector<IndexAndCoordinate<POINT> > indexZ;
+    /** All the points of a run, sorted along one of the axes. */
+    struct SortedAxis {
+        std::vector<typename PointTraits<POINT>::coordinate> coordinates[3];  ///< x, y and z.
+        std::vector<typename PointTraits<POINT>::index> indices;
+    };
     
-    #ifdef GEO_INDEX_SAFETY_CHECKS
-        bool readyForLookups;
-    #endif
-  
-   
+    /** The same points, sorted along x, y and z. */
+    struct SortedRun {
+        SortedAxis axes[3];
+        
+        size_t size() const {
+            return axes[0].indices.size();
+        }
+    };
     
-    static bool CompareEntryWithCoordinate(const IndexAndCoordinate<POINT>& indexEntry,
-                                           const typename PointTraits<POINT>::coordinate searchedValue) {
-        return indexEntry.geometricValue < searchedValue;
-    }
+    /** The points of a sorted axis, from begin to end, that are in the AABB along that axis. */
+    struct Slab {
+        const SortedAxis* axis;
+        size_t begin;
+        size_t end;
+    };
     
-    static bool CompareEntryWithIndex(const IndexAndCoordinate<POINT>& indexEntry,
-                                      const typename PointTraits<POINT>::index searchedValue) {
-        return indexEntry.pointIndex < searchedValue;
-    }
-       
-    /** Scan the given index and returns the indices of the "interesting" points.*/
-    void candidatesOnDimension(const std::vector<IndexAndCoordinate<POINT> >& indexForDimension,
-                               const typename PointTraits<POINT>::coordinate searchDistance,
-                               const typename PointTraits<POINT>::coordinate referenceCoordnate,
-                               std::vector<IndexAndCoordinate<POINT> >& candidates) const 
-    {
-        const typename PointTraits<POINT>::coordinate minAcceptedCoordinate = referenceCoordnate - searchDistance;
-        const typename PointTraits<POINT>::coordinate maxAcceptedCoordinate = referenceCoordnate + searchDistance;
-
-        const auto beginCandidates = std::lower_bound(std::begin(indexForDimension),
-                                                      std::end(indexForDimension),
-                                                      minAcceptedCoordinate,
-                                                      CompareEntryWithCoordinate);
+    /** When the delta has this many points, it becomes a run. Scanning it costs about as much as a small slab. */
+    static const size_t maximumDeltaSize = 1024;
+    
+    std::vector<SortedRun> runs;  ///< From the biggest (the oldest points) to the smallest.
+    
+    // The delta: the latest points, in the order they were indexed.
+    std::vector<typename PointTraits<POINT>::coordinate> deltaX;
+    std::vector<typename PointTraits<POINT>::coordinate> deltaY;
+    std::vector<typename PointTraits<POINT>::coordinate> deltaZ;
+    std::vector<typename PointTraits<POINT>::index> deltaIndices;
+    
+    
+    /** Sorts the delta into a new run and merges it with the runs that are not bigger than the result
+     *  (or with all of them). The merged runs are replaced by the result and the delta is emptied. */
+    void mergeRuns(const bool allTheRuns, WorkerPool& workers) {
+        size_t firstMerged = runs.size();
+        size_t mergedSize = deltaIndices.size();
+        while (firstMerged > 0 && (allTheRuns || runs[firstMerged - 1].size() <= mergedSize)) {
+            --firstMerged;
+            mergedSize += runs[firstMerged].size();
+        }
+        if (deltaIndices.empty() && runs.size() - firstMerged <= 1)
+            return;  // Nothing to merge.
         
-        const auto endCandidates = std::lower_bound(beginCandidates,  // the bigger values must be after, skip some elements.
-                                                    std::end(indexForDimension),
-                                                    maxAcceptedCoordinate,
-                                                    CompareEntryWithCoordinate);
+        // The delta sorted on the three axes at the same time, on all the workers.
+        const std::vector<const std::vector<typename PointTraits<POINT>::coordinate>*> from{&deltaX, &deltaY, &deltaZ};
+        std::vector<size_t> order[3];
+        RadixSortedPositionsOfEach(from, std::vector<std::vector<size_t>*>{&order[0], &order[1], &order[2]}, workers);
         
-        candidates.clear();
-        candidates.reserve(std::distance(beginCandidates, endCandidates));
-        for (auto i = beginCandidates; i != endCandidates; ++i)
-            candidates.push_back(*i);
+        // The merges are linear and run one axis per task.
+        SortedRun merged;
+        workers.run(3, [this, firstMerged, &merged, &order](const size_t axis) {
+            SortedAxis result = sortedDelta(order[axis]);
+            for (size_t run = runs.size(); run > firstMerged; --run)  // Smallest first.
+                result = mergedAxis(runs[run - 1].axes[axis], result, axis);
+            merged.axes[axis] = std::move(result);
+        });
         
-        // TODO: would it be faster with sets? THIS IS A MAJOR BOTTLENECK... in callgrind only?
-       //std::sort(std::begin(candidates), std::end(candidates), SortByPointIndex<POINT>);
+        runs.resize(firstMerged);
+        runs.push_back(std::move(merged));
+        deltaX.clear();
+        deltaY.clear();
+        deltaZ.clear();
+        deltaIndices.clear();
+    }
+    
+    /** The points of the delta, in the order of their positions sorted on an axis. */
+    SortedAxis sortedDelta(const std::vector<size_t>& order) const {
+        const std::vector<typename PointTraits<POINT>::coordinate>* from[3] = {&deltaX, &deltaY, &deltaZ};
+        SortedAxis sorted;
+        for (size_t c = 0; c < 3; ++c) {
+            sorted.coordinates[c].resize(order.size());
+            for (size_t i = 0; i < order.size(); ++i)
+                sorted.coordinates[c][i] = (*from[c])[order[i]];
+        }
+        sorted.indices.resize(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            sorted.indices[i] = deltaIndices[order[i]];
+        return sorted;
+    }
+    
+    /** Linear merge of two runs sorted on the same axis. */
+    static SortedAxis mergedAxis(const SortedAxis& first, const SortedAxis& second, const size_t axis) {
+        const size_t firstSize = first.indices.size();
+        const size_t secondSize = second.indices.size();
         
-        std::sort(std::begin(candidates), std::end(candidates), [](const IndexAndGeometry<POINT>& lhs,
-                             const IndexAndGeometry<POINT>& rhs)
-        {return lhs.pointIndex < rhs.pointIndex;});
+        SortedAxis merged;
+        for (size_t c = 0; c < 3; ++c)
+            merged.coordinates[c].resize(firstSize + secondSize);
+        merged.indices.resize(firstSize + secondSize);
         
-    }    
+        size_t fromFirst = 0;
+        size_t fromSecond = 0;
+        for (size_t i = 0; i < firstSize + secondSize; ++i) {
+            const bool takeFirst = fromSecond == secondSize ||
+                (fromFirst < firstSize && ! (second.coordinates[axis][fromSecond] < first.coordinates[axis][fromFirst]));
+            const SortedAxis& from = takeFirst ? first : second;
+            size_t& position = takeFirst ? fromFirst : fromSecond;
+            for (size_t c = 0; c < 3; ++c)
+                merged.coordinates[c][i] = from.coordinates[c][position];
+            merged.indices[i] = from.indices[position];
+            ++position;
+        }
+        return merged;
+    }
     
-    /** This index does not store the full collection of points (but maybe it should, or should have a reference to it,
-      * to avoid this kind of issues - or maybe we should move the distance test outside the indexes). 
-      * Assume that groupOfCandidates is sorted by point index and point indices do not repeat. */
-    typename PointTraits<POINT>::coordinate findCoordinateOf(const typename PointTraits<POINT>::index pointIndex,
-                                                             const std::vector<IndexAndCoordinate<POINT> >& groupOfCandidates) const
-    {
-        const auto indexEntry = std::lower_bound(std::begin(groupOfCandidates),
-                                                 std::end(groupOfCandidates),
-                                                 pointIndex,
-                                                 CompareEntryWithIndex);
-        
-        return indexEntry->geometricValue;
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        bool contains(const typename PointTraits<POINT>::index index) const {
+            for (const SortedRun& run : runs)
+                if (std::find(run.axes[0].indices.begin(), run.axes[0].indices.end(), index) != run.axes[0].indices.end())
+                    return true;
+            return std::find(deltaIndices.begin(), deltaIndices.end(), index) != deltaIndices.end();
+        }
+    #endif
+    
+    /** Finds the slabs of the AABB of side 2d around p on the three axes of the run (two binary searches each), 
+     *  returns the one with less points. */
+    static Slab narrowestSlab(const SortedRun& run, const POINT& p, const typename PointTraits<POINT>::coordinate d) {
+        const typename PointTraits<POINT>::coordinate center[3] = {p.x, p.y, p.z};
         
+        Slab narrowest{&run.axes[0], 0, 0};
+        for (size_t axis = 0; axis < 3; ++axis) {
+            const std::vector<typename PointTraits<POINT>::coordinate>& sortedCoordinates = run.axes[axis].coordinates[axis];
+            
+            const auto beginCandidates = std::lower_bound(std::begin(sortedCoordinates),
+                                                          std::end(sortedCoordinates),
+                                                          center[axis] - d);
+            const auto endCandidates = std::lower_bound(beginCandidates,  // the bigger values must be after, skip some elements.
+                                                        std::end(sortedCoordinates),
+                                                        center[axis] + d);
+            
+            const Slab slab{&run.axes[axis],
+                            static_cast<size_t>(beginCandidates - std::begin(sortedCoordinates)),
+                            static_cast<size_t>(endCandidates - std::begin(sortedCoordinates))};
+            if (axis == 0 || slab.end - slab.begin < narrowest.end - narrowest.begin)
+                narrowest = slab;
+        }
+        return narrowest;
+    }
+    
+    /** The points of the delta from begin to end that are strictly within the limit. */
+    void appendPointsInDelta(const POINT& p,
+                             const typename PointTraits<POINT>::coordinate squaredLimit,
+                             const size_t begin,
+                             const size_t end,
+                             std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        AppendPointsWithinSquaredDistance(p,
+                                          squaredLimit,
+                                          deltaX.data() + begin,
+                                          deltaY.data() + begin,
+                                          deltaZ.data() + begin,
+                                          deltaIndices.data() + begin,
+                                          end - begin,
+                                          output);
+    }
+    
+    /** The points of the slab from begin to end that are strictly within the limit. */
+    void appendPointsInSlab(const POINT& p,
+                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                            const Slab& slab,
+                            const size_t begin,
+                            const size_t end,
+                            std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        AppendPointsWithinSquaredDistance(p,
+                                          squaredLimit,
+                                          slab.axis->coordinates[0].data() + begin,
+                                          slab.axis->coordinates[1].data() + begin,
+                                          slab.axis->coordinates[2].data() + begin,
+                                          slab.axis->indices.data() + begin,
+                                          end - begin,
+                                          output);
     }
     
 };
@@ -3,6 +3,11 @@
 #include "AabbIndex.hpp"
 
 #include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+#include <vector>
+#include <thread>
+#include <algorithm>
 
 namespace geoIndex {
 
@@ -48,6 +53,21 @@ TEST(AabbIndex, pointsWithinDistance_squareDistance) {
     pointsWithinDistance_squareDistance(index);
 }
 
+TEST(AabbIndex, nearestPointsWithinDistance_closestK) {
+    AabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(AabbIndex, nearestPointsWithinDistance_lessThanK) {
+    AabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(AabbIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    AabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(AabbIndex, index_duplicatedIndex) {
@@ -96,7 +116,90 @@ TEST(AabbIndex, pointsWithinDistance_aabbBoundaries) {
     ASSERT_EQ(1, result.size());
     ASSERT_INDEX_PRESENT(result, 2);
 }
+
+TEST(AabbIndex, pointsWithinDistance_sparseIndices) {
+    AabbIndex<Point> gi;
+    gi.index(Point{0, 0, 1}, 4000000000u);
+    gi.index(Point{0, 0, 2}, 7);
+    gi.index(Point{0, 5, 0}, 12);  // In the x and z slabs, not in y.
+    gi.completed();
     
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    gi.pointsWithinDistance(Point{0, 0, 0}, 3, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(4000000000u, result.at(0).pointIndex);
+    ASSERT_EQ(7, result.at(1).pointIndex);
+}
+
+TEST(AabbIndex, pointsWithinDistance_narrowestSlabOnEachAxis) {
+    // Points on a line along one axis: the slab on that axis is the narrowest, the other two have all the points.
+    for (size_t axis = 0; axis < 3; ++axis) {
+        AabbIndex<Point> gi;
+        for (int t = -100; t <= 100; ++t) {
+            double coordinates[3] = {0, 0, 0};
+            coordinates[axis] = t;
+            gi.index(Point{coordinates[0], coordinates[1], coordinates[2]}, t + 100);
+        }
+        gi.completed();
+        
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        gi.pointsWithinDistance(Point{0, 0, 0}, 1.5, result);
+        ASSERT_EQ(3, result.size());
+        ASSERT_EQ(100, result.at(0).pointIndex);
+        
+        gi.nearestPointsWithinDistance(Point{0, 0, 0}, 1.5, 2, result);
+        ASSERT_EQ(2, result.size());
+        ASSERT_EQ(100, result.at(0).pointIndex);
+        ASSERT_EQ(1, result.at(1).geometricValue);
+    }
+}
+
+TEST(AabbIndex, pointsWithinDistance_manyThreads) {
+    AabbIndex<Point> gi;
+    for (PointIndex i = 0; i < 1000; ++i)
+        gi.index(Point{static_cast<double>(i % 10), static_cast<double>((i / 10) % 10), static_cast<double>(i / 100)}, i);
+    gi.completed();
+    
+    std::vector<size_t> found(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < found.size(); ++t)
+        threads.emplace_back([&gi, &found, t]() {
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            for (int lookup = 0; lookup < 100; ++lookup) {
+                gi.pointsWithinDistance(Point{5, 5, 5}, 1.1, result);
+                found[t] = std::max(found[t], result.size());
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+    
+    ASSERT_EQ(std::vector<size_t>(4, 7), found);  // The point and its 6 neighbors.
+}
+    
+TEST(AabbIndex, completed_withWorkers) {
+    for (const size_t threads : {1, 2, 4}) {
+        WorkerPool workers(threads);
+        AabbIndex<Point> withWorkers;
+        AabbIndex<Point> alone;
+        for (PointIndex i = 0; i < 1000; ++i) {
+            const Point p{static_cast<double>(i % 10) - 5, static_cast<double>((i / 10) % 10) - 5, static_cast<double>(i / 100) - 5};
+            withWorkers.index(p, i);
+            alone.index(p, i);
+        }
+        withWorkers.completed(workers);
+        alone.completed();
+        
+        std::vector<IndexAndSquaredDistance<Point>> expected;
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        alone.pointsWithinDistance(Point{-1, 0, 1}, 2.5, expected);
+        withWorkers.pointsWithinDistance(Point{-1, 0, 1}, 2.5, result);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t r = 0; r < result.size(); ++r)
+            ASSERT_EQ(expected[r].geometricValue, result[r].geometricValue);
+    }
+}
+
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(AabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupOfNothing) {
     const Point anyPoint{1, 55, 2};
@@ -106,19 +209,22 @@ TEST(AabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupOfNothing) {
     std::vector<IndexAndSquaredDistance<Point>> result;
     ASSERT_NO_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
 }
+#endif
 
-TEST(AabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+TEST(AabbIndex, pointsWithinDistance_lookupWithoutPreparation) {
     const Point anyPoint{1, 55, 2};
   
     AabbIndex<Point> gi;
     gi.index(anyPoint, 1);
-    // No call to completed();
+    // No call to completed(): the point is found anyway.
     
     std::vector<IndexAndSquaredDistance<Point>> result;
-    ASSERT_ANY_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
 }
 
-TEST(AabbIndex, pointsWithinDistance_incorrectOrderOfUsage_addPointsAfterCompletition) {
+TEST(AabbIndex, pointsWithinDistance_addPointsAfterCompletition) {
     const Point anyPoint{1, 55, 2};
   
     AabbIndex<Point> gi;
@@ -127,8 +233,43 @@ TEST(AabbIndex, pointsWithinDistance_incorrectOrderOfUsage_addPointsAfterComplet
     gi.index(anyPoint, 2);
     
     std::vector<IndexAndSquaredDistance<Point>> result;
-    ASSERT_ANY_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_INDEX_PRESENT(result, 1);
+    ASSERT_INDEX_PRESENT(result, 2);
 }
-#endif
 
-}
\ No newline at end of file
+TEST(AabbIndex, index_streaming) {
+    // Lookups between the additions, never calling completed(): the points end up in runs of many sizes.
+    NoIndex<Point> reference;
+    AabbIndex<Point> gi;
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    for (PointIndex i = 0; i < 20000; ++i) {
+        const Point p{static_cast<double>(i % 37), static_cast<double>(i % 101) / 3, static_cast<double>(i % 7) * 5};
+        reference.index(p, i);
+        gi.index(p, i);
+        
+        if (i % 997 == 0 || i == 19999) {
+            const Point lookup{static_cast<double>(i % 30), 10, 15};
+            reference.pointsWithinDistance(lookup, 4, expected);
+            gi.pointsWithinDistance(lookup, 4, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (const auto& hit : expected)
+                ASSERT_INDEX_PRESENT(result, hit.pointIndex);
+            
+            reference.nearestPointsWithinDistance(lookup, 4, 10, expected);
+            gi.nearestPointsWithinDistance(lookup, 4, 10, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t r = 0; r < result.size(); ++r)
+                ASSERT_NEAR(expected[r].geometricValue, result[r].geometricValue, 1e-9);
+        }
+    }
+    
+    gi.completed();
+    gi.pointsWithinDistance(Point{20, 10, 15}, 4, result);
+    reference.pointsWithinDistance(Point{20, 10, 15}, 4, expected);
+    ASSERT_EQ(expected.size(), result.size());
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef GEOINDEX_BIT_PACKED_VECTOR
+#define GEOINDEX_BIT_PACKED_VECTOR
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "RadixSort.hpp"
+
+namespace geoIndex {
+
+/** How an index stores its arrays of integers (positions, point indices...). */
+enum class IntegerStorage {
+    wide,     ///< 32 bits per value when they fit, 64 otherwise: the fastest to read.
+    compact   ///< Just the bits the biggest value needs: less memory, more points in the cache.
+};
+
+
+/** Fixed size array of unsigned integers, all with the same number of bits (1 to 64), one after the other
+ *  in 64 bit words. A value can sit across two words.
+ *
+ *  Reading has no branches: two shifts, an or and a mask. For that there is always one more word at the end, and
+ *  the part taken from the second word is shifted in two steps (a shift by 64 bits would be undefined). */
+class BitPackedVector {
+public:
+    BitPackedVector() :
+        length(0),
+        bits(1),
+        mask(1),
+        words(1, 0)
+    { }
+
+    /** All zeros. */
+    BitPackedVector(const size_t length, const unsigned bitsPerValue) :
+        length(length),
+        bits(bitsPerValue),
+        mask(bitsPerValue == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << bitsPerValue) - 1),
+        words((length * bitsPerValue + 63) / 64 + 1, 0)
+    { }
+
+    /** The bits needed to store values up to maxValue (included) with the given storage. */
+    static unsigned BitsFor(const uint64_t maxValue, const IntegerStorage storage) {
+        if (storage == IntegerStorage::wide)
+            return maxValue <= UINT32_MAX ? 32 : 64;
+        const unsigned needed = BitsToRepresent(maxValue);
+        return needed == 0 ? 1 : needed;
+    }
+
+    uint64_t operator[](const size_t position) const {
+        const size_t firstBit = position * bits;
+        const size_t word = firstBit / 64;
+        const unsigned offset = firstBit % 64;
+        const uint64_t low = words[word] >> offset;
+        const uint64_t high = (words[word + 1] << 1) << (63 - offset);
+        return (low | high) & mask;
+    }
+
+    /** The value must fit in the bits per value. */
+    void set(const size_t position, const uint64_t value) {
+        const size_t firstBit = position * bits;
+        const size_t word = firstBit / 64;
+        const unsigned offset = firstBit % 64;
+        words[word] = (words[word] & ~(mask << offset)) | (value << offset);
+        if (offset + bits > 64)
+            words[word + 1] = (words[word + 1] & ~(mask >> (64 - offset))) | (value >> (64 - offset));
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    bool empty() const {
+        return length == 0;
+    }
+
+    unsigned bitsPerValue() const {
+        return bits;
+    }
+
+    /** Bytes taken by the values. */
+    size_t memoryUsage() const {
+        return words.size() * sizeof(uint64_t);
+    }
+
+private:
+    size_t length;
+    unsigned bits;
+    uint64_t mask;
+    std::vector<uint64_t> words;
+};
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "gtest/gtest.h"
+
+#include "BitPackedVector.hpp"
+
+#include <vector>
+#include <cstdint>
+
+namespace geoIndex {
+
+TEST(BitPackedVector, startsWithZeros) {
+    const BitPackedVector values(100, 7);
+
+    ASSERT_EQ(100, values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        ASSERT_EQ(0, values[i]);
+}
+
+TEST(BitPackedVector, everyWidth) {
+    // Values across the word boundaries too, at all the offsets.
+    for (unsigned bits = 1; bits <= 64; ++bits) {
+        const uint64_t mask = bits == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << bits) - 1;
+        BitPackedVector values(200, bits);
+        uint64_t state = bits;
+        std::vector<uint64_t> expected;
+        for (size_t i = 0; i < values.size(); ++i) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            expected.push_back(state & mask);
+            values.set(i, expected.back());
+        }
+
+        for (size_t i = 0; i < values.size(); ++i)
+            ASSERT_EQ(expected[i], values[i]) << bits << " bits, position " << i;
+    }
+}
+
+TEST(BitPackedVector, overwriteKeepsTheNeighbors) {
+    BitPackedVector values(10, 13);
+    for (size_t i = 0; i < values.size(); ++i)
+        values.set(i, 8191);
+    values.set(4, 0);  // 13 * 4 = 52: across the first two words.
+
+    for (size_t i = 0; i < values.size(); ++i)
+        ASSERT_EQ(i == 4 ? 0 : 8191, values[i]);
+}
+
+TEST(BitPackedVector, bitsFor) {
+    ASSERT_EQ(1, BitPackedVector::BitsFor(0, IntegerStorage::compact));
+    ASSERT_EQ(1, BitPackedVector::BitsFor(1, IntegerStorage::compact));
+    ASSERT_EQ(20, BitPackedVector::BitsFor(999999, IntegerStorage::compact));
+    ASSERT_EQ(32, BitPackedVector::BitsFor(999999, IntegerStorage::wide));
+    ASSERT_EQ(32, BitPackedVector::BitsFor(UINT32_MAX, IntegerStorage::wide));
+    ASSERT_EQ(64, BitPackedVector::BitsFor(static_cast<uint64_t>(UINT32_MAX) + 1, IntegerStorage::wide));
+}
+
+TEST(BitPackedVector, memoryUsage) {
+    // 1000 values of 20 bits: 313 words, plus the one at the end.
+    ASSERT_EQ(314 * sizeof(uint64_t), BitPackedVector(1000, 20).memoryUsage());
+}
+
+}
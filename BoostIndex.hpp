@@ -7,6 +7,11 @@
 #include <boost/geometry/geometries/box.hpp>
 #include <boost/geometry/geometries/register/point.hpp> 
 
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
 #include "Common.hpp"
 
 /** Boost goemetry is somewhat shitty when it comes to namespace.
@@ -37,22 +42,54 @@ namespace geoIndex {
  *  Also expect less paranoid tests: I just wrapped a well known library so it would fit with the rest of the
  *  project and be called like the other algorithms. I have no doubts boost's code is perfectly working.
  * 
- *  Index construction is slower, but lookups are 10 times faster.
+ *  Lookups are 10 times faster than the other indexes.
  *  It could probably be possible to increase the performance even further, but I did not check all the
  *  possible ways of tweaking the r-tree.
+ *
+ *  Inserting the points one by one in the r-tree takes ages, so index() just puts them aside and completed()
+ *  builds the tree in one go with boost's packing algorithm (Sort-Tile-Recursive): much faster, and the nodes
+ *  overlap less, so the lookups are faster as well.
+ *  Points added after completed() are scanned one by one until the next call to completed().
+ *
+ *  PARAMETERS is the r-tree's own: balancing algorithm and node fill, either fixed at compile time
+ *  (linear<16>, quadratic<32, 8>, rstar<16>...) or at run time (dynamic_linear, dynamic_quadratic,
+ *  dynamic_rstar, passed to the constructor). The packed build only looks at the maximum node fill;
+ *  the algorithm is what inserts the points added to a completed index.
+ *  linear<16> stays the default: on the red meshes the lookups are the same with all three algorithms,
+ *  and linear inserts the most quickly (rstar takes 5 times longer).
  */
-template <typename POINT>
+template <typename POINT, typename PARAMETERS = boost::geometry::index::linear<16> >
 class BoostIndex
 {
 public: 
+  
+  /** The dynamic_ parameters have no defaults: pass them. */
+  explicit BoostIndex(const PARAMETERS& parameters = PARAMETERS()) :
+      rtreeIndex(parameters)
+  { }
       
-  /** Adds a point to the index. Remember its name too. */
+  /** Adds a point to the index. Remember its name too.
+   *  The point goes in the tree at the next call to completed(). */
   void index(const POINT& p, const typename PointTraits<POINT>::index index){
-      rtreeIndex.insert(geoIndex_PointWithIndex(p.x, p.y, p.z, index));
+      staged.push_back(geoIndex_PointWithIndex(p.x, p.y, p.z, index));
   }
   
-    /** Does nothing, boost has no such step, but I keep the interface. */
-    void completed() {};
+    /** Puts the points added since the last call in the tree.
+     *  Only a few points compared with the tree: inserts them. Otherwise builds the whole tree again, packed. */
+    void completed() {
+        if (staged.empty())
+            return;
+        
+        if (staged.size() < rtreeIndex.size() / maximumInsertedFraction) {
+            rtreeIndex.insert(staged.begin(), staged.end());
+        } else {
+            staged.insert(staged.end(), rtreeIndex.begin(), rtreeIndex.end());
+            rtreeIndex = rtree_type(staged.begin(), staged.end(), rtreeIndex.parameters());  // The range constructor packs.
+        }
+        
+        staged.clear();
+        staged.shrink_to_fit();
+    }
   
   
   /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
@@ -70,37 +107,114 @@ public:
   
     const double distanceLimit = d * d;
     
-    const boostPoint top(p.x + d, p.y + d, p.z + d);
-    const boostPoint bottom(p.x - d, p.y - d, p.z - d);
-    const boostBox queryBox(bottom, top);
-    
-    std::vector<geoIndex_PointWithIndex> inBoundingBox;
-    rtreeIndex.query(boost::geometry::index::intersects(queryBox), std::back_inserter(inBoundingBox));
-  
     output.clear();
-    for(const  geoIndex_PointWithIndex& candidateFromBox : inBoundingBox) {
-        POINT candidate;
-        candidate.x = candidateFromBox.x;
-        candidate.y = candidateFromBox.y;
-        candidate.z = candidateFromBox.z;
-        
-        const auto squaredDistance = SquaredDistance(p, candidate);
+    visitPointsInBox(p, d, [&](const size_t index, const typename PointTraits<POINT>::coordinate squaredDistance) {
         if (squaredDistance < distanceLimit)
-            output.push_back({candidateFromBox.index, squaredDistance});
-    }
+            output.push_back({index, squaredDistance});
+    });
     
     std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
     
   }
+  
+  /** Finds the k points closest to p, but only among those within distance d from p.
+   *  Same output as pointsWithinDistance cut after the first k elements.
+   *  May return less than k points, if there are not enough within d.
+   *
+   *  Boost's nearest query walks the tree closest nodes first and stops after k points, so the time does not
+   *  depend on how many points are in the box around p. Restricted to the box (the nearest k in the box are
+   *  the nearest k within d, if any), then the points beyond d are dropped.
+   */
+    void nearestPointsWithinDistance(const POINT& p, 
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+    KNearestCandidates<POINT> nearest(k, d * d, output);
+    if (k != 0) {
+        const boostPoint center(p.x, p.y, p.z);
+        offerNearest(p, rtreeIndex.qbegin(boost::geometry::index::intersects(BoxAround(p, d)) &&
+                                          boost::geometry::index::nearest(center, static_cast<unsigned>(k))),
+                     nearest);
+        visitStagedPointsInBox(p, d, [&](const geoIndex_PointWithIndex& candidate) {
+            nearest.offer(candidate.index, SquaredDistance(p, ToPoint(candidate)));
+        });
+    }
+    nearest.sort();
+  }
+  
+  /** Finds the k points closest to p, wherever they are: no culling distance to guess.
+   *  Returns less than k points only if the index has less than k points.
+   */
+    void nearestPoints(const POINT& p,
+                       const size_t k,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+    KNearestCandidates<POINT> nearest(k, std::numeric_limits<typename PointTraits<POINT>::coordinate>::max(), output);
+    if (k != 0) {
+        const boostPoint center(p.x, p.y, p.z);
+        offerNearest(p, rtreeIndex.qbegin(boost::geometry::index::nearest(center, static_cast<unsigned>(k))), nearest);
+        for (const geoIndex_PointWithIndex& notInTree : staged)
+            nearest.offer(notInTree.index, SquaredDistance(p, ToPoint(notInTree)));
+    }
+    nearest.sort();
+  }
                     
 private:
     
     
     
-  boost::geometry::index::rtree<
-        geoIndex_PointWithIndex , 
-        boost::geometry::index::linear<16>  // quadratic and rstar are faster, but creating the index takes so long it is not convenient. 
-    > rtreeIndex;
+  static boostBox BoxAround(const POINT& p, const typename PointTraits<POINT>::coordinate d) {
+    const boostPoint top(p.x + d, p.y + d, p.z + d);
+    const boostPoint bottom(p.x - d, p.y - d, p.z - d);
+    return boostBox(bottom, top);
+  }
+  
+  static POINT ToPoint(const geoIndex_PointWithIndex& withIndex) {
+    POINT point;
+    point.x = withIndex.x;
+    point.y = withIndex.y;
+    point.z = withIndex.z;
+    return point;
+  }
+  
+  /** Offers the points of a nearest query to the candidates. */
+  template <typename QUERY_ITERATOR>
+  void offerNearest(const POINT& p, QUERY_ITERATOR candidate, KNearestCandidates<POINT>& nearest) const {
+    for (; candidate != rtreeIndex.qend(); ++candidate)
+        nearest.offer(candidate->index, SquaredDistance(p, ToPoint(*candidate)));
+  }
+  
+  /** Calls visitor(point index, squared distance from p) for the points in the box of side 2d around p. */
+  template <typename VISITOR>
+  void visitPointsInBox(const POINT& p, 
+                        const typename PointTraits<POINT>::coordinate d,
+                        VISITOR visitor) const {
+    // Query iterators: no copy of the points in the box.
+    const auto visitWithDistance = [&](const geoIndex_PointWithIndex& candidate) {
+        visitor(candidate.index, SquaredDistance(p, ToPoint(candidate)));
+    };
+    std::for_each(rtreeIndex.qbegin(boost::geometry::index::intersects(BoxAround(p, d))),
+                  rtreeIndex.qend(),
+                  visitWithDistance);
+    visitStagedPointsInBox(p, d, visitWithDistance);
+  }
+  
+  /** Calls visitor(point) for the points not in the tree yet, in the box of side 2d around p. */
+  template <typename VISITOR>
+  void visitStagedPointsInBox(const POINT& p, 
+                              const typename PointTraits<POINT>::coordinate d,
+                              VISITOR visitor) const {
+    for (const geoIndex_PointWithIndex& notInTree : staged)
+        if (std::abs(notInTree.x - p.x) <= d && std::abs(notInTree.y - p.y) <= d && std::abs(notInTree.z - p.z) <= d)
+            visitor(notInTree);
+  }
+    
+  typedef boost::geometry::index::rtree<geoIndex_PointWithIndex, PARAMETERS> rtree_type;
+    
+  /** Fewer than tree size / this new points are inserted one by one, more rebuild the whole tree. */
+  static const size_t maximumInsertedFraction = 8;
+    
+  rtree_type rtreeIndex;
+  std::vector<geoIndex_PointWithIndex> staged;  ///< Added since the last call to completed().
 };
 
 
@@ -3,6 +3,7 @@
 #include "BoostIndex.hpp"
 
 #include "Common.hpp"
+#include "NoIndex.hpp"
 #include "TestsForAllIndexes.hpp"
 
 
@@ -52,6 +53,155 @@ TEST(BoostIndex, pointsWithinDistance_squareDistance) {
     pointsWithinDistance_squareDistance(index);
 }
 
+TEST(BoostIndex, nearestPointsWithinDistance_closestK) {
+    BoostIndex<Point> index;
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(BoostIndex, nearestPointsWithinDistance_lessThanK) {
+    BoostIndex<Point> index;
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(BoostIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    BoostIndex<Point> index;
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+
+/* Specific tests for this implementation. */
+
+TEST(BoostIndex, pointsWithinDistance_lookupWithoutPreparation) {
+    const Point anyPoint{1, 55, 2};
+  
+    BoostIndex<Point> gi;
+    gi.index(anyPoint, 1);
+    // No call to completed(): the point is found anyway.
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+}
+
+TEST(BoostIndex, pointsWithinDistance_addPointsAfterCompletition) {
+    const Point anyPoint{1, 55, 2};
+  
+    BoostIndex<Point> gi;
+    gi.index(anyPoint, 1);
+    gi.completed();
+    gi.index(anyPoint, 2);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_INDEX_PRESENT(result, 1);
+    ASSERT_INDEX_PRESENT(result, 2);
+    
+    gi.completed();
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(2, result.size());
+}
+
+/* Some calls to completed() rebuild the packed tree, others insert few points in it. */
+template <typename GEOMETRY_INDEX>
+static void completedBetweenAdditions(GEOMETRY_INDEX& gi) {
+    NoIndex<Point> reference;
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    for (PointIndex i = 0; i < 20000; ++i) {
+        const Point p{static_cast<double>(i % 37), static_cast<double>(i % 101) / 3, static_cast<double>(i % 7) * 5};
+        reference.index(p, i);
+        gi.index(p, i);
+        if (i % 1499 == 0)
+            gi.completed();
+        
+        if (i % 997 == 0 || i == 19999) {
+            const Point lookup{static_cast<double>(i % 30), 10, 15};
+            reference.pointsWithinDistance(lookup, 4, expected);
+            gi.pointsWithinDistance(lookup, 4, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (const auto& hit : expected)
+                ASSERT_INDEX_PRESENT(result, hit.pointIndex);
+            
+            reference.nearestPointsWithinDistance(lookup, 4, 10, expected);
+            gi.nearestPointsWithinDistance(lookup, 4, 10, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t r = 0; r < result.size(); ++r)
+                ASSERT_NEAR(expected[r].geometricValue, result[r].geometricValue, 1e-9);
+        }
+    }
+}
+
+TEST(BoostIndex, index_completedBetweenAdditions) {
+    BoostIndex<Point> gi;
+    completedBetweenAdditions(gi);
+}
+
+TEST(BoostIndex, index_completedBetweenAdditions_otherParameters) {
+    // Smaller nodes than the default: a deeper tree, more splits on the insertions.
+    BoostIndex<Point, boost::geometry::index::quadratic<4> > quadratic;
+    completedBetweenAdditions(quadratic);
+    BoostIndex<Point, boost::geometry::index::linear<6, 2> > linear;
+    completedBetweenAdditions(linear);
+}
+
+TEST(BoostIndex, index_completedBetweenAdditions_runtimeParameters) {
+    BoostIndex<Point, boost::geometry::index::dynamic_linear> linear(boost::geometry::index::dynamic_linear(6));
+    completedBetweenAdditions(linear);
+    BoostIndex<Point, boost::geometry::index::dynamic_rstar> rstar(boost::geometry::index::dynamic_rstar(32, 10));
+    completedBetweenAdditions(rstar);
+}
+
+TEST(BoostIndex, nearestPoints_sameAsNoIndex) {
+    BoostIndex<Point> gi;
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 2000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23) + 0.5 * (i % 3)};
+        gi.index(p, i);
+        bruteForce.index(p, i);
+        if (i == 1500)
+            gi.completed();  // The last points are not in the tree yet.
+    }
+    
+    const std::vector<Point> references{{1.5, -2.5, 10.25}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (size_t k : {1, 7, 100}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, 100000, expected);
+            gi.nearestPoints(referencePoint, k, result);
+            
+            ASSERT_EQ(k, result.size());
+            for (size_t i = 0; i < k; ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);
+            
+            // With a culling distance: those among the above strictly within it.
+            const double d = 6;
+            bruteForce.nearestPointsWithinDistance(referencePoint, d, k, expected);
+            gi.nearestPointsWithinDistance(referencePoint, d, k, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t i = 0; i < result.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);
+        }
+}
+
+TEST(BoostIndex, nearestPoints_lessThanK) {
+    BoostIndex<Point> gi;
+    gi.index(Point{0, 0, 0}, 1);
+    gi.index(Point{30, -20, 10}, 2);
+    gi.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    gi.nearestPoints(Point{5, 5, 5}, 10, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(BoostIndex, index_duplicatedIndex) {
@@ -2,6 +2,7 @@
 #define GEOINDEX_COMMON
 
 #include <vector>
+#include <algorithm>
 #include "BasicGeometry.hpp"
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
@@ -48,6 +49,62 @@ using IndexAndSquaredDistance = IndexAndGeometry<POINT>;
 template <typename POINT>
 using IndexAndCoordinate = IndexAndGeometry<POINT>;
 
+
+/** Keeps the k points closest to a reference among those it is offered, for the k-nearest-neighbor searches.
+ * 
+ *  It is a max-heap (farthest point on top) that lives directly in the output vector, so it allocates nothing
+ *  more than the k results.
+ *  Once it has k points, only points closer than the farthest of them can get in. That is a smaller search limit,
+ *  that the indexes can read back from squaredLimit() to skip more points as the search goes on.
+ */
+template <typename POINT>
+class KNearestCandidates {
+public:
+    /** Cleans the output. The limit is a squared distance, like all the others, and is strict. */
+    KNearestCandidates(const size_t k,
+                       const typename PointTraits<POINT>::coordinate squaredLimit,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output) :
+        k(k),
+        limit(k == 0 ? 0 : squaredLimit), // Squared distances are never below 0: this refuses everything.
+        heap(output)
+    {
+        heap.clear();
+        heap.reserve(k);
+    }
+    
+    /** Only points strictly closer than this (squared) distance can still enter the k nearest. */
+    typename PointTraits<POINT>::coordinate squaredLimit() const {
+        return limit;
+    }
+    
+    void offer(const typename PointTraits<POINT>::index pointIndex,
+               const typename PointTraits<POINT>::coordinate squaredDistance) {
+        if (! (squaredDistance < limit))
+            return;
+        
+        if (heap.size() == k) {
+            std::pop_heap(std::begin(heap), std::end(heap), SortByGeometry<POINT>);
+            heap.back() = {pointIndex, squaredDistance};
+        } else
+            heap.push_back({pointIndex, squaredDistance});
+        
+        std::push_heap(std::begin(heap), std::end(heap), SortByGeometry<POINT>);
+        
+        if (heap.size() == k)
+            limit = heap.front().geometricValue;
+    }
+    
+    /** Puts the points in the output in distance order, closest first. Call it once, at the end. */
+    void sort() {
+        std::sort_heap(std::begin(heap), std::end(heap), SortByGeometry<POINT>);
+    }
+    
+private:
+    const size_t k;
+    typename PointTraits<POINT>::coordinate limit;
+    std::vector<IndexAndSquaredDistance<POINT> >& heap;
+};
+
 #ifdef GEO_INDEX_SAFETY_CHECKS
 
 template <typename POINT_COORDINATE>
@@ -71,7 +128,7 @@ void CheckMeaningfulDistance(const DISTANCE_TYPE d) {
   * but may still help to smoke out bugs. */
 template <typename T>
 void StopSumOverflow(const T a, const T b) {
-    if (std::numeric_limits<T>::max() - a < b)
+    if (b > 0 && a > std::numeric_limits<T>::max() - b)  // Written this way, the check itself can not overflow.
         throw std::runtime_error("Sum about to overflow.");
     
 }
@@ -81,7 +138,7 @@ void StopSumOverflow(const T a, const T b) {
   * but may still help to smoke out bugs. */
 template <typename T>
 void StopDifferenceUnderflow(const T a, const T b) {
-    if (a < std::numeric_limits<T>::min() + b)
+    if (b > 0 && a < std::numeric_limits<T>::min() + b)
         throw std::runtime_error("Difference about to underflow.");
     
 }
@@ -4,6 +4,8 @@
 
 #include <algorithm>
 #include <vector>
+#include <limits>
+#include <cstdint>
 
 #include "BasicGeometry.hpp"
 
@@ -44,6 +46,63 @@ TEST(IndexAndGeometry, SortByPointIndex) {
     ASSERT_EQ(200, pointsToSort.at(2).pointIndex);
 }
 
+TEST(KNearestCandidates, keepsTheClosest) {
+    std::vector<IndexAndSquaredDistance<Point> > output;
+    KNearestCandidates<Point> nearest(2, 100, output);
+    
+    nearest.offer(1, 50);
+    nearest.offer(2, 10);
+    nearest.offer(3, 30);
+    nearest.offer(4, 40);
+    nearest.sort();
+    
+    ASSERT_EQ(2, output.size());
+    ASSERT_EQ(2, output.at(0).pointIndex);
+    ASSERT_EQ(3, output.at(1).pointIndex);
+}
+
+TEST(KNearestCandidates, limitShrinksWhenFull) {
+    std::vector<IndexAndSquaredDistance<Point> > output;
+    KNearestCandidates<Point> nearest(2, 100, output);
+    
+    nearest.offer(1, 50);
+    ASSERT_EQ(100, nearest.squaredLimit());
+    
+    nearest.offer(2, 70);
+    ASSERT_EQ(70, nearest.squaredLimit());
+    
+    nearest.offer(3, 20);
+    ASSERT_EQ(50, nearest.squaredLimit());
+}
+
+TEST(KNearestCandidates, strictLimit) {
+    std::vector<IndexAndSquaredDistance<Point> > output;
+    KNearestCandidates<Point> nearest(2, 100, output);
+    
+    nearest.offer(1, 100);
+    nearest.sort();
+    
+    ASSERT_TRUE(output.empty());
+}
+
+TEST(KNearestCandidates, cleansOutput) {
+    std::vector<IndexAndSquaredDistance<Point> > output{{1, 1}, {2, 2}};
+    KNearestCandidates<Point> nearest(2, 100, output);
+    nearest.sort();
+    
+    ASSERT_TRUE(output.empty());
+}
+
+TEST(KNearestCandidates, zeroK) {
+    std::vector<IndexAndSquaredDistance<Point> > output;
+    KNearestCandidates<Point> nearest(0, 100, output);
+    
+    nearest.offer(1, 0);
+    nearest.sort();
+    
+    ASSERT_TRUE(output.empty());
+}
+
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(CheckOverflow, NoOverflow) {
     ASSERT_NO_THROW(CheckOverflow<double>(29));
@@ -81,6 +140,11 @@ TEST(StopSumOverflow, Negatives) {
     ASSERT_NO_THROW(StopSumOverflow<int8_t>(127, -1));
 }
 
+TEST(StopSumOverflow, NegativeFirstTerm) {
+    ASSERT_NO_THROW(StopSumOverflow<int64_t>(-2, 3));
+    ASSERT_ANY_THROW(StopSumOverflow<int64_t>(std::numeric_limits<int64_t>::max(), 1));
+}
+
 TEST(StopDifferenceUnderflow, Ok) {
     ASSERT_NO_THROW(StopDifferenceUnderflow<int>(1, 1));
 }
@@ -92,6 +156,11 @@ TEST(StopDifferenceUnderflow, BelowMin) {
 TEST(StopDifferenceUnderflow, Negatives) {
     ASSERT_NO_THROW(StopDifferenceUnderflow<int8_t>(1, -2));
 }
+
+TEST(StopDifferenceUnderflow, NegativeSecondTerm) {
+    ASSERT_NO_THROW(StopDifferenceUnderflow<int64_t>(0, -2));
+    ASSERT_ANY_THROW(StopDifferenceUnderflow<int64_t>(std::numeric_limits<int64_t>::min(), 1));
+}
 #endif
 
 }
\ No newline at end of file
@@ -0,0 +1,461 @@
+#ifndef GEOINDEX_CONCURRENT_CUBE_INDEX
+#define GEOINDEX_CONCURRENT_CUBE_INDEX
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+
+#include "Common.hpp"
+#include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+#include "CubeIndex.hpp"
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+    #include <unordered_set>
+#endif
+
+namespace geoIndex {
+
+/** Same cubes as CubeIndex, for many threads that look up while one thread adds points.
+ *
+ *  The lookups work on a snapshot: an immutable version of the index, published by completed().
+ *  Readers never wait for the writer to build a version and never see a half-done update: the points indexed after
+ *  the last completed() are invisible until the next one.
+ *
+ *  Getting the snapshot from the shared pointer is not free: a std::atomic_load of a shared_ptr takes a short lock
+ *  from a global pool of mutexes in libstdc++ (and in most standard libraries before C++20), plus an increment and
+ *  a decrement of the reference count that all the readers share. So the lookups of this class do not do it every
+ *  time: each thread keeps the last snapshot it used in a thread_local cache, and loads it again only when
+ *  completed() has published a new version since (an atomic counter tells). A lookup reads that counter and nothing
+ *  else shared: no lock, no reference count.
+ *  The price: the cache of a thread keeps its snapshot alive (and the memory of the old cubes with it) until that
+ *  thread looks up again, on a newer version or on another index, or ends.
+ *
+ *  Copy on write: a new version shares everything with the previous one, except the cubes that got new points
+ *  (copied with the new points) and the shards of the cube table where those cubes are (copied too, they are small).
+ *  Everything is reference counted: the memory of the old cubes goes back to the system when the last snapshot
+ *  that uses them is dropped, i.e. when no reader works on the old version anymore.
+ *
+ *  index() and completed() can be called from any thread, but they are serialized between them.
+ */
+template <typename POINT>
+class ConcurrentCubeIndex {
+    struct StagedPoint;
+    struct CubePoints;
+    struct Shard;
+
+    /** The cubes out of the range of the keys (see CubeKey), on their full coordinates. Usually empty. */
+    typedef std::unordered_map<CubeCoordinates, std::shared_ptr<const CubePoints>, CubeCoordinatesHash> FarCubes;
+
+public:
+    /** An immutable version of the index. */
+    class Snapshot {
+    public:
+        /** How many points this version has. */
+        size_t size() const {
+            return pointCount;
+        }
+
+        void pointsWithinDistance(const POINT& p,
+                                  const typename PointTraits<POINT>::coordinate d,
+                                  std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                CheckMeaningfulDistance(d);
+            #endif
+
+            const auto distanceLimit = d * d;
+
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                CheckOverflow(distanceLimit);
+            #endif
+
+            output.clear();
+            scanCubes(p, d, distanceLimit, [&](const CubePoints& cube) {
+                AppendPointsWithinSquaredDistance(p,
+                                                  distanceLimit,
+                                                  cube.coordinatesX.data(),
+                                                  cube.coordinatesY.data(),
+                                                  cube.coordinatesZ.data(),
+                                                  cube.indices.data(),
+                                                  cube.indices.size(),
+                                                  output);
+                return distanceLimit;
+            });
+
+            std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+        }
+
+        /** Finds the k points closest to p, but only among those within distance d from p.
+         *  Same output as pointsWithinDistance cut after the first k elements. */
+        void nearestPointsWithinDistance(const POINT& p,
+                                         const typename PointTraits<POINT>::coordinate d,
+                                         const size_t k,
+                                         std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                CheckMeaningfulDistance(d);
+            #endif
+
+            const auto distanceLimit = d * d;
+
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                CheckOverflow(distanceLimit);
+            #endif
+
+            KNearestCandidates<POINT> nearest(k, distanceLimit, output);
+            std::vector<IndexAndSquaredDistance<POINT> > hitsInCube;
+            scanCubes(p, d, distanceLimit, [&](const CubePoints& cube) {
+                hitsInCube.clear();
+                AppendPointsWithinSquaredDistance(p,
+                                                  nearest.squaredLimit(),
+                                                  cube.coordinatesX.data(),
+                                                  cube.coordinatesY.data(),
+                                                  cube.coordinatesZ.data(),
+                                                  cube.indices.data(),
+                                                  cube.indices.size(),
+                                                  hitsInCube);
+                for (const auto& hit : hitsInCube)
+                    nearest.offer(hit.pointIndex, hit.geometricValue);
+                return nearest.squaredLimit();
+            });
+
+            nearest.sort();
+        }
+
+    private:
+        friend class ConcurrentCubeIndex;
+
+        explicit Snapshot(const typename PointTraits<POINT>::coordinate cubeSide) :
+            gridStep(cubeSide),
+            shards(shardCount),
+            farCubes(std::make_shared<FarCubes>()),
+            pointCount(0),
+            occupied{0, 0, 0, 0, 0, 0}
+        {
+            const std::shared_ptr<const Shard> empty = std::make_shared<Shard>();
+            for (auto& shard : shards)
+                shard = empty;
+        }
+
+        const typename PointTraits<POINT>::coordinate gridStep;
+        std::vector<std::shared_ptr<const Shard> > shards;
+        std::shared_ptr<const FarCubes> farCubes;
+        size_t pointCount;
+        CubeBounds occupied;  ///< The smallest block with all the cubes. Meaningless without points.
+
+        const CubePoints* find(const CubicCoordinate i, const CubicCoordinate j, const CubicCoordinate k) const {
+            if (! FitsInCubeKey(i, j, k)) {
+                if (farCubes->empty())
+                    return nullptr;
+                const auto found = farCubes->find(CubeCoordinates{i, j, k});
+                return found == farCubes->end() ? nullptr : found->second.get();
+            }
+
+            const CubeKey key = MakeCubeKey(i, j, k);
+            const Shard& shard = *shards[ShardOf(key)];
+            const uint32_t position = shard.positions.find(key);
+            if (position == CubeKeyTable::notFound)
+                return nullptr;
+            return shard.cubes[position].get();
+        }
+
+        /** Calls visit on the cubes that may have points closer than d, skipping rows and cubes that are farther
+         *  than the squared limit. visit returns the new limit (smaller, once the k nearest candidates are found). */
+        template <typename VISIT>
+        void scanCubes(const POINT& p,
+                       const typename PointTraits<POINT>::coordinate d,
+                       typename PointTraits<POINT>::coordinate squaredLimit,
+                       VISIT visit) const
+        {
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                if (d / gridStep >= cubeKeyBias)
+                    throw std::runtime_error("Scan distance overflow");
+            #endif
+
+            const CubicCoordinate iReference = spaceToCubic(p.x);
+            const CubicCoordinate jReference = spaceToCubic(p.y);
+            const CubicCoordinate kReference = spaceToCubic(p.z);
+            const CubicCoordinate scanDistance = static_cast<CubicCoordinate>(d / gridStep) + 1;
+
+            // Only where there are cubes: a big d must not cost more than the whole index.
+            if (pointCount == 0)
+                return;
+            const CubicCoordinate kFirst = std::max(kReference - scanDistance, occupied.kLowest);
+            const CubicCoordinate kLast = std::min(kReference + scanDistance, occupied.kHighest);
+            for (CubicCoordinate i = std::max(iReference - scanDistance, occupied.iLowest);
+                 i <= std::min(iReference + scanDistance, occupied.iHighest); i++)
+                for (CubicCoordinate j = std::max(jReference - scanDistance, occupied.jLowest);
+                     j <= std::min(jReference + scanDistance, occupied.jHighest); j++) {
+                    const typename PointTraits<POINT>::coordinate xDistance = distanceFromSide(p.x, i);
+                    const typename PointTraits<POINT>::coordinate yDistance = distanceFromSide(p.y, j);
+                    const typename PointTraits<POINT>::coordinate rowDistance = xDistance * xDistance + yDistance * yDistance;
+                    if (! (rowDistance < squaredLimit))
+                        continue;
+
+                    for (CubicCoordinate k = kFirst; k <= kLast; k++) {
+                        const typename PointTraits<POINT>::coordinate zDistance = distanceFromSide(p.z, k);
+                        if (! (rowDistance + zDistance * zDistance < squaredLimit))
+                            continue;
+
+                        const CubePoints* cube = find(i, j, k);
+                        if (cube != nullptr)
+                            squaredLimit = visit(*cube);
+                    }
+                }
+        }
+
+        CubicCoordinate spaceToCubic(const typename PointTraits<POINT>::coordinate coordinate) const {
+            return SpaceToCubic(coordinate, gridStep);
+        }
+
+        typename PointTraits<POINT>::coordinate distanceFromSide(const typename PointTraits<POINT>::coordinate coordinate,
+                                                                 const CubicCoordinate c) const
+        {
+            const typename PointTraits<POINT>::coordinate lowerSide = c * gridStep;
+            const typename PointTraits<POINT>::coordinate upperSide = lowerSide + gridStep;
+            if (coordinate < lowerSide)
+                return lowerSide - coordinate;
+            if (coordinate > upperSide)
+                return coordinate - upperSide;
+            return 0;
+        }
+    };
+
+    /** Creates an index that divides the space in cubes of the given side size. */
+    explicit ConcurrentCubeIndex(const typename PointTraits<POINT>::coordinate cubeSide) :
+        id(NewId()),
+        version(0),
+        gridStep(cubeSide),
+        latest(new Snapshot(cubeSide))
+    {
+        std::atomic_store(&published, latest);
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(cubeSide);
+        #endif
+    }
+
+    ConcurrentCubeIndex(const ConcurrentCubeIndex&) = delete;
+    ConcurrentCubeIndex& operator=(const ConcurrentCubeIndex&) = delete;
+
+    /** Adds a point to the index. The lookups see it after the next completed(). */
+    void index(const POINT& p, const typename PointTraits<POINT>::index index) {
+        std::lock_guard<std::mutex> oneWriterAtATime(writerMutex);
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (! indexedPoints.insert(index).second)
+                throw std::runtime_error("ConcurrentCubeIndex::index Point indexed twice");
+        #endif
+
+        const CubicCoordinate i = SpaceToCubic(p.x, gridStep);
+        const CubicCoordinate j = SpaceToCubic(p.y, gridStep);
+        const CubicCoordinate k = SpaceToCubic(p.z, gridStep);
+
+        staged.push_back({CubeCoordinates{i, j, k}, p.x, p.y, p.z, index});
+    }
+
+    /** Publishes a new version with the points indexed since the last call.
+     *  The lookups already running go on with the version they started with. */
+    void completed() {
+        std::lock_guard<std::mutex> oneWriterAtATime(writerMutex);
+
+        if (staged.empty())
+            return;
+
+        const std::shared_ptr<const Snapshot> current = latest;
+        std::shared_ptr<Snapshot> next(new Snapshot(*current));  // Shares all the shards, for now.
+        next->pointCount += staged.size();
+
+        std::sort(staged.begin(), staged.end(),
+                  [](const StagedPoint& a, const StagedPoint& b) { return a.cube < b.cube; });
+
+        std::vector<std::shared_ptr<Shard> > copiedShards(shardCount);
+        std::shared_ptr<FarCubes> copiedFarCubes;
+        for (size_t begin = 0; begin < staged.size(); ) {
+            const CubeCoordinates c = staged[begin].cube;
+            size_t end = begin + 1;
+            while (end < staged.size() && staged[end].cube == c)
+                ++end;
+            extendBounds(*next, c, current->pointCount == 0 && begin == 0);
+
+            if (! FitsInCubeKey(c.i, c.j, c.k)) {
+                // Rare: the whole map is copied, once per version.
+                if (! copiedFarCubes) {
+                    copiedFarCubes = std::make_shared<FarCubes>(*current->farCubes);
+                    next->farCubes = copiedFarCubes;
+                }
+                std::shared_ptr<const CubePoints>& slot = (*copiedFarCubes)[c];
+                slot = appendToCopy(slot, begin, end);
+                begin = end;
+                continue;
+            }
+
+            const CubeKey key = MakeCubeKey(c.i, c.j, c.k);
+            const size_t s = ShardOf(key);
+            if (! copiedShards[s]) {
+                copiedShards[s] = std::make_shared<Shard>(*current->shards[s]);
+                next->shards[s] = copiedShards[s];
+            }
+            Shard& shard = *copiedShards[s];
+
+            const uint32_t position = shard.positions.findOrInsert(key, static_cast<uint32_t>(shard.cubes.size()));
+            if (position == shard.cubes.size())
+                shard.cubes.push_back(appendToCopy(nullptr, begin, end));
+            else
+                shard.cubes[position] = appendToCopy(shard.cubes[position], begin, end);
+
+            begin = end;
+        }
+        staged.clear();
+
+        latest = next;
+        std::atomic_store(&published, latest);
+        version.fetch_add(1, std::memory_order_release);  // After the store: a reader that sees it loads the new one.
+    }
+
+    /** The last published version. Keeping it keeps its memory alive, even after newer versions come.
+     *  Takes the lock of std::atomic_load (see above): get it once for many lookups, not once per lookup. */
+    std::shared_ptr<const Snapshot> snapshot() const {
+        return std::atomic_load(&published);
+    }
+
+    /** On the last published version, through the cache of the thread (see above). */
+    void pointsWithinDistance(const POINT& p,
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        cachedSnapshot().pointsWithinDistance(p, d, output);
+    }
+
+    void nearestPointsWithinDistance(const POINT& p,
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        cachedSnapshot().nearestPointsWithinDistance(p, d, k, output);
+    }
+
+private:
+    static const size_t shardCount = 256;
+
+    /** Tells the indexes apart in the caches of the threads, even one made where a destroyed one was. Never 0. */
+    static uint64_t NewId() {
+        static std::atomic<uint64_t> lastId(0);
+        return ++lastId;
+    }
+
+    /** As in CubeIndex. */
+    static CubicCoordinate SpaceToCubic(const typename PointTraits<POINT>::coordinate coordinate,
+                                        const typename PointTraits<POINT>::coordinate gridStep) {
+        const typename PointTraits<POINT>::coordinate beforeTruncation = std::floor(coordinate / gridStep);
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (beforeTruncation > std::numeric_limits<CubicCoordinate>::max())
+                throw std::runtime_error("Cubic coordinate overflow");
+        #endif
+        return static_cast<CubicCoordinate>(beforeTruncation);
+    }
+
+    /** The last published version, as this thread last loaded it: loaded again only if the version counter
+     *  changed since, or if the thread last looked up on another index. Valid until the next call in the thread. */
+    const Snapshot& cachedSnapshot() const {
+        struct Cache {
+            uint64_t owner;
+            uint64_t version;
+            std::shared_ptr<const Snapshot> snapshot;
+        };
+        static thread_local Cache cache{0, 0, nullptr};
+
+        const uint64_t current = version.load(std::memory_order_acquire);
+        if (cache.owner != id || cache.version != current) {
+            cache.snapshot = std::atomic_load(&published);
+            cache.owner = id;
+            cache.version = current;
+        }
+        return *cache.snapshot;
+    }
+
+    /** Grows the block of the occupied cubes of the snapshot to the cube (or starts it there). */
+    static void extendBounds(Snapshot& snapshot, const CubeCoordinates& c, const bool first) {
+        CubeBounds& occupied = snapshot.occupied;
+        if (first) {
+            occupied = CubeBounds{c.i, c.i, c.j, c.j, c.k, c.k};
+            return;
+        }
+        occupied.iLowest = std::min(occupied.iLowest, c.i);
+        occupied.iHighest = std::max(occupied.iHighest, c.i);
+        occupied.jLowest = std::min(occupied.jLowest, c.j);
+        occupied.jHighest = std::max(occupied.jHighest, c.j);
+        occupied.kLowest = std::min(occupied.kLowest, c.k);
+        occupied.kHighest = std::max(occupied.kHighest, c.k);
+    }
+
+    /** A different multiplier than the one of CubeKeyTable, so that the keys of a shard still spread over its table. */
+    static size_t ShardOf(const CubeKey key) {
+        return static_cast<size_t>((key * 0xD6E8FEB86659FD93ull) >> 56);
+    }
+
+    /** A point waiting for the next completed(), with its cube. */
+    struct StagedPoint {
+        CubeCoordinates cube;
+        typename PointTraits<POINT>::coordinate x;
+        typename PointTraits<POINT>::coordinate y;
+        typename PointTraits<POINT>::coordinate z;
+        typename PointTraits<POINT>::index pointIndex;
+    };
+
+    /** The points of a cube, as a structure of arrays. Never changed once published. */
+    struct CubePoints {
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+        std::vector<typename PointTraits<POINT>::index> indices;
+
+        void append(const StagedPoint& point) {
+            coordinatesX.push_back(point.x);
+            coordinatesY.push_back(point.y);
+            coordinatesZ.push_back(point.z);
+            indices.push_back(point.pointIndex);
+        }
+    };
+
+    /** A slice of the cube table: the cubes whose keys hash there. */
+    struct Shard {
+        CubeKeyTable positions;
+        std::vector<std::shared_ptr<const CubePoints> > cubes;
+    };
+
+    /** A new cube with the points of the old one (null for none) and the staged points from begin to end.
+     *  The old one stays as it is: readers may be scanning it. */
+    std::shared_ptr<const CubePoints> appendToCopy(const std::shared_ptr<const CubePoints>& old,
+                                                   const size_t begin,
+                                                   const size_t end) const {
+        const std::shared_ptr<CubePoints> cube = old ? std::make_shared<CubePoints>(*old) : std::make_shared<CubePoints>();
+        for (size_t p = begin; p < end; ++p)
+            cube->append(staged[p]);
+        return cube;
+    }
+
+    const uint64_t id;
+    std::atomic<uint64_t> version;  ///< How many versions completed() published: tells the caches to load again.
+    std::shared_ptr<const Snapshot> published;  ///< Only through std::atomic_load and std::atomic_store.
+
+    // Writer side, protected by writerMutex.
+    std::mutex writerMutex;
+    const typename PointTraits<POINT>::coordinate gridStep;
+    std::shared_ptr<const Snapshot> latest;  ///< The same as published, without the atomic_load.
+    std::vector<StagedPoint> staged;  ///< Indexed, not published yet.
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        std::unordered_set<typename PointTraits<POINT>::index> indexedPoints;
+    #endif
+};
+
+template <typename POINT>
+const size_t ConcurrentCubeIndex<POINT>::shardCount;
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include "gtest/gtest.h"
+
+#include "ConcurrentCubeIndex.hpp"
+
+#include <vector>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include "Common.hpp"
+#include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+using namespace std;
+
+namespace geoIndex {
+
+static const PointTraits<Point>::coordinate gridStep = 10.0;
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_samePoint) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_samePoint(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_coincidentPoints) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_coincidentPoints(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_noPoints) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_noPoints(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_onlyFarPoints) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_onlyFarPoints(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_inAndOutPoints) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_inAndOutPoints(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_exactDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_exactDistance(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_outputOrder) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_outputOrder(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_squareDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_squareDistance(index);
+}
+
+TEST(ConcurrentCubeIndex, nearestPointsWithinDistance_closestK) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(ConcurrentCubeIndex, nearestPointsWithinDistance_lessThanK) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(ConcurrentCubeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(ConcurrentCubeIndex, index_duplicatedIndex) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    index_duplicatedIndex(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_negativeDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_negativeDistance(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_zeroDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_zeroDistance(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_NanDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_NanDistance(index);
+}
+
+TEST(ConcurrentCubeIndex, pointsWithinDistance_overflowDistance) {
+    ConcurrentCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_overflowDistance(index);
+}
+
+#endif
+
+
+/* Specific tests for this implementation. */
+
+TEST(ConcurrentCubeIndex, invisibleUntilCompleted) {
+    ConcurrentCubeIndex<Point> index(10);
+    index.index(Point{0, 0, 0}, 1);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_TRUE(result.empty());
+    
+    index.completed();
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(1, result.size());
+}
+
+TEST(ConcurrentCubeIndex, oldSnapshotsDoNotChange) {
+    ConcurrentCubeIndex<Point> index(10);
+    index.index(Point{0, 0, 0}, 1);
+    index.completed();
+    
+    const std::shared_ptr<const ConcurrentCubeIndex<Point>::Snapshot> before = index.snapshot();
+    index.index(Point{0, 0, 0.5}, 2);  // Same cube: copied, not changed.
+    index.index(Point{50, 0, 0}, 3);  // New cube.
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    before->pointsWithinDistance(Point{0, 0, 0}, 100, result);
+    ASSERT_EQ(1, before->size());
+    ASSERT_EQ(1, result.size());
+    
+    index.snapshot()->pointsWithinDistance(Point{0, 0, 0}, 100, result);
+    ASSERT_EQ(3, index.snapshot()->size());
+    ASSERT_EQ(3, result.size());
+}
+
+TEST(ConcurrentCubeIndex, sameAsNoIndex) {
+    ConcurrentCubeIndex<Point> concurrent(2);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 5000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23)};
+        concurrent.index(p, i);
+        bruteForce.index(p, i);
+        if (i % 1000 == 999)
+            concurrent.completed();  // Several versions, each one copying some cubes of the previous.
+    }
+    
+    const Point referencePoint{1.5, -2.5, 10.25};
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    bruteForce.pointsWithinDistance(referencePoint, 15, expected);
+    concurrent.pointsWithinDistance(referencePoint, 15, result);
+    
+    ASSERT_EQ(expected.size(), result.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+    
+    concurrent.nearestPointsWithinDistance(referencePoint, 15, 10, result);
+    ASSERT_EQ(10, result.size());
+    for (size_t i = 0; i < result.size(); ++i)
+        ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+}
+
+TEST(ConcurrentCubeIndex, readersWhileWriting) {
+    // Points on a line, published in batches: a reader must always see a whole number of batches.
+    static const PointIndex batchSize = 100;
+    static const PointIndex batches = 50;
+    ConcurrentCubeIndex<Point> index(10);
+    std::atomic<bool> writing(true);
+    std::atomic<bool> consistent(true);
+    
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r)
+        readers.emplace_back([&index, &writing, &consistent]() {
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            while (writing) {
+                index.pointsWithinDistance(Point{0, 0, 0}, 60, result);
+                if (result.size() % batchSize != 0)
+                    consistent = false;
+            }
+        });
+    
+    for (PointIndex b = 0; b < batches; ++b) {
+        for (PointIndex i = b * batchSize; i < (b + 1) * batchSize; ++i)
+            index.index(Point{0, 0, 0.01 * i}, i);
+        index.completed();
+    }
+    writing = false;
+    for (auto& reader : readers)
+        reader.join();
+    
+    ASSERT_TRUE(consistent);
+    ASSERT_EQ(batchSize * batches, index.snapshot()->size());
+}
+
+
+TEST(ConcurrentCubeIndex, severalIndexesInTheSameThread) {
+    // The lookups of a thread go through the same cache: each index must still see its own last version.
+    ConcurrentCubeIndex<Point> first(10);
+    ConcurrentCubeIndex<Point> second(10);
+    first.index(Point{0, 0, 0}, 1);
+    first.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    for (PointIndex i = 0; i < 3; ++i) {
+        second.index(Point{0, 0, 0.1 * (i + 1)}, 10 + i);
+        second.completed();
+        first.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+        ASSERT_EQ(1, result.size());
+        second.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+        ASSERT_EQ(i + 1, result.size());
+    }
+    
+    for (int again = 0; again < 3; ++again) {
+        // Likely at the same address as the last one: not the same index.
+        ConcurrentCubeIndex<Point> other(10);
+        other.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+        ASSERT_TRUE(result.empty());
+        other.index(Point{0, 0, 0}, 1);
+        other.completed();
+        other.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+        ASSERT_EQ(1, result.size());
+    }
+}
+
+TEST(ConcurrentCubeIndex, bigDistanceScansOnlyTheOccupiedCubes) {
+    // Small cubes, huge distance: 10^10 rows of cubes around the reference, only 2 cubes with points.
+    ConcurrentCubeIndex<Point> index(1);
+    index.index(Point{0, 0, 0}, 1);
+    index.index(Point{3, 4, 5}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{-20000, 20000, 0}, 50000, result);
+    ASSERT_EQ(2, result.size());
+    index.nearestPointsWithinDistance(Point{-20000, 20000, 0}, 50000, 1, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(2, result[0].pointIndex);  // A bit closer to the reference than the origin.
+    
+    ConcurrentCubeIndex<Point> empty(1);
+    empty.pointsWithinDistance(Point{0, 0, 0}, 50000, result);
+    ASSERT_TRUE(result.empty());
+}
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(ConcurrentCubeIndex, invalidCubeSize) {
+    ASSERT_ANY_THROW(ConcurrentCubeIndex<Point> index(0));
+}
+#endif
+
+TEST(ConcurrentCubeIndex, index_outsideTheKeyRange) {
+    // UTM coordinates in meters, small cubes: millions of cubes from the origin, beyond the range of the keys.
+    const Point utm{3000000.5, 5000000.5, 100.5};
+    ConcurrentCubeIndex<Point> index(1);
+    index.index(utm, 1);
+    index.index(Point{0, 0, 0}, 2);
+    index.completed();
+    
+    const std::shared_ptr<const ConcurrentCubeIndex<Point>::Snapshot> before = index.snapshot();
+    index.index(Point{utm.x + 0.25, utm.y, utm.z}, 3);  // Same far cube: copied, not changed.
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    before->pointsWithinDistance(utm, 2, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(1, result[0].pointIndex);
+    
+    index.pointsWithinDistance(utm, 2, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result[0].pointIndex);
+    ASSERT_EQ(3, result[1].pointIndex);
+    
+    index.nearestPointsWithinDistance(Point{0, 0, 0}, 2, 5, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(2, result[0].pointIndex);
+}
+
+}
@@ -2,76 +2,750 @@
 #define GEOINDEX_CUBE_INDEX
 
 #include <vector>
-#include <unordered_map>
+#include <utility>
 #include <algorithm>
 #include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
 
 #include "Common.hpp"
 #include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+#include "RadixSort.hpp"
+#include "WorkerPool.hpp"
+
+#include <limits>
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
-    #include <limits>
+    #include <unordered_set>
 #endif
 
 namespace geoIndex {
   
-    /** Space partition unit. Notice that we only know the indexes at this level. */
+    /** A point added to a cube after the last packing. Its coordinates come along with its index, so scanning a cube 
+     *  needs nothing else. The recent points of the same cube make a linked list. */
     template <typename POINT>
+    struct RecentPoint {
+        typename PointTraits<POINT>::coordinate x;
+        typename PointTraits<POINT>::coordinate y;
+        typename PointTraits<POINT>::coordinate z;
+        typename PointTraits<POINT>::index pointIndex;
+        size_t nextInCube;
+    };
+    
+    /** End of the list of recent points. */
+    static const size_t noRecentPoint = ~static_cast<size_t>(0);
+    
+    /** Space partition unit. Its points are in two places:
+     *  - those that were inside when the collection was last packed are in the arrays of the collection, 
+     *    from packedBegin to packedEnd (the cubes one after the other, in the order of their keys);
+     *  - those added later are in a list that starts at firstRecentPoint, until the next packing. */
     struct Cube {
-        std::vector<typename PointTraits<POINT>::index> indexOfPointsInside;
+        Cube() : packedBegin(0), packedEnd(0), firstRecentPoint(noRecentPoint) {}
+        
+        size_t packedBegin;
+        size_t packedEnd;
+        size_t firstRecentPoint;
     };
   
     typedef int64_t CubicCoordinate;
+    
+    /** The i, j, k coordinates of a cube packed in a single integer, 21 bits each (k in the lowest bits).
+     *  Coordinates are shifted by 2^20 so that negative values fit too: that covers about one million cubes on each
+     *  side of the origin, for each axis. The cubes farther than that (small cubes on real-world coordinates) have
+     *  no key: they go in a slower map, on their full coordinates. */
+    typedef uint64_t CubeKey;
+    
+    static const CubicCoordinate cubeKeyBias = static_cast<CubicCoordinate>(1) << 20;
+    
+    inline bool FitsInCubeKey(const CubicCoordinate i,
+                              const CubicCoordinate j,
+                              const CubicCoordinate k)
+    {
+        return -cubeKeyBias <= i && i < cubeKeyBias &&
+               -cubeKeyBias <= j && j < cubeKeyBias &&
+               -cubeKeyBias <= k && k < cubeKeyBias;
+    }
+    
+    inline CubeKey MakeCubeKey(const CubicCoordinate i,
+                               const CubicCoordinate j,
+                               const CubicCoordinate k)
+    {
+        return (static_cast<CubeKey>(i + cubeKeyBias) << 42) |
+               (static_cast<CubeKey>(j + cubeKeyBias) << 21) |
+                static_cast<CubeKey>(k + cubeKeyBias);
+    }
+
+    /** The i, j, k of a cube, without limits. Ordered like the keys (i, then j, then k). */
+    struct CubeCoordinates {
+        CubicCoordinate i;
+        CubicCoordinate j;
+        CubicCoordinate k;
+    };
+
+    inline bool operator==(const CubeCoordinates& lhs, const CubeCoordinates& rhs) {
+        return lhs.i == rhs.i && lhs.j == rhs.j && lhs.k == rhs.k;
+    }
+
+    inline bool operator<(const CubeCoordinates& lhs, const CubeCoordinates& rhs) {
+        if (lhs.i != rhs.i)
+            return lhs.i < rhs.i;
+        if (lhs.j != rhs.j)
+            return lhs.j < rhs.j;
+        return lhs.k < rhs.k;
+    }
+
+    inline CubeCoordinates CoordinatesOfCubeKey(const CubeKey key) {
+        return CubeCoordinates{static_cast<CubicCoordinate>((key >> 42) & 0x1FFFFF) - cubeKeyBias,
+                               static_cast<CubicCoordinate>((key >> 21) & 0x1FFFFF) - cubeKeyBias,
+                               static_cast<CubicCoordinate>(key & 0x1FFFFF) - cubeKeyBias};
+    }
+
+    struct CubeCoordinatesHash {
+        size_t operator()(const CubeCoordinates& c) const {
+            return static_cast<size_t>(static_cast<uint64_t>(c.i) * 0x9E3779B97F4A7C15ull ^
+                                       static_cast<uint64_t>(c.j) * 0xC2B2AE3D27D4EB4Full ^
+                                       static_cast<uint64_t>(c.k) * 0x165667B19E3779F9ull);
+        }
+    };
+
+    /** Where the cubes out of the key range are, in the array of the cubes. */
+    typedef std::unordered_map<CubeCoordinates, uint32_t, CubeCoordinatesHash> FarCubePositions;
+
+    
+    /** Allocates memory aligned on the cache lines (64 bytes on anything recent). 
+     *  The standard allocator does not care about alignas before C++17. */
+    template <typename T>
+    struct CacheLineAllocator {
+        typedef T value_type;
+        
+        CacheLineAllocator() {}
+        
+        template <typename U>
+        CacheLineAllocator(const CacheLineAllocator<U>&) {}
+        
+        T* allocate(const size_t n) {
+            void* memory = nullptr;
+            if (posix_memalign(&memory, 64, n * sizeof(T)) != 0)
+                throw std::bad_alloc();
+            return static_cast<T*>(memory);
+        }
+        
+        void deallocate(T* memory, const size_t) {
+            free(memory);
+        }
+    };
+    
+    template <typename T, typename U>
+    bool operator==(const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) { return true; }
+    
+    template <typename T, typename U>
+    bool operator!=(const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) { return false; }
+    
+    
+    /** Hash table from cube keys to positions (in some other array, up to the user).
+     *  Open addressing with linear probing: the keys are stored in the table itself, in buckets as big as
+     *  a cache line. A lookup hashes once, then reads one bucket. It moves to the next bucket only if this one
+     *  is full, which is rare as the table grows when it is 3/4 full.
+     *  Since the slots of a bucket are filled in order, the first empty slot ends the search:
+     *  looking for a cube that does not exist (the most common case when scanning around a point) usually costs a single
+     *  cache line.
+     */
+    class CubeKeyTable {
+    public:
+        static const uint32_t notFound = 0xFFFFFFFF;
+        
+        CubeKeyTable() :
+            buckets(initialBuckets, EmptyBucket()),
+            shift(64 - initialBucketsLog2),
+            usedSlots(0)
+        {}
+
+        
+        uint32_t find(const CubeKey key) const {
+            for (size_t b = bucketOf(key); ; b = (b + 1) & (buckets.size() - 1)) {
+                const Bucket& bucket = buckets[b];
+                for (size_t slot = 0; slot < slotsPerBucket; ++slot) {
+                    if (bucket.keys[slot] == key)
+                        return bucket.positions[slot];
+                    if (bucket.keys[slot] == emptyKey)
+                        return notFound;
+                }
+            }
+        }
+        
+        /** Returns the position of the key. If it is not in the table, adds it with the new position. */
+        uint32_t findOrInsert(const CubeKey key, const uint32_t positionIfNew) {
+            const uint32_t found = find(key);
+            if (found != notFound)
+                return found;
+            
+            if (4 * (usedSlots + 1) > 3 * buckets.size() * slotsPerBucket)
+                grow();
+            
+            place(key, positionIfNew);
+            ++usedSlots;
+            return positionIfNew;
+        }
+        
+        size_t size() const {
+            return usedSlots;
+        }
+        
+        /** Grows the table once, now, instead of many times while inserting that many keys. */
+        void reserve(const size_t keys) {
+            while (4 * keys > 3 * buckets.size() * slotsPerBucket)
+                grow();
+        }
+        
+    private:
+        static const size_t slotsPerBucket = 5;
+        static const unsigned initialBucketsLog2 = 4;
+        static const size_t initialBuckets = static_cast<size_t>(1) << initialBucketsLog2;
+        static const CubeKey emptyKey = ~static_cast<CubeKey>(0);  // Real keys use only 63 bits.
+        
+        struct alignas(64) Bucket {
+            CubeKey keys[slotsPerBucket];
+            uint32_t positions[slotsPerBucket];
+        };
+        static_assert(sizeof(Bucket) == 64, "A bucket must fill exactly a cache line.");
+        
+        static Bucket EmptyBucket() {
+            Bucket empty;
+            for (size_t slot = 0; slot < slotsPerBucket; ++slot) {
+                empty.keys[slot] = emptyKey;
+                empty.positions[slot] = notFound;
+            }
+            return empty;
+        }
+        
+        std::vector<Bucket, CacheLineAllocator<Bucket> > buckets;  ///< Always a power of 2 of them.
+        unsigned shift;  ///< To keep the highest bits of the hash, as many as needed to pick a bucket.
+        size_t usedSlots;
+        
+        /** Fibonacci hashing: the multiplication mixes all the bits of the key into the highest ones. */
+        size_t bucketOf(const CubeKey key) const {
+            return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> shift);
+        }
+        
+        void place(const CubeKey key, const uint32_t position) {
+            for (size_t b = bucketOf(key); ; b = (b + 1) & (buckets.size() - 1)) {
+                Bucket& bucket = buckets[b];
+                for (size_t slot = 0; slot < slotsPerBucket; ++slot)
+                    if (bucket.keys[slot] == emptyKey) {
+                        bucket.keys[slot] = key;
+                        bucket.positions[slot] = position;
+                        return;
+                    }
+            }
+        }
+        
+        void grow() {
+            std::vector<Bucket, CacheLineAllocator<Bucket> > oldBuckets(buckets.size() * 2, EmptyBucket());
+            oldBuckets.swap(buckets);
+            --shift;
+            
+            for (const Bucket& bucket : oldBuckets)
+                for (size_t slot = 0; slot < slotsPerBucket && bucket.keys[slot] != emptyKey; ++slot)
+                    place(bucket.keys[slot], bucket.positions[slot]);
+        }
+    };
+    
   
-    /* Group of cubes in the space. Cube coordinates are i, j, k so we don't mix up with points that use x, y, z. */
+    /** The smallest block of cubes that holds all the cubes of a collection. */
+    struct CubeBounds {
+        CubicCoordinate iLowest;
+        CubicCoordinate iHighest;
+        CubicCoordinate jLowest;
+        CubicCoordinate jHighest;
+        CubicCoordinate kLowest;
+        CubicCoordinate kHighest;
+    };
+    
+  
+    /* Group of cubes in the space. Cube coordinates are i, j, k so we don't mix up with points that use x, y, z. 
+     *
+     * After pack() the coordinates of all the points are in a "structure of arrays" (all the x, then all the y...),
+     * grouped by cube and with the cubes sorted by key. Since k is in the lowest bits of the key, the cubes of a 
+     * row along k are next to each other in memory: a scan reads long runs of coordinates, ready for DistanceKernels.
+     *
+     * Points can be removed (or moved) too. That leaves holes, after the last packed point of the cube or in the 
+     * recent points: the next pack() closes them. The cubes left without points stay (empty) until there are many. */
     template <typename POINT>
     class CubeCollection {
     public:
+        CubeCollection() :
+            cubeOfPointReady(false),
+            removedPoints(0)
+        {}
+        
         void insert(const CubicCoordinate i,
                     const CubicCoordinate j,
                     const CubicCoordinate k,
+                    const POINT& point,
                     const typename PointTraits<POINT>::index index
                    ) {
-            auto& cubeForInsertion = cubes[i][j][k];
-            cubeForInsertion.indexOfPointsInside.push_back(index);
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                if (cubes.size() == CubeKeyTable::notFound)
+                    throw std::runtime_error("Too many cubes.");
+            #endif
+            
+            const uint32_t newPosition = static_cast<uint32_t>(cubes.size());
+            const uint32_t position = FitsInCubeKey(i, j, k) ? 
+                                      positions.findOrInsert(MakeCubeKey(i, j, k), newPosition) :
+                                      farPositions.emplace(CubeCoordinates{i, j, k}, newPosition).first->second;
+            if (position == newPosition) {
+                cubes.emplace_back();
+                coordinates.push_back(CubeCoordinates{i, j, k});
+                extendBounds(i, j, k);
+            }
+            
+            recent.push_back({point.x, point.y, point.z, index, cubes[position].firstRecentPoint});
+            cubes[position].firstRecentPoint = recent.size() - 1;
+            
+            if (cubeOfPointReady)
+                cubeOfPoint[index] = position;
+        }
+        
+        /** Fills an empty collection at once, already packed. cubeKeys has the key of the cube of each point, 
+         *  the index of each point is its position.
+         *
+         *  The points are sorted by cube with a parallel radix sort, on the bits of the keys that change from a point
+         *  to the other (after removing the lowest i, j and k). Then each cube is hashed only once, not each point. */
+        void insertAll(const std::vector<POINT>& newPoints, const std::vector<CubeKey>& cubeKeys, WorkerPool& workers) {
+            static const CubeKey fieldMask = (static_cast<CubeKey>(1) << 21) - 1;
+            
+            const size_t count = newPoints.size();
+            const size_t maxChunks = (count + radixMinimumChunkSize - 1) / radixMinimumChunkSize;
+            const size_t chunks = std::max<size_t>(1, std::min(workers.size(), maxChunks));
+            const size_t chunkSize = (count + chunks - 1) / chunks;
+            if (count == 0)
+                return;
+            
+            // Lowest and highest i, j, k (as in the keys, biased) of each chunk.
+            std::vector<CubeKey> lowest(3 * chunks, fieldMask);
+            std::vector<CubeKey> highest(3 * chunks, 0);
+            workers.run(chunks, [&](const size_t chunk) {
+                const size_t begin = std::min(chunk * chunkSize, count);
+                const size_t end = std::min(begin + chunkSize, count);
+                for (size_t p = begin; p < end; ++p)
+                    for (size_t axis = 0; axis < 3; ++axis) {
+                        const CubeKey field = (cubeKeys[p] >> (42 - 21 * axis)) & fieldMask;
+                        lowest[3 * chunk + axis] = std::min(lowest[3 * chunk + axis], field);
+                        highest[3 * chunk + axis] = std::max(highest[3 * chunk + axis], field);
+                    }
+            });
+            CubeKey lowestField[3] = {fieldMask, fieldMask, fieldMask};
+            CubeKey highestField[3] = {0, 0, 0};
+            unsigned fieldBits[3];
+            for (size_t axis = 0; axis < 3; ++axis) {
+                for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                    lowestField[axis] = std::min(lowestField[axis], lowest[3 * chunk + axis]);
+                    highestField[axis] = std::max(highestField[axis], highest[3 * chunk + axis]);
+                }
+                fieldBits[axis] = BitsToRepresent(highestField[axis] - lowestField[axis]);
+            }
+            
+            // Same order as the keys, in fewer bits. If there is room, the position of the point goes in the lowest 
+            // bits, under the key: the sort moves a single array.
+            const unsigned keyBits = fieldBits[0] + fieldBits[1] + fieldBits[2];
+            const unsigned positionBits = BitsToRepresent(count - 1);
+            const bool together = keyBits + positionBits <= 64;
+            std::vector<uint64_t> compactKeys(count);
+            std::vector<size_t> order(together ? 0 : count);
+            workers.run(chunks, [&](const size_t chunk) {
+                const size_t begin = std::min(chunk * chunkSize, count);
+                const size_t end = std::min(begin + chunkSize, count);
+                for (size_t p = begin; p < end; ++p) {
+                    uint64_t compact = 0;
+                    for (size_t axis = 0; axis < 3; ++axis)
+                        compact = (compact << fieldBits[axis]) | 
+                                  (((cubeKeys[p] >> (42 - 21 * axis)) & fieldMask) - lowestField[axis]);
+                    if (together) {
+                        compactKeys[p] = (compact << positionBits) | p;
+                    } else {
+                        compactKeys[p] = compact;
+                        order[p] = p;
+                    }
+                }
+            });
+            if (together) {
+                RadixSortOnBits(compactKeys, positionBits, positionBits + keyBits, workers);
+                order.resize(count);
+                const uint64_t positionMask = (static_cast<uint64_t>(1) << positionBits) - 1;  // positionBits < 64 here.
+                workers.run(chunks, [&](const size_t chunk) {
+                    const size_t begin = std::min(chunk * chunkSize, count);
+                    const size_t end = std::min(begin + chunkSize, count);
+                    for (size_t r = begin; r < end; ++r) {
+                        order[r] = static_cast<size_t>(compactKeys[r] & positionMask);
+                        compactKeys[r] >>= positionBits;
+                    }
+                });
+            } else {
+                RadixSortByKey(compactKeys, order, keyBits, workers);
+            }
+            
+            points.resize(count);
+            workers.run(chunks, [&](const size_t chunk) {
+                const size_t begin = std::min(chunk * chunkSize, count);
+                const size_t end = std::min(begin + chunkSize, count);
+                for (size_t r = begin; r < end; ++r) {
+                    const POINT& point = newPoints[order[r]];
+                    points.coordinatesX[r] = point.x;
+                    points.coordinatesY[r] = point.y;
+                    points.coordinatesZ[r] = point.z;
+                    points.indices[r] = static_cast<typename PointTraits<POINT>::index>(order[r]);
+                }
+            });
+            
+            size_t cubeCount = 1;
+            for (size_t r = 1; r < count; ++r)
+                cubeCount += compactKeys[r] != compactKeys[r - 1];
+            positions.reserve(cubeCount);
+            cubes.reserve(cubeCount);
+            coordinates.reserve(cubeCount);
+            
+            for (size_t r = 0; r < count; ++r) {
+                if (r > 0 && compactKeys[r] == compactKeys[r - 1]) {
+                    ++cubes.back().packedEnd;
+                    continue;
+                }
+                #ifdef GEO_INDEX_SAFETY_CHECKS
+                    if (cubes.size() == CubeKeyTable::notFound)
+                        throw std::runtime_error("Too many cubes.");
+                #endif
+                positions.findOrInsert(cubeKeys[order[r]], static_cast<uint32_t>(cubes.size()));
+                cubes.emplace_back();
+                cubes.back().packedBegin = r;
+                cubes.back().packedEnd = r + 1;
+                coordinates.push_back(CoordinatesOfCubeKey(cubeKeys[order[r]]));
+            }
+            
+            occupied = CubeBounds{static_cast<CubicCoordinate>(lowestField[0]) - cubeKeyBias,
+                                  static_cast<CubicCoordinate>(highestField[0]) - cubeKeyBias,
+                                  static_cast<CubicCoordinate>(lowestField[1]) - cubeKeyBias,
+                                  static_cast<CubicCoordinate>(highestField[1]) - cubeKeyBias,
+                                  static_cast<CubicCoordinate>(lowestField[2]) - cubeKeyBias,
+                                  static_cast<CubicCoordinate>(highestField[2]) - cubeKeyBias};
+        }
+        
+        /** Takes the point out of its cube. Returns false if there is no such point. */
+        bool remove(const typename PointTraits<POINT>::index index) {
+            prepareCubeOfPoint();
+            
+            const auto found = cubeOfPoint.find(index);
+            if (found == cubeOfPoint.end())
+                return false;
+            
+            removeFromCube(cubes[found->second], index);
+            cubeOfPoint.erase(found);
+            return true;
+        }
+        
+        /** Gives new coordinates to the point, at cube i, j, k. Returns false if there is no such point.
+         *  If the cube does not change, the point is updated where it is. */
+        bool move(const typename PointTraits<POINT>::index index,
+                  const CubicCoordinate i,
+                  const CubicCoordinate j,
+                  const CubicCoordinate k,
+                  const POINT& point)
+        {
+            prepareCubeOfPoint();
+            
+            const auto found = cubeOfPoint.find(index);
+            if (found == cubeOfPoint.end())
+                return false;
+            
+            Cube& cube = cubes[found->second];
+            if (coordinates[found->second] == CubeCoordinates{i, j, k}) {
+                updateInCube(cube, index, point);
+                return true;
+            }
+            
+            removeFromCube(cube, index);
+            insert(i, j, k, point, index);
+            return true;
         }
 
-        const std::vector<typename PointTraits<POINT>::index>& read(const CubicCoordinate i,
-                                                                    const CubicCoordinate j,
-                                                                    const CubicCoordinate k) const
+        /** The cube at i, j, k or nullptr if there are no points there. */
+        const Cube* find(const CubicCoordinate i,
+                         const CubicCoordinate j,
+                         const CubicCoordinate k) const
        {
-             static const Cube<POINT> empty;  // Void return value.
-  
-            const auto sliceAtI = cubes.find(i);
-            if (sliceAtI == cubes.end())
-                return empty.indexOfPointsInside;
+            if (! FitsInCubeKey(i, j, k)) {
+                if (farPositions.empty())  // The usual case: no lookups on the far cubes.
+                    return nullptr;
+                const auto found = farPositions.find(CubeCoordinates{i, j, k});
+                return found == farPositions.end() ? nullptr : &cubes[found->second];
+            }
+            
+            const uint32_t position = positions.find(MakeCubeKey(i, j, k));
+            if (position == CubeKeyTable::notFound)
+                return nullptr;
             
-            const auto rowAtIJ = sliceAtI->second.find(j);
-            if (rowAtIJ == sliceAtI->second.end())
-                return empty.indexOfPointsInside;
+            return &cubes[position];
+       }
+       
+       bool empty() const {
+            return cubes.empty();
+       }
+       
+       /** Meaningless if the collection is empty. */
+       const CubeBounds& bounds() const {
+            return occupied;
+       }
+       
+       /** Moves all the points in the packed arrays, in the order of the cube keys (then the far cubes, in the same 
+        *  order of their coordinates). Drops the empty cubes too, if they are at least half of them. */
+       void pack() {
+            if (recent.empty() && removedPoints == 0)
+                return;
             
-            const auto cubeAtIJK = rowAtIJ->second.find(k);
-            if (cubeAtIJK == rowAtIJ->second.end())
-                return empty.indexOfPointsInside;
+            std::vector<std::pair<CubeKey, uint32_t> > order;  // Key and position of each cube with a key.
+            std::vector<std::pair<CubeCoordinates, uint32_t> > farOrder;
+            order.reserve(cubes.size() - farPositions.size());
+            farOrder.reserve(farPositions.size());
+            for (uint32_t position = 0; position < cubes.size(); ++position) {
+                const CubeCoordinates& c = coordinates[position];
+                if (FitsInCubeKey(c.i, c.j, c.k))
+                    order.emplace_back(MakeCubeKey(c.i, c.j, c.k), position);
+                else
+                    farOrder.emplace_back(c, position);
+            }
+            std::sort(order.begin(), order.end());
+            std::sort(farOrder.begin(), farOrder.end(), 
+                      [](const std::pair<CubeCoordinates, uint32_t>& lhs, const std::pair<CubeCoordinates, uint32_t>& rhs) {
+                          return lhs.first < rhs.first;
+                      });
             
-            return cubeAtIJK->second.indexOfPointsInside;
+            // The cubes stay where they are (and the hash tables stay valid): only their points move.
+            PackedPoints packed;
+            packed.reserve(points.indices.size() + recent.size());
+            std::vector<size_t> recentOfCube;
+            for (const auto& keyAndPosition : order)
+                packCube(cubes[keyAndPosition.second], packed, recentOfCube);
+            for (const auto& coordinatesAndPosition : farOrder)
+                packCube(cubes[coordinatesAndPosition.second], packed, recentOfCube);
+            points.swap(packed);
+            std::vector<RecentPoint<POINT> >().swap(recent);  // Releases the memory too.
+            removedPoints = 0;
+            
+            const size_t emptyCubes = std::count_if(cubes.begin(), cubes.end(), 
+                                                    [](const Cube& cube) { return cube.packedBegin == cube.packedEnd; });
+            if (2 * emptyCubes >= cubes.size() && emptyCubes > 0)
+                dropEmptyCubes();
        }
        
+       /** The packed arrays, where Cube::packedBegin and Cube::packedEnd point. */
+       const typename PointTraits<POINT>::coordinate* packedX() const { return points.coordinatesX.data(); }
+       const typename PointTraits<POINT>::coordinate* packedY() const { return points.coordinatesY.data(); }
+       const typename PointTraits<POINT>::coordinate* packedZ() const { return points.coordinatesZ.data(); }
+       const typename PointTraits<POINT>::index* packedIndices() const { return points.indices.data(); }
+       
+       /** Where Cube::firstRecentPoint and RecentPoint::nextInCube point. */
+       const std::vector<RecentPoint<POINT> >& recentPoints() const { return recent; }
+       
     private:
+    /** The map from the points to their cubes is built the first time it is needed: 
+     *  an index that never removes or moves points does not pay for it. */
+    void prepareCubeOfPoint() {
+        if (cubeOfPointReady)
+            return;
+        
+        cubeOfPoint.reserve(points.indices.size() + recent.size());
+        for (uint32_t position = 0; position < cubes.size(); ++position) {
+            const Cube& cube = cubes[position];
+            for (size_t p = cube.packedBegin; p < cube.packedEnd; ++p)
+                cubeOfPoint[points.indices[p]] = position;
+            for (size_t r = cube.firstRecentPoint; r != noRecentPoint; r = recent[r].nextInCube)
+                cubeOfPoint[recent[r].pointIndex] = position;
+        }
+        cubeOfPointReady = true;
+    }
+    
+    /** The last packed point of the cube takes the place of the removed one, so the packed points of the cube stay 
+     *  contiguous. A recent point is just unlinked from the list. Either way, the space is reclaimed by pack(). */
+    void removeFromCube(Cube& cube, const typename PointTraits<POINT>::index index) {
+        ++removedPoints;
+        
+        for (size_t p = cube.packedBegin; p < cube.packedEnd; ++p)
+            if (points.indices[p] == index) {
+                points.copy(cube.packedEnd - 1, p);
+                --cube.packedEnd;
+                return;
+            }
+        
+        for (size_t* link = &cube.firstRecentPoint; *link != noRecentPoint; link = &recent[*link].nextInCube)
+            if (recent[*link].pointIndex == index) {
+                *link = recent[*link].nextInCube;
+                return;
+            }
+    }
+    
+    void updateInCube(const Cube& cube, const typename PointTraits<POINT>::index index, const POINT& point) {
+        for (size_t p = cube.packedBegin; p < cube.packedEnd; ++p)
+            if (points.indices[p] == index) {
+                points.coordinatesX[p] = point.x;
+                points.coordinatesY[p] = point.y;
+                points.coordinatesZ[p] = point.z;
+                return;
+            }
+        
+        for (size_t r = cube.firstRecentPoint; r != noRecentPoint; r = recent[r].nextInCube)
+            if (recent[r].pointIndex == index) {
+                recent[r].x = point.x;
+                recent[r].y = point.y;
+                recent[r].z = point.z;
+                return;
+            }
+    }
+    
+    /** Only right after packing: all the points are in the packed arrays. The hash tables are rebuilt from scratch
+     *  (it can not forget keys) and the bounds shrink to the cubes that are left. */
+    void dropEmptyCubes() {
+        std::vector<uint32_t> newPositions(cubes.size(), CubeKeyTable::notFound);
+        CubeKeyTable keptPositions;
+        FarCubePositions keptFarPositions;
+        std::vector<Cube> keptCubes;
+        std::vector<CubeCoordinates> keptCoordinates;
+        
+        for (uint32_t position = 0; position < cubes.size(); ++position) {
+            if (cubes[position].packedBegin == cubes[position].packedEnd)
+                continue;
+            const CubeCoordinates& c = coordinates[position];
+            newPositions[position] = static_cast<uint32_t>(keptCubes.size());
+            if (FitsInCubeKey(c.i, c.j, c.k))
+                keptPositions.findOrInsert(MakeCubeKey(c.i, c.j, c.k), newPositions[position]);
+            else
+                keptFarPositions.emplace(c, newPositions[position]);
+            keptCubes.push_back(cubes[position]);
+            keptCoordinates.push_back(c);
+        }
+        
+        std::swap(positions, keptPositions);
+        farPositions.swap(keptFarPositions);
+        cubes.swap(keptCubes);
+        coordinates.swap(keptCoordinates);
+        
+        for (size_t position = 0; position < coordinates.size(); ++position) {
+            const CubeCoordinates& c = coordinates[position];
+            if (position == 0)
+                occupied = CubeBounds{c.i, c.i, c.j, c.j, c.k, c.k};
+            else
+                extendBounds(c.i, c.j, c.k);
+        }
+        
+        for (auto& pointAndCube : cubeOfPoint)
+            pointAndCube.second = newPositions[pointAndCube.second];
+    }
+    
+    void extendBounds(const CubicCoordinate i, const CubicCoordinate j, const CubicCoordinate k) {
+        if (cubes.size() == 1) {
+            occupied = CubeBounds{i, i, j, j, k, k};
+            return;
+        }
+        occupied.iLowest = std::min(occupied.iLowest, i);
+        occupied.iHighest = std::max(occupied.iHighest, i);
+        occupied.jLowest = std::min(occupied.jLowest, j);
+        occupied.jHighest = std::max(occupied.jHighest, j);
+        occupied.kLowest = std::min(occupied.kLowest, k);
+        occupied.kHighest = std::max(occupied.kHighest, k);
+    }
+    
+    struct PackedPoints {
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+        std::vector<typename PointTraits<POINT>::index> indices;
+        
+        void resize(const size_t size) {
+            coordinatesX.resize(size);
+            coordinatesY.resize(size);
+            coordinatesZ.resize(size);
+            indices.resize(size);
+        }
+        
+        void reserve(const size_t size) {
+            coordinatesX.reserve(size);
+            coordinatesY.reserve(size);
+            coordinatesZ.reserve(size);
+            indices.reserve(size);
+        }
+        
+        void append(const PackedPoints& other, const size_t begin, const size_t end) {
+            coordinatesX.insert(coordinatesX.end(), other.coordinatesX.begin() + begin, other.coordinatesX.begin() + end);
+            coordinatesY.insert(coordinatesY.end(), other.coordinatesY.begin() + begin, other.coordinatesY.begin() + end);
+            coordinatesZ.insert(coordinatesZ.end(), other.coordinatesZ.begin() + begin, other.coordinatesZ.begin() + end);
+            indices.insert(indices.end(), other.indices.begin() + begin, other.indices.begin() + end);
+        }
+        
+        void append(const RecentPoint<POINT>& point) {
+            coordinatesX.push_back(point.x);
+            coordinatesY.push_back(point.y);
+            coordinatesZ.push_back(point.z);
+            indices.push_back(point.pointIndex);
+        }
+        
+        /** Overwrites the point at position "to" with the one at "from". */
+        void copy(const size_t from, const size_t to) {
+            coordinatesX[to] = coordinatesX[from];
+            coordinatesY[to] = coordinatesY[from];
+            coordinatesZ[to] = coordinatesZ[from];
+            indices[to] = indices[from];
+        }
+        
+        void swap(PackedPoints& other) {
+            coordinatesX.swap(other.coordinatesX);
+            coordinatesY.swap(other.coordinatesY);
+            coordinatesZ.swap(other.coordinatesZ);
+            indices.swap(other.indices);
+        }
+    };
+    
+    /** Appends the points of the cube to the new packed arrays, and points the cube there.
+     *  The recent points are in the list newest first: they are packed from the end of the list, so the points of a 
+     *  cube stay in the order they were indexed (the order of the curve, see SpaceFillingCurve.hpp). */
+    void packCube(Cube& cube, PackedPoints& packed, std::vector<size_t>& recentOfCube) const {
+        const size_t packedBegin = packed.indices.size();
+        
+        packed.append(points, cube.packedBegin, cube.packedEnd);
+        recentOfCube.clear();
+        for (size_t r = cube.firstRecentPoint; r != noRecentPoint; r = recent[r].nextInCube)
+            recentOfCube.push_back(r);
+        for (auto r = recentOfCube.rbegin(); r != recentOfCube.rend(); ++r)
+            packed.append(recent[*r]);
+        cube.firstRecentPoint = noRecentPoint;
+        
+        cube.packedBegin = packedBegin;
+        cube.packedEnd = packed.indices.size();
+    }
+    
     /* Alternative: the usual 3D matrix. But with that (vector in vector in vector) I would have to know the size in advance.
      That would give direct access, this may work better if there are many empty cubes (that don't get created).
-     The hashing for integer indexes seems to be already optimal (tested by using a "return index" hashing function).
-     A normal (not unordered) map gave slightly faster lookup times, but longer index construction times.
+     It used to be 3 nested unordered_maps (on i, then j, then k): up to 3 lookups and many pointers to follow for each cube.
+     Now the cubes are in a single array and a flat hash table on the packed (i, j, k) keys says where.
       */
-    std::unordered_map<CubicCoordinate,  // i
-                      std::unordered_map<CubicCoordinate, // j
-                                        std::unordered_map<CubicCoordinate, Cube<POINT> > > > cubes;  // k and content.
-    //And also a map that index on (i, j, k) triplets or other i, j, k combinations.
+    CubeKeyTable positions;
+    FarCubePositions farPositions;  ///< The cubes out of the range of the keys: usually none.
+    std::vector<Cube> cubes;
+    std::vector<CubeCoordinates> coordinates;  ///< Of each cube, to sort the points when packing.
+    PackedPoints points;
+    std::vector<RecentPoint<POINT> > recent;  ///< Points added after the last packing, in the order they came.
+    CubeBounds occupied;  ///< May be larger than needed after removing points, until the empty cubes are dropped.
+    
+    std::unordered_map<typename PointTraits<POINT>::index, uint32_t> cubeOfPoint;  ///< Position of the cube of each point.
+    bool cubeOfPointReady;
+    size_t removedPoints;  ///< Holes left in the packed arrays and in the recent points.
     };
     
 
 /** Different take on the problem. Divide the space in cubes, remember wich cube hosts wich point, then
  *  seek the "interesting" points in the cube or its neighbors in space.
+ *  The size of the cubes matters a lot: if in doubt, ask SuggestCubeSide (or use BuildCubeIndex).
  * 
  *  Could take advantage from a voxel library, but I want to avoid dependencies.
  */
@@ -87,23 +761,106 @@ public:
         #endif
     }
 
+    /** The side of the cubes, as given to the constructor. */
+    typename PointTraits<POINT>::coordinate cubeSide() const {
+        return gridStep;
+    }
+    
     /** Adds a point to the index. Remember its name too. */
     void index(const POINT& p, const typename PointTraits<POINT>::index index){
         #ifdef GEO_INDEX_SAFETY_CHECKS
-            if (points.find(index) != end(points))
-                throw std::runtime_error("NoIndex::index Point indexed twice");
+            if (! indexedPoints.insert(index).second)
+                throw std::runtime_error("CubeIndex::index Point indexed twice");
         #endif
         
         cubes.insert(spaceToCubic(p.x),
                      spaceToCubic(p.y),
                      spaceToCubic(p.z),
+                     p,
                      index);
-        points[index] = p;
+    }
+    
+    /** Adds all the points, the index of each point being its position in the vector (like BuildIndex), 
+     *  then packs them like completed().
+     *  Much faster than calling index() for each point: the workers find the cubes of the points and sort 
+     *  them by cube, and the cube table gets one insertion per cube instead of one per point.
+     *  If the index already has points, or if some cubes are out of the range of the keys (see CubeKey), falls back
+     *  to index() and completed(). */
+    void indexAll(const std::vector<POINT>& points, WorkerPool& workers) {
+        static_assert(std::is_unsigned<typename PointTraits<POINT>::index>::value,
+                      "CubeIndex::indexAll can only deal with unsigned integral types as indexes.");
+        
+        if (! cubes.empty()) {
+            indexOneByOne(points);
+            return;
+        }
+        
+        const size_t count = points.size();
+        const size_t maxChunks = (count + radixMinimumChunkSize - 1) / radixMinimumChunkSize;
+        const size_t chunks = std::max<size_t>(1, std::min(workers.size(), maxChunks));
+        const size_t chunkSize = (count + chunks - 1) / chunks;
+        
+        std::vector<CubeKey> cubeKeys(count);
+        std::vector<char> allFit(chunks, true);  // Not vector<bool>: each worker writes its own.
+        workers.run(chunks, [&](const size_t chunk) {
+            const size_t begin = std::min(chunk * chunkSize, count);
+            const size_t end = std::min(begin + chunkSize, count);
+            for (size_t p = begin; p < end; ++p) {
+                const CubicCoordinate i = spaceToCubic(points[p].x);
+                const CubicCoordinate j = spaceToCubic(points[p].y);
+                const CubicCoordinate k = spaceToCubic(points[p].z);
+                if (! FitsInCubeKey(i, j, k)) {
+                    allFit[chunk] = false;
+                    return;
+                }
+                cubeKeys[p] = MakeCubeKey(i, j, k);
+            }
+        });
+        if (std::find(allFit.begin(), allFit.end(), false) != allFit.end()) {
+            indexOneByOne(points);
+            return;
+        }
+        
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            for (typename PointTraits<POINT>::index i = 0; i < points.size(); ++i)
+                indexedPoints.insert(i);
+        #endif
+        
+        cubes.insertAll(points, cubeKeys, workers);
+    }
+    
+    /** Takes a point out of the index. Only its cube changes: the cost does not depend on the size of the index.
+     *  The first call after building the index maps every point to its cube, once. */
+    void remove(const typename PointTraits<POINT>::index index) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (indexedPoints.erase(index) == 0)
+                throw std::runtime_error("CubeIndex::remove Point not indexed");
+        #endif
+        
+        cubes.remove(index);
+    }
+    
+    /** Gives new coordinates to an indexed point. Same as remove and index again, but if the point stays in 
+     *  the same cube it is updated where it is (and it stays packed). */
+    void move(const typename PointTraits<POINT>::index index, const POINT& newPoint) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (indexedPoints.count(index) == 0)
+                throw std::runtime_error("CubeIndex::move Point not indexed");
+        #endif
         
+        cubes.move(index,
+                   spaceToCubic(newPoint.x),
+                   spaceToCubic(newPoint.y),
+                   spaceToCubic(newPoint.z),
+                   newPoint);
     }
     
-    /** Does nothing. This index does not require any "pre-processing" and can be used after indexing "new" points. */
-    void completed() {};
+    /** Packs the points in memory, cube after cube, so that lookups read the coordinates in long runs.
+     *  Not mandatory: the index can be used before calling it and after indexing, removing or moving points,
+     *  only a bit slower until the next call. */
+    void completed() {
+        cubes.pack();
+    }
     
     void pointsWithinDistance(const POINT& p, 
                               const typename PointTraits<POINT>::coordinate d,
@@ -116,85 +873,593 @@ public:
         const CubicCoordinate jReference = spaceToCubic(p.y);
         const CubicCoordinate kReference = spaceToCubic(p.z);
         
-        /* We must take the points in all the cubes that are closer than d to the reference.
-        * Then we take cubes that are d on both sides.
-        * The +1 guarantees that we "comfortably exceed" the distance, to compensate for truncated decimals */
-        const CubicCoordinate dAsNumberOfCubes = static_cast<CubicCoordinate>(d / gridStep);
+        const CubicCoordinate scanDistance = scanDistanceAround(iReference, jReference, kReference, d);
         
-        #ifdef GEO_INDEX_SAFETY_CHECKS  // Checking ALL the math makes things too messy.
-            StopSumOverflow<CubicCoordinate>(dAsNumberOfCubes, 1);
-        #endif   
+        const auto distanceLimit = d * d;
+                                                                   
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(distanceLimit);
+        #endif
+    
+        // Scan the cubes around the one that contains the reference point, taking only the points really inside d.
+        // The search region is a sphere, not a cube: whole rows of cubes in the "corners" can be skipped.
+        // Only where there are cubes, though: a big d must not cost more than the whole index.
+        output.clear();
+        if (cubes.empty())
+            return;
+        const CubeBounds& bounds = cubes.bounds();
+        const CubicCoordinate kFirst = std::max(kReference - scanDistance, bounds.kLowest);
+        const CubicCoordinate kLast = std::min(kReference + scanDistance, bounds.kHighest);
+        for (CubicCoordinate i = std::max(iReference - scanDistance, bounds.iLowest);
+             i <= std::min(iReference + scanDistance, bounds.iHighest); i++)
+            for (CubicCoordinate j = std::max(jReference - scanDistance, bounds.jLowest);
+                 j <= std::min(jReference + scanDistance, bounds.jHighest); j++) {
+                if (! (squaredDistanceToRow(p, i, j) < distanceLimit))
+                    continue;
+                
+                appendPointsInRow(p, distanceLimit, i, j, kFirst, kLast, output);
+            }
         
-        const CubicCoordinate scanDistance = dAsNumberOfCubes + static_cast<CubicCoordinate>(1);
+        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    }
     
-        // Scan all the cubes around the one that contains the reference point.
-        std::vector<typename PointTraits<POINT>::index> indicesOfCandidates;
-       
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements.
+     *  Once k points are found, the cubes that are farther than the k-th point are skipped altogether.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p, 
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
         #ifdef GEO_INDEX_SAFETY_CHECKS
-            StopSumOverflow<CubicCoordinate>(iReference, scanDistance);
-            StopSumOverflow<CubicCoordinate>(jReference, scanDistance);
-            StopSumOverflow<CubicCoordinate>(kReference, scanDistance);
-            StopDifferenceUnderflow<CubicCoordinate>(iReference, scanDistance);
-            StopDifferenceUnderflow<CubicCoordinate>(jReference, scanDistance);
-            StopDifferenceUnderflow<CubicCoordinate>(kReference, scanDistance);
+            CheckMeaningfulDistance(d);
         #endif
+            
+        const CubicCoordinate iReference = spaceToCubic(p.x);
+        const CubicCoordinate jReference = spaceToCubic(p.y);
+        const CubicCoordinate kReference = spaceToCubic(p.z);
         
+        const CubicCoordinate scanDistance = scanDistanceAround(iReference, jReference, kReference, d);
         
-        for (CubicCoordinate i = iReference - scanDistance; i <= iReference + scanDistance; i++)
-            for (CubicCoordinate j = jReference - scanDistance; j <= jReference + scanDistance; j++)
-                for (CubicCoordinate k = kReference - scanDistance; k <= kReference + scanDistance; k++) {
-                    const auto& foundPoints = cubes.read(i, j, k);
-                    std::copy(foundPoints.begin(), foundPoints.end(), std::back_inserter(indicesOfCandidates));
-                }
-                
-
         const auto distanceLimit = d * d;
                                                                    
         #ifdef GEO_INDEX_SAFETY_CHECKS
             CheckOverflow(distanceLimit);
         #endif
         
-        // Now take only the points really inside d and sort the output.
-        // This step could be done inside the triple loop above to avoid a call to std::copy, but 
-        // the performances remain the same.
-        output.clear();
-        output.reserve(indicesOfCandidates.size()); //May reserve more than necessary.
-        for (const auto candidateIndex : indicesOfCandidates) {
-            const POINT& candidate = points.find(candidateIndex)->second;
-            const auto squaredDistance = SquaredDistance(p, candidate);
-
+        KNearestCandidates<POINT> nearest(k, distanceLimit, output);
+        if (cubes.empty()) {
+            nearest.sort();
+            return;
+        }
+        std::vector<IndexAndSquaredDistance<POINT> > hitsInCube;
+        
+        const CubeBounds& bounds = cubes.bounds();
+        const CubicCoordinate kFirst = std::max(kReference - scanDistance, bounds.kLowest);
+        const CubicCoordinate kLast = std::min(kReference + scanDistance, bounds.kHighest);
+        for (CubicCoordinate i = std::max(iReference - scanDistance, bounds.iLowest);
+             i <= std::min(iReference + scanDistance, bounds.iHighest); i++)
+            for (CubicCoordinate j = std::max(jReference - scanDistance, bounds.jLowest);
+                 j <= std::min(jReference + scanDistance, bounds.jHighest); j++) {
+                if (! (squaredDistanceToRow(p, i, j) < nearest.squaredLimit()))
+                    continue;
+                
+                for (CubicCoordinate c = kFirst; c <= kLast; c++)
+                    offerPointsInCube(p, i, j, c, nearest, hitsInCube);
+            }
+        
+        nearest.sort();
+    }
+    
+    /** Finds the k points closest to p, wherever they are: no culling distance to guess.
+     *  Visits the cubes in shells of growing Chebyshev distance around the cube of p (first the cube itself, 
+     *  then the 26 around it, then the 98 around those...) and stops as soon as the k-th point found 
+     *  is closer than anything the next shell may hold.
+     *  Returns less than k points only if the index has less than k points.
+     */
+    void nearestPoints(const POINT& p,
+                       const size_t k,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        KNearestCandidates<POINT> nearest(k, std::numeric_limits<typename PointTraits<POINT>::coordinate>::max(), output);
+        
+        if (cubes.empty()) {
+            nearest.sort();
+            return;
+        }
+        
+        const CubicCoordinate iReference = spaceToCubic(p.x);
+        const CubicCoordinate jReference = spaceToCubic(p.y);
+        const CubicCoordinate kReference = spaceToCubic(p.z);
+        
+        // Beyond this, the shells have no cubes.
+        const CubeBounds& bounds = cubes.bounds();
+        const CubicCoordinate lastShell = std::max(std::max(std::max(iReference - bounds.iLowest, bounds.iHighest - iReference),
+                                                            std::max(jReference - bounds.jLowest, bounds.jHighest - jReference)),
+                                                   std::max(kReference - bounds.kLowest, bounds.kHighest - kReference));
+        
+        std::vector<IndexAndSquaredDistance<POINT> > hitsInCube;
+        for (CubicCoordinate shell = 0; shell <= lastShell; ++shell) {
+            if (! (squaredDistanceToShell(p, iReference, jReference, kReference, shell) < nearest.squaredLimit()))
+                break;
+            
+            const CubicCoordinate iFirst = std::max(iReference - shell, bounds.iLowest);
+            const CubicCoordinate iLast = std::min(iReference + shell, bounds.iHighest);
+            const CubicCoordinate jFirst = std::max(jReference - shell, bounds.jLowest);
+            const CubicCoordinate jLast = std::min(jReference + shell, bounds.jHighest);
+            const CubicCoordinate kFirst = std::max(kReference - shell, bounds.kLowest);
+            const CubicCoordinate kLast = std::min(kReference + shell, bounds.kHighest);
             
-            if (squaredDistance < distanceLimit)
-                output.push_back({candidateIndex, squaredDistance});
+            for (CubicCoordinate i = iFirst; i <= iLast; ++i)
+                for (CubicCoordinate j = jFirst; j <= jLast; ++j) {
+                    if (! (squaredDistanceToRow(p, i, j) < nearest.squaredLimit()))
+                        continue;
+                    
+                    const bool rowOnTheShell = i == iReference - shell || i == iReference + shell ||
+                                               j == jReference - shell || j == jReference + shell;
+                    if (rowOnTheShell) {
+                        for (CubicCoordinate c = kFirst; c <= kLast; ++c)
+                            offerPointsInCube(p, i, j, c, nearest, hitsInCube);
+                    } else {
+                        // Inner row: only its two ends are on the shell (the rest was visited before).
+                        if (kReference - shell == kFirst)
+                            offerPointsInCube(p, i, j, kFirst, nearest, hitsInCube);
+                        if (kReference + shell == kLast)
+                            offerPointsInCube(p, i, j, kLast, nearest, hitsInCube);
+                    }
+                }
         }
         
-        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+        nearest.sort();
     }
                             
 private:
     const typename PointTraits<POINT>::coordinate gridStep;
     
-    CubeCollection<POINT> cubes;
-    std::unordered_map<typename PointTraits<POINT>::index, POINT> points;  ///< Must keep track of the points for geometry computations.
+    CubeCollection<POINT> cubes;  ///< The coordinates of the points are there too: no need to look them up elsewhere.
+    
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        std::unordered_set<typename PointTraits<POINT>::index> indexedPoints;
+    #endif
 
     
+    /** indexAll without the bulk build. */
+    void indexOneByOne(const std::vector<POINT>& points) {
+        for (typename PointTraits<POINT>::index i = 0; i < points.size(); ++i)
+            index(points[i], i);
+        completed();
+    }
+    
     /** To convert from the x, y, z coordinates of points to the discreet coordinates of cubes. 
-     *  The cubes divide the space in a uniform 3D grid, so finding the relevant cube is easy. Decimals are truncated
-     *  (imagine the cubes aligned on integer coordinates in the grid reference system). 
+     *  The cubes divide the space in a uniform 3D grid, so finding the relevant cube is easy. Decimals are rounded down
+     *  (imagine the cubes aligned on integer coordinates in the grid reference system). Cube i goes from
+     *  i * gridStep (included) to (i + 1) * gridStep (excluded).
+     *  Rounding towards 0 would be faster, but would make the cube around 0 twice as big as the others.
      *
      *  Assume implicitely that coordinates are expressed in some "big" type, like double, that may have
      *  bigger values that the integer used for CubicCoordinate. */
     CubicCoordinate spaceToCubic(const typename PointTraits<POINT>::coordinate coordinate) const 
     {
-        // Finds the cube and truncates decimal in single to.
-        const typename PointTraits<POINT>::coordinate beforeTruncation = coordinate / gridStep;
+        const typename PointTraits<POINT>::coordinate beforeTruncation = std::floor(coordinate / gridStep);
         #ifdef GEO_INDEX_SAFETY_CHECKS
             if (beforeTruncation > std::numeric_limits<CubicCoordinate>::max())
                 throw std::runtime_error("Cubic coordinate overflow");
         #endif
         return static_cast<CubicCoordinate>(beforeTruncation);
     }
+    
+    /** How many cubes to scan on each side of the reference cube to cover the distance d. */
+    CubicCoordinate scanDistanceAround(const CubicCoordinate iReference,
+                                       const CubicCoordinate jReference,
+                                       const CubicCoordinate kReference,
+                                       const typename PointTraits<POINT>::coordinate d) const
+    {
+        /* We must take the points in all the cubes that are closer than d to the reference.
+        * Then we take cubes that are d on both sides.
+        * The +1 guarantees that we "comfortably exceed" the distance, to compensate for truncated decimals */
+        #ifdef GEO_INDEX_SAFETY_CHECKS  // Checking ALL the math makes things too messy.
+            if (d / gridStep >= std::numeric_limits<CubicCoordinate>::max())
+                throw std::runtime_error("Scan distance overflow");
+        #endif
+        
+        const CubicCoordinate dAsNumberOfCubes = static_cast<CubicCoordinate>(d / gridStep);
+        
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            StopSumOverflow<CubicCoordinate>(dAsNumberOfCubes, 1);
+        #endif   
+        
+        const CubicCoordinate scanDistance = dAsNumberOfCubes + static_cast<CubicCoordinate>(1);
+       
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            StopSumOverflow<CubicCoordinate>(iReference, scanDistance);
+            StopSumOverflow<CubicCoordinate>(jReference, scanDistance);
+            StopSumOverflow<CubicCoordinate>(kReference, scanDistance);
+            StopDifferenceUnderflow<CubicCoordinate>(iReference, scanDistance);
+            StopDifferenceUnderflow<CubicCoordinate>(jReference, scanDistance);
+            StopDifferenceUnderflow<CubicCoordinate>(kReference, scanDistance);
+        #else
+            (void) iReference; (void) jReference; (void) kReference;
+        #endif
+        
+        return scanDistance;
+    }
+    
+    /** Distance of p from the closest point of the cube, 0 if p is inside. Squared, as usual. */
+    typename PointTraits<POINT>::coordinate squaredDistanceToCube(const POINT& p,
+                                                                  const CubicCoordinate i,
+                                                                  const CubicCoordinate j,
+                                                                  const CubicCoordinate k) const
+    {
+        const typename PointTraits<POINT>::coordinate zDistance = distanceFromSide(p.z, k);
+        return squaredDistanceToRow(p, i, j) + zDistance * zDistance;
+    }
+    
+    /** Same as squaredDistanceToCube, for the closest of the cubes (i, j, any k). */
+    typename PointTraits<POINT>::coordinate squaredDistanceToRow(const POINT& p,
+                                                                 const CubicCoordinate i,
+                                                                 const CubicCoordinate j) const
+    {
+        const typename PointTraits<POINT>::coordinate xDistance = distanceFromSide(p.x, i);
+        const typename PointTraits<POINT>::coordinate yDistance = distanceFromSide(p.y, j);
+        return xDistance * xDistance + yDistance * yDistance;
+    }
+    
+    /** A lower bound for the distance of p from the points in the cubes that are exactly "shell" cubes away 
+     *  (Chebyshev distance) from the cube of p. It is the distance p has to go to get out of the cubes of the 
+     *  previous shells. Squared, as usual. */
+    typename PointTraits<POINT>::coordinate squaredDistanceToShell(const POINT& p,
+                                                                   const CubicCoordinate iReference,
+                                                                   const CubicCoordinate jReference,
+                                                                   const CubicCoordinate kReference,
+                                                                   const CubicCoordinate shell) const
+    {
+        if (shell == 0)
+            return 0;
+        
+        const typename PointTraits<POINT>::coordinate distance = std::min(std::min(distanceToExit(p.x, iReference, shell),
+                                                                                   distanceToExit(p.y, jReference, shell)),
+                                                                          distanceToExit(p.z, kReference, shell));
+        return distance * distance;
+    }
+    
+    /** Along one axis: how far the coordinate is from both ends of the cubes from cReference - (shell - 1) to 
+     *  cReference + (shell - 1), whichever is closer. */
+    typename PointTraits<POINT>::coordinate distanceToExit(const typename PointTraits<POINT>::coordinate coordinate,
+                                                           const CubicCoordinate cReference,
+                                                           const CubicCoordinate shell) const
+    {
+        const typename PointTraits<POINT>::coordinate lowerSide = (cReference - shell + 1) * gridStep;
+        const typename PointTraits<POINT>::coordinate upperSide = (cReference + shell) * gridStep;
+        const typename PointTraits<POINT>::coordinate distance = std::min(coordinate - lowerSide, upperSide - coordinate);
+        return std::max(distance, static_cast<typename PointTraits<POINT>::coordinate>(0));  // Rounding could make it negative.
+    }
+    
+    /** Distance of p from the farthest corner of the cube. Squared, as usual. */
+    typename PointTraits<POINT>::coordinate squaredDistanceToFarthestCorner(const POINT& p,
+                                                                            const CubicCoordinate i,
+                                                                            const CubicCoordinate j,
+                                                                            const CubicCoordinate k) const
+    {
+        const typename PointTraits<POINT>::coordinate xDistance = distanceFromFarSide(p.x, i);
+        const typename PointTraits<POINT>::coordinate yDistance = distanceFromFarSide(p.y, j);
+        const typename PointTraits<POINT>::coordinate zDistance = distanceFromFarSide(p.z, k);
+        return xDistance * xDistance + yDistance * yDistance + zDistance * zDistance;
+    }
+    
+    /** Distance, along one axis, from the coordinate to the interval covered by the cubes at cubic coordinate c. */
+    typename PointTraits<POINT>::coordinate distanceFromSide(const typename PointTraits<POINT>::coordinate coordinate,
+                                                             const CubicCoordinate c) const
+    {
+        const typename PointTraits<POINT>::coordinate lowerSide = c * gridStep;
+        const typename PointTraits<POINT>::coordinate upperSide = lowerSide + gridStep;
+        if (coordinate < lowerSide)
+            return lowerSide - coordinate;
+        if (coordinate > upperSide)
+            return coordinate - upperSide;
+        return 0;
+    }
+    
+    /** Distance, along one axis, from the coordinate to the farthest end of the interval covered by the cubes at c. */
+    typename PointTraits<POINT>::coordinate distanceFromFarSide(const typename PointTraits<POINT>::coordinate coordinate,
+                                                                const CubicCoordinate c) const
+    {
+        const typename PointTraits<POINT>::coordinate lowerSide = c * gridStep;
+        const typename PointTraits<POINT>::coordinate upperSide = lowerSide + gridStep;
+        return std::max(coordinate - lowerSide, upperSide - coordinate);
+    }
+    
+    /** Appends the points of cube (i, j, kFirst) to cube (i, j, kLast) that are strictly closer than the limit.
+     *  The cubes that are too far are skipped without even looking them up. The points of the cubes that are
+     *  all within the limit are taken without checking them one by one.
+     *  After completed() the cubes of a row are next to each other in the packed arrays: adjacent ones 
+     *  are scanned with a single call to the distance kernel. */
+    void appendPointsInRow(const POINT& p,
+                           const typename PointTraits<POINT>::coordinate squaredLimit,
+                           const CubicCoordinate i,
+                           const CubicCoordinate j,
+                           const CubicCoordinate kFirst,
+                           const CubicCoordinate kLast,
+                           std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        size_t runBegin = 0;
+        size_t runEnd = 0;
+        bool runInside = false;  ///< All the cubes of the run are within the limit.
+        for (CubicCoordinate k = kFirst; k <= kLast; k++) {
+            if (! (squaredDistanceToCube(p, i, j, k) < squaredLimit))
+                continue;
+            
+            const Cube* cube = cubes.find(i, j, k);
+            if (cube == nullptr)
+                continue;
+            
+            const bool inside = squaredDistanceToFarthestCorner(p, i, j, k) < squaredLimit;
+            if (cube->packedBegin != runEnd || inside != runInside) {
+                appendPackedPoints(p, squaredLimit, runBegin, runEnd, runInside, output);
+                runBegin = cube->packedBegin;
+                runInside = inside;
+            }
+            runEnd = cube->packedEnd;
+            appendRecentPoints(p, squaredLimit, *cube, output);
+        }
+        appendPackedPoints(p, squaredLimit, runBegin, runEnd, runInside, output);
+    }
+    
+    /** Gives the points of the cube to the k nearest candidates, unless the whole cube is too far. */
+    void offerPointsInCube(const POINT& p,
+                           const CubicCoordinate i,
+                           const CubicCoordinate j,
+                           const CubicCoordinate k,
+                           KNearestCandidates<POINT>& nearest,
+                           std::vector<IndexAndSquaredDistance<POINT> >& hitsInCube) const
+    {
+        if (! (squaredDistanceToCube(p, i, j, k) < nearest.squaredLimit()))
+            return;
+        
+        const Cube* cube = cubes.find(i, j, k);
+        if (cube == nullptr)
+            return;
+        
+        hitsInCube.clear();
+        appendPointsInCube(p, nearest.squaredLimit(), *cube, hitsInCube);
+        for (const auto& hit : hitsInCube)
+            nearest.offer(hit.pointIndex, hit.geometricValue);
+    }
+    
+    void appendPointsInCube(const POINT& p,
+                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                            const Cube& cube,
+                            std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        appendPackedPoints(p, squaredLimit, cube.packedBegin, cube.packedEnd, false, output);
+        appendRecentPoints(p, squaredLimit, cube, output);
+    }
+    
+    /** If allInside, the caller knows that all the points are within the limit. */
+    void appendPackedPoints(const POINT& p,
+                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                            const size_t begin,
+                            const size_t end,
+                            const bool allInside,
+                            std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        if (allInside)
+            AppendPointsWithSquaredDistance(p,
+                                            cubes.packedX() + begin,
+                                            cubes.packedY() + begin,
+                                            cubes.packedZ() + begin,
+                                            cubes.packedIndices() + begin,
+                                            end - begin,
+                                            output);
+        else
+            AppendPointsWithinSquaredDistance(p,
+                                              squaredLimit,
+                                              cubes.packedX() + begin,
+                                              cubes.packedY() + begin,
+                                              cubes.packedZ() + begin,
+                                              cubes.packedIndices() + begin,
+                                              end - begin,
+                                              output);
+    }
+    
+    /** The points added after the last completed(): few of them, not worth a SIMD kernel. */
+    void appendRecentPoints(const POINT& p,
+                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                            const Cube& cube,
+                            std::vector<IndexAndSquaredDistance<POINT> >& output) const
+    {
+        const std::vector<RecentPoint<POINT> >& recentPoints = cubes.recentPoints();
+        for (size_t r = cube.firstRecentPoint; r != noRecentPoint; r = recentPoints[r].nextInCube) {
+            const RecentPoint<POINT>& candidate = recentPoints[r];
+            const typename PointTraits<POINT>::coordinate xDistance = p.x - candidate.x;
+            const typename PointTraits<POINT>::coordinate yDistance = p.y - candidate.y;
+            const typename PointTraits<POINT>::coordinate zDistance = p.z - candidate.z;
+            const typename PointTraits<POINT>::coordinate squaredDistance = xDistance * xDistance +
+                                                                            yDistance * yDistance +
+                                                                            zDistance * zDistance;
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                CheckOverflow(squaredDistance);
+            #endif
+            
+            if (squaredDistance < squaredLimit)
+                output.push_back({candidate.pointIndex, squaredDistance});
+        }
+    }
 };
 
+/** What SuggestCubeSide should know about the lookups, if anything. */
+template <typename POINT>
+struct CubeSideHints {
+    CubeSideHints() :
+        queryRadius(0),
+        neighbors(0),
+        pointsPerCube(8)
+    {}
+    
+    typename PointTraits<POINT>::coordinate queryRadius;  ///< The d of pointsWithinDistance, 0 if unknown.
+    size_t neighbors;  ///< The k of the k nearest neighbors searches, 0 if unknown.
+    
+    /** How many points a cube should hold when nothing is known about the lookups.
+     *  It is also how many distance computations a cube lookup is supposed to cost. */
+    double pointsPerCube;
+};
+
+/** Average number of points in the cubes (of the given side) that have at least one. */
+template <typename POINT>
+double AveragePointsPerCube(const std::vector<POINT>& points, const double cubeSide) {
+    const double keyRange = static_cast<double>(cubeKeyBias);
+    CubeKeyTable occupiedCubes;
+    size_t outsideKeyRange = 0;  // Counted as alone in their cube: the cubes are small anyway if we get there.
+    
+    for (const POINT& p : points) {
+        const double i = std::floor(p.x / cubeSide);
+        const double j = std::floor(p.y / cubeSide);
+        const double k = std::floor(p.z / cubeSide);
+        if (! (-keyRange <= i && i < keyRange && -keyRange <= j && j < keyRange && -keyRange <= k && k < keyRange)) {
+            ++outsideKeyRange;
+            continue;
+        }
+        occupiedCubes.findOrInsert(MakeCubeKey(static_cast<CubicCoordinate>(i),
+                                               static_cast<CubicCoordinate>(j),
+                                               static_cast<CubicCoordinate>(k)), 0);
+    }
+    
+    return static_cast<double>(points.size()) / static_cast<double>(occupiedCubes.size() + outsideKeyRange);
+}
+
+/** Volume of the sphere of radius 1 in the given (possibly fractional) number of dimensions. */
+inline double UnitBallVolume(const double dimension) {
+    return std::pow(std::acos(-1.0), dimension / 2) / std::tgamma(dimension / 2 + 1);
+}
+
+/** Picks a cube side for a CubeIndex that will hold the given points.
+ *
+ *  Looks at a sample of the points: how many of them share a cube for a few candidate sides, 
+ *  then corrects the side until the cubes hold about hints.pointsPerCube points each.
+ *  Only the cubes that have points count, so clusters and empty regions do not fool it. It also estimates the 
+ *  "dimension" of the points (3 for a cloud, 2 for the surface of a mesh, 1 for a curve) from how the occupancy 
+ *  grows when the cubes are twice as big.
+ *
+ *  If the lookups are known (a distance, or the k of the nearest neighbors), it looks for the side that minimizes
+ *  the cube lookups plus the distance computations for a typical lookup, given the density seen above. 
+ *  Big distances want bigger cubes, but not proportionally.
+ *
+ *  Assumes floating point coordinates. Returns 1 if there are less than 2 distinct points.
+ */
+template <typename POINT>
+typename PointTraits<POINT>::coordinate SuggestCubeSide(const std::vector<POINT>& points,
+                                                        const CubeSideHints<POINT>& hints = CubeSideHints<POINT>())
+{
+    static const size_t maximumSample = static_cast<size_t>(1) << 15;
+    static const int maximumAttempts = 10;
+    
+    std::vector<POINT> sample;
+    const size_t stride = points.size() / maximumSample + 1;
+    for (size_t i = 0; i < points.size(); i += stride)
+        sample.push_back(points[i]);
+    
+    double largestExtent = 0;
+    if (! sample.empty()) {
+        double lowest[3] = {sample[0].x, sample[0].y, sample[0].z};
+        double highest[3] = {sample[0].x, sample[0].y, sample[0].z};
+        for (const POINT& p : sample) {
+            const double coordinates[3] = {p.x, p.y, p.z};
+            for (int axis = 0; axis < 3; ++axis) {
+                lowest[axis] = std::min(lowest[axis], coordinates[axis]);
+                highest[axis] = std::max(highest[axis], coordinates[axis]);
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis)
+            largestExtent = std::max(largestExtent, highest[axis] - lowest[axis]);
+    }
+    if (! (largestExtent > 0))
+        return 1;
+    
+    const double pointsPerCube = std::max(hints.pointsPerCube, 1.0);
+    
+    // Start as if the points filled uniformly a cube as big as their largest extent, then correct.
+    double side = std::min(largestExtent * std::cbrt(pointsPerCube / sample.size()), largestExtent);
+    double dimension = 3;
+    for (int attempt = 0; attempt < maximumAttempts; ++attempt) {
+        const double occupancy = AveragePointsPerCube(sample, side);
+        const double doubledOccupancy = AveragePointsPerCube(sample, 2 * side);
+        if (occupancy >= 2 && doubledOccupancy > occupancy)  // With lonely points the ratio means little.
+            dimension = std::min(std::max(std::log2(doubledOccupancy / occupancy), 1.0), 3.0);
+        
+        const double missingFactor = pointsPerCube / occupancy;
+        if (missingFactor > 0.8 && missingFactor < 1.25)
+            break;
+        if (missingFactor > 1 && side >= largestExtent)  // Not enough points for that, even all in one cube.
+            break;
+        
+        side = std::min(side * std::pow(std::min(std::max(missingFactor, 1.0 / 64), 64.0), 1 / dimension), largestExtent);
+    }
+    
+    // The sample is less dense than the full set of points: the same occupancy needs smaller cubes.
+    const double sampledFraction = static_cast<double>(sample.size()) / static_cast<double>(points.size());
+    const double densitySide = side * std::pow(sampledFraction, 1 / dimension);
+    
+    // Around a point, there are about UnitBallVolume * pointsPerCube * (r / densitySide)^dimension points within r.
+    double radius = hints.queryRadius;
+    if (hints.neighbors > 0) {
+        const double neighborsRadius = densitySide * std::pow(hints.neighbors / (UnitBallVolume(dimension) * pointsPerCube),
+                                                              1 / dimension);
+        radius = radius > 0 ? std::min(radius, neighborsRadius) : neighborsRadius;
+    }
+    if (! (radius > 0))
+        return static_cast<typename PointTraits<POINT>::coordinate>(densitySide);
+    
+    // A lookup touches the cubes that intersect the sphere, and checks the points inside them.
+    double bestSide = densitySide;
+    double bestCost = std::numeric_limits<double>::max();
+    for (int step = -16; step <= 16; ++step) {
+        const double candidate = densitySide * std::pow(2.0, step / 4.0);
+        const double reach = radius + 0.87 * candidate;  // Half the diagonal of a cube.
+        const double cubeLookups = UnitBallVolume(3) * std::pow(reach / candidate, 3);
+        const double distanceComputations = UnitBallVolume(dimension) * pointsPerCube * std::pow(reach / densitySide, dimension);
+        const double cost = pointsPerCube * cubeLookups + distanceComputations;
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSide = candidate;
+        }
+    }
+    return static_cast<typename PointTraits<POINT>::coordinate>(bestSide);
+}
+
+/** Same as BuildIndex in NearestNeighbors.hpp, with the parallel bulk build of CubeIndex::indexAll. */
+template <typename POINT>
+void BuildIndex(const std::vector<POINT>& knownPoints,
+                CubeIndex<POINT>& resultingIndex,
+                WorkerPool& workers)
+{
+    resultingIndex.indexAll(knownPoints, workers);
+}
+
+/** Builds a CubeIndex with the cube side chosen by SuggestCubeSide. Like BuildIndex, the index of each point
+ *  is its position in the vector. */
+template <typename POINT>
+CubeIndex<POINT> BuildCubeIndex(const std::vector<POINT>& points,
+                                const CubeSideHints<POINT>& hints = CubeSideHints<POINT>())
+{
+   static_assert(std::is_unsigned<typename PointTraits<POINT>::index>::value,
+                 "BuildCubeIndex can only deal with unsigned integral types as indexes.");
+    
+    CubeIndex<POINT> index(SuggestCubeSide(points, hints));
+    for (typename PointTraits<POINT>::index i = 0; i < points.size(); ++i)
+        index.index(points[i], i);
+    index.completed();
+    return index;
+}
+
+/** Same as above, with the parallel bulk build of CubeIndex::indexAll. */
+template <typename POINT>
+CubeIndex<POINT> BuildCubeIndex(const std::vector<POINT>& points,
+                                const CubeSideHints<POINT>& hints,
+                                WorkerPool& workers)
+{
+    CubeIndex<POINT> index(SuggestCubeSide(points, hints));
+    index.indexAll(points, workers);
+    return index;
+}
+
 }
 #endif
@@ -4,8 +4,12 @@
 
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <cstdint>
 #include "Common.hpp"
 #include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+#include "NearestNeighbors.hpp"
 
 using namespace std;
 
@@ -53,6 +57,21 @@ TEST(CubeIndex, pointsWithinDistance_squareDistance) {
     pointsWithinDistance_squareDistance(index);
 }
 
+TEST(CubeIndex, nearestPointsWithinDistance_closestK) {
+    CubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(CubeIndex, nearestPointsWithinDistance_lessThanK) {
+    CubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(CubeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    CubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(CubeIndex, index_duplicatedIndex) {
@@ -84,30 +103,255 @@ TEST(CubeIndex, pointsWithinDistance_overflowDistance) {
 
 
 /* Specific tests for this implementation. */
+
+/* All the indices in a cube, packed or not, sorted to compare them easily. */
+static std::vector<PointTraits<Point>::index> indicesIn(const CubeCollection<Point>& cc,
+                                                        const CubicCoordinate i,
+                                                        const CubicCoordinate j,
+                                                        const CubicCoordinate k)
+{
+    std::vector<PointTraits<Point>::index> indices;
+    const Cube* cube = cc.find(i, j, k);
+    if (cube == nullptr)
+        return indices;
+    
+    indices.insert(indices.end(), cc.packedIndices() + cube->packedBegin, cc.packedIndices() + cube->packedEnd);
+    for (size_t r = cube->firstRecentPoint; r != noRecentPoint; r = cc.recentPoints().at(r).nextInCube)
+        indices.push_back(cc.recentPoints().at(r).pointIndex);
+    std::sort(indices.begin(), indices.end());
+    return indices;
+}
+
+static const Point anyPoint{0, 0, 0};  // CubeCollection does not check that the point is in the cube.
+
 TEST(CubeCollection, origin) {
     CubeCollection<Point> cc;
-    cc.insert(0, 0, 0, 10);
+    cc.insert(0, 0, 0, anyPoint, 10);
 
-    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, cc.read(0, 0, 0));
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, indicesIn(cc, 0, 0, 0));
 }
 
 
 TEST(CubeCollection, readFromUnmappedSlice) {
     CubeCollection<Point> cc;
-    ASSERT_EQ(std::vector<PointTraits<Point>::index>{}, cc.read(0, 0, 0));
+    ASSERT_EQ(nullptr, cc.find(0, 0, 0));
 }
  
 TEST(CubeCollection, readFromUnmappedRow) {
     CubeCollection<Point> cc;
-    cc.insert(0, 0, 0, 0);
-    ASSERT_EQ(std::vector<PointTraits<Point>::index>{}, cc.read(0, 1, 0));
+    cc.insert(0, 0, 0, anyPoint, 0);
+    ASSERT_EQ(nullptr, cc.find(0, 1, 0));
 }
  
 TEST(CubeCollection, readFromUnmappedCube) {
     CubeCollection<Point> cc;
-    cc.insert(0, 0, 0, 0);
-    cc.insert(0, 1, 0, 1);
-    ASSERT_EQ(std::vector<PointTraits<Point>::index>{}, cc.read(0, 1, 2));
+    cc.insert(0, 0, 0, anyPoint, 0);
+    cc.insert(0, 1, 0, anyPoint, 1);
+    ASSERT_EQ(nullptr, cc.find(0, 1, 2));
+}
+
+TEST(CubeCollection, negativeCoordinates) {
+    CubeCollection<Point> cc;
+    cc.insert(-1, -1, -1, anyPoint, 10);
+    cc.insert(-1, -1, 0, anyPoint, 11);
+
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, indicesIn(cc, -1, -1, -1));
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, -1, -1, 0));
+}
+
+TEST(CubeCollection, manyCubes) {
+    // Enough to make the table grow several times.
+    CubeCollection<Point> cc;
+    PointTraits<Point>::index index = 0;
+    for (CubicCoordinate i = -10; i < 10; ++i)
+        for (CubicCoordinate j = -10; j < 10; ++j)
+            for (CubicCoordinate k = -10; k < 10; ++k)
+                cc.insert(i, j, k, anyPoint, index++);
+
+    index = 0;
+    for (CubicCoordinate i = -10; i < 10; ++i)
+        for (CubicCoordinate j = -10; j < 10; ++j)
+            for (CubicCoordinate k = -10; k < 10; ++k)
+                ASSERT_EQ(std::vector<PointTraits<Point>::index>{index++}, indicesIn(cc, i, j, k));
+    
+    ASSERT_EQ(nullptr, cc.find(10, 0, 0));
+}
+
+TEST(CubeCollection, readOutsideTheKeyRange) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 10);
+    ASSERT_EQ(nullptr, cc.find(cubeKeyBias, 0, 0));
+    ASSERT_EQ(nullptr, cc.find(0, 0, -cubeKeyBias - 1));
+}
+
+TEST(CubeCollection, coordinatesInside) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, Point{1, 2, 3}, 10);
+    ASSERT_EQ(1, cc.recentPoints().at(cc.find(0, 0, 0)->firstRecentPoint).x);
+    
+    cc.pack();
+    const Cube* cube = cc.find(0, 0, 0);
+    ASSERT_EQ(1, cube->packedEnd - cube->packedBegin);
+    ASSERT_EQ(1, cc.packedX()[cube->packedBegin]);
+    ASSERT_EQ(2, cc.packedY()[cube->packedBegin]);
+    ASSERT_EQ(3, cc.packedZ()[cube->packedBegin]);
+    ASSERT_EQ(10, cc.packedIndices()[cube->packedBegin]);
+}
+
+TEST(CubeCollection, packKeepsThePoints) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 1, anyPoint, 10);
+    cc.insert(5, 0, 0, anyPoint, 11);
+    cc.insert(0, 0, 1, anyPoint, 12);
+    cc.pack();
+    cc.insert(0, 0, 1, anyPoint, 13);  // Both packed and recent points in the same cube.
+    
+    ASSERT_EQ((std::vector<PointTraits<Point>::index>{10, 12, 13}), indicesIn(cc, 0, 0, 1));
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, 5, 0, 0));
+    
+    cc.pack();
+    ASSERT_EQ((std::vector<PointTraits<Point>::index>{10, 12, 13}), indicesIn(cc, 0, 0, 1));
+    ASSERT_EQ(noRecentPoint, cc.find(0, 0, 1)->firstRecentPoint);
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, 5, 0, 0));
+}
+
+TEST(CubeCollection, packKeepsTheOrderOfIndexing) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 12);
+    cc.insert(0, 0, 0, anyPoint, 10);
+    cc.insert(0, 0, 0, anyPoint, 11);
+    cc.pack();
+    cc.insert(0, 0, 0, anyPoint, 14);
+    cc.insert(0, 0, 0, anyPoint, 13);
+    cc.pack();
+
+    const Cube* cube = cc.find(0, 0, 0);
+    ASSERT_EQ((std::vector<PointTraits<Point>::index>{12, 10, 11, 14, 13}),
+              std::vector<PointTraits<Point>::index>(cc.packedIndices() + cube->packedBegin,
+                                                     cc.packedIndices() + cube->packedEnd));
+}
+
+TEST(CubeCollection, packedRowsAreContiguous) {
+    CubeCollection<Point> cc;
+    for (CubicCoordinate k = 3; k >= -3; --k) {
+        cc.insert(1, 0, k, anyPoint, 0);
+        cc.insert(0, 0, k, anyPoint, 0);
+    }
+    cc.pack();
+    
+    for (CubicCoordinate k = -3; k < 3; ++k)
+        ASSERT_EQ(cc.find(0, 0, k)->packedEnd, cc.find(0, 0, k + 1)->packedBegin);
+}
+
+TEST(CubeCollection, removePackedAndRecent) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 10);
+    cc.insert(0, 0, 0, anyPoint, 11);
+    cc.insert(0, 0, 0, anyPoint, 12);
+    cc.pack();
+    cc.insert(0, 0, 0, anyPoint, 13);
+    cc.insert(0, 0, 0, anyPoint, 14);
+    
+    ASSERT_TRUE(cc.remove(10));  // Packed: the last packed point takes its place.
+    ASSERT_TRUE(cc.remove(14));  // Recent, head of the list.
+    ASSERT_FALSE(cc.remove(10));
+    ASSERT_FALSE(cc.remove(99));
+    ASSERT_EQ((std::vector<PointTraits<Point>::index>{11, 12, 13}), indicesIn(cc, 0, 0, 0));
+    
+    cc.pack();
+    ASSERT_EQ((std::vector<PointTraits<Point>::index>{11, 12, 13}), indicesIn(cc, 0, 0, 0));
+    ASSERT_EQ(3, cc.find(0, 0, 0)->packedEnd - cc.find(0, 0, 0)->packedBegin);
+}
+
+TEST(CubeCollection, moveInTheSameCube) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, Point{1, 2, 3}, 10);
+    cc.pack();
+    
+    ASSERT_TRUE(cc.move(10, 0, 0, 0, Point{4, 5, 6}));
+    const Cube* cube = cc.find(0, 0, 0);
+    ASSERT_EQ(1, cube->packedEnd - cube->packedBegin);  // Still packed.
+    ASSERT_EQ(4, cc.packedX()[cube->packedBegin]);
+    ASSERT_EQ(5, cc.packedY()[cube->packedBegin]);
+    ASSERT_EQ(6, cc.packedZ()[cube->packedBegin]);
+}
+
+TEST(CubeCollection, moveToAnotherCube) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 10);
+    cc.insert(0, 0, 0, anyPoint, 11);
+    cc.pack();
+    
+    ASSERT_TRUE(cc.move(10, 0, 0, 1, anyPoint));
+    ASSERT_TRUE(cc.move(10, 0, 0, 2, anyPoint));  // Twice, to move a recent point.
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, 0, 0, 0));
+    ASSERT_TRUE(indicesIn(cc, 0, 0, 1).empty());
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, indicesIn(cc, 0, 0, 2));
+}
+
+TEST(CubeCollection, packDropsTheEmptyCubes) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 10);
+    cc.insert(5, 5, 5, anyPoint, 11);
+    cc.insert(-5, 0, 0, anyPoint, 12);
+    cc.pack();
+    cc.remove(11);
+    cc.remove(12);
+    
+    ASSERT_NE(nullptr, cc.find(5, 5, 5));  // Empty, but still there until the next packing.
+    cc.pack();
+    ASSERT_EQ(nullptr, cc.find(5, 5, 5));
+    ASSERT_EQ(nullptr, cc.find(-5, 0, 0));
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, indicesIn(cc, 0, 0, 0));
+    ASSERT_EQ(0, cc.bounds().iLowest);
+    ASSERT_EQ(0, cc.bounds().iHighest);
+    
+    ASSERT_TRUE(cc.move(10, 1, 1, 1, anyPoint));  // The points still know their cube.
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{10}, indicesIn(cc, 1, 1, 1));
+}
+
+TEST(CubeKey, distinctKeys) {
+    ASSERT_NE(MakeCubeKey(0, 0, 1), MakeCubeKey(0, 1, 0));
+    ASSERT_NE(MakeCubeKey(0, 1, 0), MakeCubeKey(1, 0, 0));
+    ASSERT_NE(MakeCubeKey(-1, 0, 0), MakeCubeKey(0, 0, -1));
+    ASSERT_NE(MakeCubeKey(cubeKeyBias - 1, 0, 0), MakeCubeKey(-cubeKeyBias, 0, 0));
+}
+
+TEST(CubeCollection, insertOutsideTheKeyRange) {
+    CubeCollection<Point> cc;
+    cc.insert(cubeKeyBias, 0, 0, anyPoint, 10);
+    cc.insert(-cubeKeyBias - 1, 0, 0, anyPoint, 11);
+    cc.insert(0, 0, 0, anyPoint, 12);
+    cc.insert(cubeKeyBias, 0, 0, anyPoint, 13);
+    
+    for (int packed = 0; packed < 2; ++packed) {
+        ASSERT_EQ((std::vector<PointTraits<Point>::index>{10, 13}), indicesIn(cc, cubeKeyBias, 0, 0));
+        ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, -cubeKeyBias - 1, 0, 0));
+        ASSERT_EQ(std::vector<PointTraits<Point>::index>{12}, indicesIn(cc, 0, 0, 0));
+        ASSERT_EQ(nullptr, cc.find(cubeKeyBias + 1, 0, 0));
+        // Where the key of the far cube would overflow.
+        ASSERT_EQ(nullptr, cc.find(-cubeKeyBias, 0, 0));
+        ASSERT_EQ(-cubeKeyBias - 1, cc.bounds().iLowest);
+        ASSERT_EQ(cubeKeyBias, cc.bounds().iHighest);
+        cc.pack();
+    }
+}
+
+TEST(CubeCollection, packDropsTheEmptyFarCubes) {
+    CubeCollection<Point> cc;
+    cc.insert(0, 0, 0, anyPoint, 10);
+    cc.insert(0, 3 * cubeKeyBias, 0, anyPoint, 11);
+    cc.insert(0, 5 * cubeKeyBias, 0, anyPoint, 12);
+    cc.pack();
+    cc.remove(12);
+    cc.remove(10);
+    cc.pack();
+    
+    ASSERT_EQ(nullptr, cc.find(0, 0, 0));
+    ASSERT_EQ(nullptr, cc.find(0, 5 * cubeKeyBias, 0));
+    ASSERT_EQ(std::vector<PointTraits<Point>::index>{11}, indicesIn(cc, 0, 3 * cubeKeyBias, 0));
+    ASSERT_EQ(3 * cubeKeyBias, cc.bounds().jLowest);
+    ASSERT_EQ(3 * cubeKeyBias, cc.bounds().jHighest);
 }
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
@@ -131,6 +375,14 @@ TEST(CubeIndex, pointsWithinDistance_scanPlusReference) {
     ASSERT_ANY_THROW(cu.pointsWithinDistance(Point{referenceCloseToLimit, 0, 0}, 20, output));
 }
 
+TEST(CubeIndex, remove_notIndexed) {
+    CubeIndex<Point> cu(10);
+    cu.index(Point{0, 0, 0}, 1);
+    cu.remove(1);
+    ASSERT_ANY_THROW(cu.remove(1));
+    ASSERT_ANY_THROW(cu.move(2, Point{0, 0, 0}));
+}
+
 TEST(CubeIndex, invalidCubeSize) {
     ASSERT_ANY_THROW(CubeIndex<Point> cu(-1));
     // No need to deeply test all cases - it relies on a common self-test function.
@@ -200,4 +452,421 @@ TEST(CubeIndex, pointsWithinDistance_bizzarreCubeSize) {
     ASSERT_INDEX_PRESENT(result, 1);
 }
 
-}
\ No newline at end of file
+TEST(CubeIndex, indexAfterCompleted) {
+    CubeIndex<Point> cu(10);
+    cu.index(Point{0, 0, 1}, 1);
+    cu.index(Point{0, 0, 11}, 2);
+    cu.completed();
+    cu.index(Point{0, 0, 2}, 3);  // Same cube as a packed point.
+    cu.index(Point{0, 0, 21}, 4);  // New cube.
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 30, result);
+    ASSERT_EQ(4, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(3, result.at(1).pointIndex);
+    ASSERT_EQ(2, result.at(2).pointIndex);
+    ASSERT_EQ(4, result.at(3).pointIndex);
+    
+    cu.completed();
+    std::vector<IndexAndSquaredDistance<Point>> afterPacking;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 30, afterPacking);
+    ASSERT_EQ(result.size(), afterPacking.size());
+    for (size_t i = 0; i < result.size(); ++i)
+        ASSERT_EQ(result.at(i).pointIndex, afterPacking.at(i).pointIndex);
+}
+
+TEST(CubeIndex, pointsWithinDistance_bigDistanceSameAsNoIndex) {
+    // Distance many times the cube size: some cubes are all inside the sphere, some all outside.
+    CubeIndex<Point> cubeIndex(2);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 5000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23)};
+        cubeIndex.index(p, i);
+        bruteForce.index(p, i);
+    }
+    cubeIndex.completed();
+    
+    const Point referencePoint{1.5, -2.5, 10.25};
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    bruteForce.pointsWithinDistance(referencePoint, 15, expected);
+    cubeIndex.pointsWithinDistance(referencePoint, 15, result);
+    
+    ASSERT_EQ(expected.size(), result.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+}
+
+/* The first k points of a brute force search with a distance that includes them all. */
+static void nearestPointsFromNoIndex(const NoIndex<Point>& bruteForce,
+                                     const Point& referencePoint,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<Point>>& expected)
+{
+    bruteForce.pointsWithinDistance(referencePoint, 100000, expected);
+    if (expected.size() > k)
+        expected.resize(k);
+}
+
+TEST(CubeIndex, nearestPoints_sameAsNoIndex) {
+    CubeIndex<Point> cubeIndex(2);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 2000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23) + 0.5 * (i % 3)};
+        cubeIndex.index(p, i);
+        bruteForce.index(p, i);
+    }
+    cubeIndex.completed();
+    
+    const std::vector<Point> references{{1.5, -2.5, 10.25}, {-50, -30, 0}, {500, 10, 10}, {0, -1000, 1000}};
+    for (const Point& referencePoint : references)
+        for (size_t k : {1, 7, 100}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            nearestPointsFromNoIndex(bruteForce, referencePoint, k, expected);
+            cubeIndex.nearestPoints(referencePoint, k, result);
+            
+            ASSERT_EQ(k, result.size());
+            for (size_t i = 0; i < k; ++i)
+                ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+        }
+}
+
+TEST(CubeIndex, nearestPoints_lessThanK) {
+    CubeIndex<Point> cu(1);
+    cu.index(Point{0, 0, 0}, 1);
+    cu.index(Point{30, -20, 10}, 2);
+    cu.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.nearestPoints(Point{5, 5, 5}, 10, result);
+    
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
+TEST(CubeIndex, nearestPoints_noPoints) {
+    CubeIndex<Point> cu(1);
+    std::vector<IndexAndSquaredDistance<Point>> result{{1, 1}};
+    cu.nearestPoints(Point{5, 5, 5}, 10, result);
+    
+    ASSERT_TRUE(result.empty());
+}
+
+TEST(CubeIndex, removeAndIndexAgain) {
+    CubeIndex<Point> cu(10);
+    cu.index(Point{0, 0, 1}, 1);
+    cu.index(Point{0, 0, 2}, 2);
+    cu.completed();
+    cu.remove(1);
+    cu.index(Point{0, 0, 3}, 1);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 5, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(2, result.at(0).pointIndex);
+    ASSERT_EQ(1, result.at(1).pointIndex);
+    ASSERT_EQ(9, result.at(1).geometricValue);
+}
+
+TEST(CubeIndex, removeAll) {
+    CubeIndex<Point> cu(1);
+    cu.index(Point{0, 0, 0}, 1);
+    cu.index(Point{30, -20, 10}, 2);
+    cu.completed();
+    cu.remove(1);
+    cu.remove(2);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.nearestPoints(Point{5, 5, 5}, 10, result);
+    ASSERT_TRUE(result.empty());
+    
+    cu.completed();
+    cu.nearestPoints(Point{5, 5, 5}, 10, result);
+    ASSERT_TRUE(result.empty());
+}
+
+TEST(CubeIndex, farFromTheOrigin) {
+    // UTM coordinates in meters, small cubes: millions of cubes from the origin, beyond the range of the keys.
+    const Point utm{3000000.5, 5000000.5, 100.5};
+    CubeIndex<Point> cu(1);
+    cu.index(utm, 1);
+    cu.index(Point{utm.x + 1, utm.y, utm.z}, 2);
+    cu.index(Point{0.5, 0.5, 0.5}, 3);
+
+    for (int completed = 0; completed < 2; ++completed) {
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        cu.pointsWithinDistance(utm, 2, result);
+        ASSERT_EQ(2, result.size());
+        ASSERT_EQ(1, result[0].pointIndex);
+        ASSERT_EQ(2, result[1].pointIndex);
+
+        cu.nearestPointsWithinDistance(utm, 2, 1, result);
+        ASSERT_EQ(1, result.size());
+        ASSERT_EQ(1, result[0].pointIndex);
+
+        cu.nearestPoints(Point{utm.x + 0.9, utm.y, utm.z}, 1, result);
+        ASSERT_EQ(1, result.size());
+        ASSERT_EQ(2, result[0].pointIndex);
+
+        cu.pointsWithinDistance(Point{0, 0, 0}, 2, result);
+        ASSERT_EQ(1, result.size());
+        ASSERT_EQ(3, result[0].pointIndex);
+
+        cu.completed();
+    }
+}
+
+TEST(CubeIndex, move_outsideTheKeyRange) {
+    CubeIndex<Point> cu(1);
+    cu.index(Point{0, 0, 0}, 1);
+    cu.move(1, Point{1e7, 0, 0});
+
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_TRUE(result.empty());
+    cu.pointsWithinDistance(Point{1e7, 0, 0}, 1, result);
+    ASSERT_EQ(1, result.size());
+
+    cu.move(1, Point{1e7 + 0.5, 0, 0});  // Same far cube.
+    cu.move(1, Point{0, 0, 0});
+    cu.completed();
+    cu.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(1, result.size());
+    cu.pointsWithinDistance(Point{1e7, 0, 0}, 1, result);
+    ASSERT_TRUE(result.empty());
+}
+
+TEST(CubeIndex, moveSameAsNoIndex) {
+    // Deform a mesh a few times: some points stay in their cube, some change cube, a few go far away.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50,
+                               static_cast<double>((i * 104729) % 61) - 30,
+                               static_cast<double>((i * 31) % 23)});
+    
+    CubeIndex<Point> cubeIndex(4);
+    for (PointIndex i = 0; i < points.size(); ++i)
+        cubeIndex.index(points[i], i);
+    cubeIndex.completed();
+    
+    for (int step = 0; step < 4; ++step) {
+        for (PointIndex i = step; i < points.size(); i += 7) {
+            points[i].x += 0.5 * ((i % 5) - 2.0);
+            points[i].z -= (i % 13 == 0) ? 200 : 0.75;
+            cubeIndex.move(i, points[i]);
+        }
+        if (step % 2 == 1)
+            cubeIndex.completed();
+        
+        NoIndex<Point> bruteForce;
+        for (PointIndex i = 0; i < points.size(); ++i)
+            bruteForce.index(points[i], i);
+        
+        const Point referencePoint{1.5, -2.5, 10.25};
+        std::vector<IndexAndSquaredDistance<Point>> expected;
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        bruteForce.pointsWithinDistance(referencePoint, 15, expected);
+        cubeIndex.pointsWithinDistance(referencePoint, 15, result);
+        
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+        
+        nearestPointsFromNoIndex(bruteForce, Point{0, 0, -500}, 5, expected);
+        cubeIndex.nearestPoints(Point{0, 0, -500}, 5, result);
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+    }
+}
+
+/* Deterministic pseudo random points in [0, side)^3. */
+static std::vector<Point> uniformPoints(const size_t count, const double side) {
+    std::vector<Point> points;
+    uint64_t state = 12345;
+    auto next = [&state, side]() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<double>(state >> 11) / static_cast<double>(1ull << 53) * side;
+    };
+    for (size_t i = 0; i < count; ++i) {
+        const double x = next();
+        const double y = next();
+        const double z = next();
+        points.push_back(Point{x, y, z});
+    }
+    return points;
+}
+
+TEST(CubeIndex, indexAll_sameAsOneByOne) {
+    // Enough points for several chunks, some with negative cubes.
+    std::vector<Point> points = uniformPoints(200000, 1000);
+    for (size_t i = 0; i < points.size(); i += 3)
+        points[i].y -= 500;
+    
+    CubeIndex<Point> oneByOne(20);
+    BuildIndex(points, oneByOne);
+    CubeIndex<Point> bulk(20);
+    WorkerPool workers(4);
+    BuildIndex(points, bulk, workers);
+    
+    const std::vector<Point> references{{500, 0, 500}, {0, -500, 0}, {1000, 500, 1000}};
+    for (const Point& referencePoint : references) {
+        std::vector<IndexAndSquaredDistance<Point>> expected;
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        oneByOne.pointsWithinDistance(referencePoint, 50, expected);
+        bulk.pointsWithinDistance(referencePoint, 50, result);
+        
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQ(expected[i].pointIndex, result[i].pointIndex);
+            ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+        }
+        
+        oneByOne.nearestPoints(referencePoint, 10, expected);
+        bulk.nearestPoints(referencePoint, 10, result);
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            ASSERT_EQ(expected[i].pointIndex, result[i].pointIndex);
+    }
+}
+
+TEST(CubeIndex, indexAll_thenUpdate) {
+    std::vector<Point> points{{1, 1, 1}, {2, 2, 2}, {25, 25, 25}};
+    CubeIndex<Point> cu(10);
+    WorkerPool workers(2);
+    cu.indexAll(points, workers);
+    
+    cu.move(0, Point{26, 26, 26});
+    cu.index(Point{3, 3, 3}, 3);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 10, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(3, result.at(1).pointIndex);
+}
+
+TEST(CubeIndex, indexAll_notEmpty) {
+    CubeIndex<Point> cu(10);
+    cu.index(Point{100, 0, 0}, 7);
+    WorkerPool workers(2);
+    cu.indexAll(std::vector<Point>{{1, 1, 1}, {2, 2, 2}}, workers);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{0, 0, 0}, 1000, result);
+    ASSERT_EQ(3, result.size());
+    ASSERT_EQ(7, result.at(2).pointIndex);
+}
+
+TEST(CubeIndex, indexAll_noPoints) {
+    CubeIndex<Point> cu(10);
+    WorkerPool workers(2);
+    cu.indexAll(std::vector<Point>(), workers);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.nearestPoints(Point{0, 0, 0}, 3, result);
+    ASSERT_TRUE(result.empty());
+}
+
+TEST(CubeIndex, indexAll_outsideTheKeyRange) {
+    CubeIndex<Point> cu(1);
+    WorkerPool workers(2);
+    cu.indexAll(std::vector<Point>{{0, 0, 0}, {1e7, 0, 0}, {1e7 + 0.5, 0, 0}}, workers);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    cu.pointsWithinDistance(Point{1e7, 0, 0}, 1, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result[0].pointIndex);
+    ASSERT_EQ(2, result[1].pointIndex);
+    cu.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(0, result[0].pointIndex);
+}
+
+TEST(SuggestCubeSide, uniformCloud) {
+    // 8000 points in a 100 x 100 x 100 box: cubes of side 10 hold 8 points on average.
+    const double side = SuggestCubeSide(uniformPoints(8000, 100));
+    ASSERT_GT(side, 7);
+    ASSERT_LT(side, 14);
+}
+
+TEST(SuggestCubeSide, biggerThanTheSample) {
+    // Same density as above, in a bigger box: only a sample is analyzed.
+    const double side = SuggestCubeSide(uniformPoints(216000, 300));
+    ASSERT_GT(side, 7);
+    ASSERT_LT(side, 14);
+}
+
+TEST(SuggestCubeSide, surface) {
+    // A flat grid with a point every 1 unit: 8 points are a square of side 2.83.
+    std::vector<Point> points;
+    for (int i = 0; i < 200; ++i)
+        for (int j = 0; j < 200; ++j)
+            points.push_back(Point{i + 0.5, j + 0.5, 3});
+    const double side = SuggestCubeSide(points);
+    ASSERT_GT(side, 2);
+    ASSERT_LT(side, 4);
+}
+
+TEST(SuggestCubeSide, clusters) {
+    // Two tight clusters far apart: the empty space between them must not count.
+    std::vector<Point> points = uniformPoints(4000, 10);
+    for (const Point& p : uniformPoints(4000, 10))
+        points.push_back(Point{p.x + 10000, p.y, p.z});
+    const double side = SuggestCubeSide(points);
+    ASSERT_GT(side, 1);
+    ASSERT_LT(side, 2.5);  // 8 points per cube: the clusters have 4 points per unit of volume.
+}
+
+TEST(SuggestCubeSide, degenerate) {
+    ASSERT_EQ(1, SuggestCubeSide(std::vector<Point>()));
+    ASSERT_EQ(1, SuggestCubeSide(std::vector<Point>{{1, 2, 3}}));
+    ASSERT_EQ(1, SuggestCubeSide(std::vector<Point>{{1, 2, 3}, {1, 2, 3}}));
+    ASSERT_GT(SuggestCubeSide(std::vector<Point>{{1, 2, 3}, {1, 2, 4}}), 0);
+}
+
+TEST(SuggestCubeSide, lookupsMatter) {
+    const std::vector<Point> points = uniformPoints(8000, 100);
+    const double withoutHints = SuggestCubeSide(points);
+    
+    CubeSideHints<Point> bigDistance;
+    bigDistance.queryRadius = 50;
+    ASSERT_GT(SuggestCubeSide(points, bigDistance), withoutHints);
+    
+    CubeSideHints<Point> smallDistance;
+    smallDistance.queryRadius = 0.5;
+    ASSERT_LT(SuggestCubeSide(points, smallDistance), withoutHints);
+    
+    CubeSideHints<Point> manyNeighbors;
+    manyNeighbors.neighbors = 1000;
+    ASSERT_GT(SuggestCubeSide(points, manyNeighbors), withoutHints);
+}
+
+TEST(BuildCubeIndex, sameAsNoIndex) {
+    const std::vector<Point> points = uniformPoints(5000, 100);
+    CubeSideHints<Point> hints;
+    hints.queryRadius = 20;
+    const CubeIndex<Point> cubeIndex = BuildCubeIndex(points, hints);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < points.size(); ++i)
+        bruteForce.index(points[i], i);
+    
+    const Point referencePoint{50, 40, 30};
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    bruteForce.pointsWithinDistance(referencePoint, 20, expected);
+    cubeIndex.pointsWithinDistance(referencePoint, 20, result);
+    
+    ASSERT_EQ(expected.size(), result.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_EQ(expected[i].pointIndex, result[i].pointIndex);
+}
+
+}
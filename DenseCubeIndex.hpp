@@ -0,0 +1,341 @@
+#ifndef GEOINDEX_DENSE_CUBE_INDEX
+#define GEOINDEX_DENSE_CUBE_INDEX
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+#include "Common.hpp"
+#include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+
+namespace geoIndex {
+
+/** Same idea as the CubeIndex (divide the space in cubes, look only in the cubes close to the reference),
+ *  but the cubes are a plain 3D grid that covers the bounding box of the points. No hashing at all.
+ *
+ *  The points are sorted by cube and stored in a single array ("compressed sparse row" layout, as in sparse matrices):
+ *  cubeStart[c] tells where the points of cube c begin, cubeStart[c + 1] where they end.
+ *  The cubes are numbered so that the cubes along z are consecutive, then their points are consecutive too:
+ *  each row of cubes in the search is a single run over contiguous memory.
+ *
+ *  Preparing the index is a counting sort: one pass to count the points per cube, one to put them in place.
+ *
+ *  The grid has a cube for every position in the bounding box, empty or not: good when the points fill their
+ *  bounding box, terrible if a few of them are very far from the others. Use CubeIndex in that case.
+ *
+ *  The user must call completed() between modifications and lookups.
+ */
+template <typename POINT>
+class DenseCubeIndex {
+public:
+    /** Creates an index that divides the space in cubes of the given side size.
+     *  If you know how many points you are going to use, tell it to the constructor to reserve memory. */
+    DenseCubeIndex(const typename PointTraits<POINT>::coordinate cubeSide,
+                   const size_t expectedCollectionSize = 0) :
+        gridStep(cubeSide),
+        cubesX(0),
+        cubesY(0),
+        cubesZ(0)
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(gridStep);
+            readyForLookups = true;  // Nothing inside, nothing to prepare.
+        #endif
+
+        coordinatesX.reserve(expectedCollectionSize);
+        coordinatesY.reserve(expectedCollectionSize);
+        coordinatesZ.reserve(expectedCollectionSize);
+        indices.reserve(expectedCollectionSize);
+    }
+
+    /** Adds a point to the index. Remember its name too. */
+    void index(const POINT& p, const typename PointTraits<POINT>::index index) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = false;
+
+            if (std::find(begin(indices), end(indices), index) != end(indices))
+                throw std::runtime_error("DenseCubeIndex::index Point indexed twice");
+        #endif
+
+        coordinatesX.push_back(p.x);
+        coordinatesY.push_back(p.y);
+        coordinatesZ.push_back(p.z);
+        indices.push_back(index);
+    }
+
+    /** Builds the grid around all the points indexed so far.
+     *  It can be called again after indexing more points, but it redoes all the work. */
+    void completed() {
+        cubesX = cubesY = cubesZ = 0;
+        cubeStart.clear();
+
+        if (indices.empty()) {
+            #ifdef GEO_INDEX_SAFETY_CHECKS
+                readyForLookups = true;
+            #endif
+            return;
+        }
+
+        originX = *std::min_element(std::begin(coordinatesX), std::end(coordinatesX));
+        originY = *std::min_element(std::begin(coordinatesY), std::end(coordinatesY));
+        originZ = *std::min_element(std::begin(coordinatesZ), std::end(coordinatesZ));
+
+        cubesX = cubesAlong(originX, *std::max_element(std::begin(coordinatesX), std::end(coordinatesX)));
+        cubesY = cubesAlong(originY, *std::max_element(std::begin(coordinatesY), std::end(coordinatesY)));
+        cubesZ = cubesAlong(originZ, *std::max_element(std::begin(coordinatesZ), std::end(coordinatesZ)));
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (cubesY > std::numeric_limits<size_t>::max() / cubesZ ||
+                cubesX > std::numeric_limits<size_t>::max() / (cubesY * cubesZ) - 1)
+                throw std::runtime_error("Too many cubes. Use bigger ones.");
+        #endif
+
+        const size_t cubeCount = cubesX * cubesY * cubesZ;
+
+        // First pass: count the points in each cube. Cube c counts in c + 1, so the prefix sum gives the starts.
+        std::vector<size_t> cubeOfPoint(indices.size());
+        cubeStart.assign(cubeCount + 1, 0);
+        for (size_t point = 0; point < indices.size(); ++point) {
+            const size_t cube = linearCube(cubeAlong(coordinatesX[point], originX, cubesX),
+                                           cubeAlong(coordinatesY[point], originY, cubesY),
+                                           cubeAlong(coordinatesZ[point], originZ, cubesZ));
+            cubeOfPoint[point] = cube;
+            ++cubeStart[cube + 1];
+        }
+
+        for (size_t cube = 0; cube < cubeCount; ++cube)
+            cubeStart[cube + 1] += cubeStart[cube];
+
+        // Second pass: move each point to the next free place in its cube.
+        std::vector<size_t> nextFree(std::begin(cubeStart), std::end(cubeStart) - 1);
+        std::vector<typename PointTraits<POINT>::coordinate> sortedX(indices.size());
+        std::vector<typename PointTraits<POINT>::coordinate> sortedY(indices.size());
+        std::vector<typename PointTraits<POINT>::coordinate> sortedZ(indices.size());
+        std::vector<typename PointTraits<POINT>::index> sortedIndices(indices.size());
+        for (size_t point = 0; point < indices.size(); ++point) {
+            const size_t destination = nextFree[cubeOfPoint[point]]++;
+            sortedX[destination] = coordinatesX[point];
+            sortedY[destination] = coordinatesY[point];
+            sortedZ[destination] = coordinatesZ[point];
+            sortedIndices[destination] = indices[point];
+        }
+
+        coordinatesX.swap(sortedX);
+        coordinatesY.swap(sortedY);
+        coordinatesZ.swap(sortedZ);
+        indices.swap(sortedIndices);
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = true;
+        #endif
+    }
+
+    /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
+    *  Returns the points sorted in distance order from p (to simplify computing the k-nearest-neighbor).
+    *  The returned structure also gives the squared distance. The client can do a sqrt and use it for its computations.
+    *
+    *  Returns only points strictly within the distance.
+    */
+    void pointsWithinDistance(const POINT& p,
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+
+        output.clear();
+
+        CubeRange range;
+        if (! scanRange(p, d, range))
+            return;
+
+        for (size_t i = range.firstX; i <= range.lastX; ++i)
+            for (size_t j = range.firstY; j <= range.lastY; ++j) {
+                const size_t begin = cubeStart[linearCube(i, j, range.firstZ)];
+                const size_t end = cubeStart[linearCube(i, j, range.lastZ) + 1];
+                AppendPointsWithinSquaredDistance(p,
+                                                  distanceLimit,
+                                                  coordinatesX.data() + begin,
+                                                  coordinatesY.data() + begin,
+                                                  coordinatesZ.data() + begin,
+                                                  indices.data() + begin,
+                                                  end - begin,
+                                                  output);
+            }
+
+        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    }
+
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements.
+     *  Rows of cubes that are farther than the k-th point found so far are skipped.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p,
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        KNearestCandidates<POINT> nearest(k, squaredDistanceLimit(d), output);
+
+        CubeRange range;
+        if (! scanRange(p, d, range)) {
+            nearest.sort();
+            return;
+        }
+
+        const typename PointTraits<POINT>::coordinate zDistance = distanceFromCubes(p.z, originZ, range.firstZ, range.lastZ);
+
+        std::vector<IndexAndSquaredDistance<POINT> > rowHits;
+        for (size_t i = range.firstX; i <= range.lastX; ++i) {
+            const typename PointTraits<POINT>::coordinate xDistance = distanceFromCubes(p.x, originX, i, i);
+
+            for (size_t j = range.firstY; j <= range.lastY; ++j) {
+                const typename PointTraits<POINT>::coordinate yDistance = distanceFromCubes(p.y, originY, j, j);
+                const typename PointTraits<POINT>::coordinate rowSquaredDistance =
+                    xDistance * xDistance + yDistance * yDistance + zDistance * zDistance;
+                if (! (rowSquaredDistance < nearest.squaredLimit()))
+                    continue;
+
+                const size_t begin = cubeStart[linearCube(i, j, range.firstZ)];
+                const size_t end = cubeStart[linearCube(i, j, range.lastZ) + 1];
+
+                rowHits.clear();
+                AppendPointsWithinSquaredDistance(p,
+                                                  nearest.squaredLimit(),
+                                                  coordinatesX.data() + begin,
+                                                  coordinatesY.data() + begin,
+                                                  coordinatesZ.data() + begin,
+                                                  indices.data() + begin,
+                                                  end - begin,
+                                                  rowHits);
+                for (const auto& hit : rowHits)
+                    nearest.offer(hit.pointIndex, hit.geometricValue);
+            }
+        }
+
+        nearest.sort();
+    }
+
+private:
+    const typename PointTraits<POINT>::coordinate gridStep;
+
+    // Corner of the grid (the smallest coordinates among the points) and number of cubes on each axis.
+    typename PointTraits<POINT>::coordinate originX;
+    typename PointTraits<POINT>::coordinate originY;
+    typename PointTraits<POINT>::coordinate originZ;
+    size_t cubesX;
+    size_t cubesY;
+    size_t cubesZ;
+
+    std::vector<size_t> cubeStart;  ///< One more element than the cubes: the end of the last cube.
+
+    // The points, sorted by cube after completed().
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+    std::vector<typename PointTraits<POINT>::index> indices;
+
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        bool readyForLookups;
+    #endif
+
+    /** The cubes that may contain points within the search distance, limited to the grid. Extremes included. */
+    struct CubeRange {
+        size_t firstX, lastX;
+        size_t firstY, lastY;
+        size_t firstZ, lastZ;
+    };
+
+
+    size_t linearCube(const size_t i, const size_t j, const size_t k) const {
+        return (i * cubesY + j) * cubesZ + k;
+    }
+
+    size_t cubesAlong(const typename PointTraits<POINT>::coordinate minimum,
+                      const typename PointTraits<POINT>::coordinate maximum) const {
+        const typename PointTraits<POINT>::coordinate cubes = std::floor((maximum - minimum) / gridStep);
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (cubes >= std::numeric_limits<size_t>::max())
+                throw std::runtime_error("Too many cubes. Use bigger ones.");
+        #endif
+        return static_cast<size_t>(cubes) + 1;
+    }
+
+    /** Position of the cube that contains the coordinate. Clamped, in case rounding pushes the biggest coordinate out. */
+    size_t cubeAlong(const typename PointTraits<POINT>::coordinate coordinate,
+                     const typename PointTraits<POINT>::coordinate origin,
+                     const size_t cubes) const {
+        const size_t cube = static_cast<size_t>(std::floor((coordinate - origin) / gridStep));
+        return std::min(cube, cubes - 1);
+    }
+
+    /** Cubes from reference - d to reference + d (plus one more cube on each side, for rounding), cut to [0, cubes).
+     *  Returns false if no cube is left. */
+    static bool clampedRange(const typename PointTraits<POINT>::coordinate firstCube,
+                             const typename PointTraits<POINT>::coordinate lastCube,
+                             const size_t cubes,
+                             size_t& first,
+                             size_t& last) {
+        if (lastCube < 0 || firstCube >= cubes)
+            return false;
+
+        first = firstCube < 0 ? 0 : static_cast<size_t>(firstCube);
+        last = lastCube >= cubes ? cubes - 1 : static_cast<size_t>(lastCube);
+        return true;
+    }
+
+    bool scanRange(const POINT& p,
+                   const typename PointTraits<POINT>::coordinate d,
+                   CubeRange& range) const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (! readyForLookups)
+                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
+        #endif
+
+        if (cubeStart.empty())
+            return false;
+
+        return clampedRange(std::floor((p.x - d - originX) / gridStep) - 1,
+                            std::floor((p.x + d - originX) / gridStep) + 1,
+                            cubesX, range.firstX, range.lastX) &&
+               clampedRange(std::floor((p.y - d - originY) / gridStep) - 1,
+                            std::floor((p.y + d - originY) / gridStep) + 1,
+                            cubesY, range.firstY, range.lastY) &&
+               clampedRange(std::floor((p.z - d - originZ) / gridStep) - 1,
+                            std::floor((p.z + d - originZ) / gridStep) + 1,
+                            cubesZ, range.firstZ, range.lastZ);
+    }
+
+    /** Distance, along one axis, from the coordinate to the interval covered by the cubes from first to last. */
+    typename PointTraits<POINT>::coordinate distanceFromCubes(const typename PointTraits<POINT>::coordinate coordinate,
+                                                              const typename PointTraits<POINT>::coordinate origin,
+                                                              const size_t first,
+                                                              const size_t last) const {
+        const typename PointTraits<POINT>::coordinate lowerSide = origin + first * gridStep;
+        const typename PointTraits<POINT>::coordinate upperSide = origin + (last + 1) * gridStep;
+        if (coordinate < lowerSide)
+            return lowerSide - coordinate;
+        if (coordinate > upperSide)
+            return coordinate - upperSide;
+        return 0;
+    }
+
+    typename PointTraits<POINT>::coordinate squaredDistanceLimit(const typename PointTraits<POINT>::coordinate d) const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+
+        const typename PointTraits<POINT>::coordinate distanceLimit = d * d;
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(distanceLimit);
+        #endif
+
+        return distanceLimit;
+    }
+};
+
+}
+
+#endif
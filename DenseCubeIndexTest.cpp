@@ -0,0 +1,184 @@
+#include "gtest/gtest.h"
+
+#include "DenseCubeIndex.hpp"
+
+#include <vector>
+#include <limits>
+#include "Common.hpp"
+#include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+using namespace std;
+
+namespace geoIndex {
+
+static const PointTraits<Point>::coordinate gridStep = 10.0;
+
+TEST(DenseCubeIndex, pointsWithinDistance_samePoint) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_samePoint(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_coincidentPoints) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_coincidentPoints(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_noPoints) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_noPoints(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_onlyFarPoints) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_onlyFarPoints(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_inAndOutPoints) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_inAndOutPoints(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_exactDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_exactDistance(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_outputOrder) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_outputOrder(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_squareDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_squareDistance(index);
+}
+
+TEST(DenseCubeIndex, nearestPointsWithinDistance_closestK) {
+    DenseCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(DenseCubeIndex, nearestPointsWithinDistance_lessThanK) {
+    DenseCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(DenseCubeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(DenseCubeIndex, index_duplicatedIndex) {
+    DenseCubeIndex<Point> index(gridStep);
+    index_duplicatedIndex(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_negativeDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_negativeDistance(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_zeroDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_zeroDistance(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_NanDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_NanDistance(index);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_overflowDistance) {
+    DenseCubeIndex<Point> index(gridStep);
+    pointsWithinDistance_overflowDistance(index);
+}
+
+#endif
+
+
+/* Specific tests for this implementation. */
+TEST(DenseCubeIndex, pointsWithinDistance_referenceOutsideTheGrid) {
+    DenseCubeIndex<Point> index(1);
+    index.index(Point{0, 0, 0}, 1);
+    index.index(Point{5, 5, 5}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{-2, 0, 0}, 2.5, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_INDEX_PRESENT(result, 1);
+    
+    index.pointsWithinDistance(Point{100, 0, 0}, 2.5, result);
+    ASSERT_TRUE(result.empty());
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_negativeCoordinates) {
+    DenseCubeIndex<Point> index(0.5);
+    index.index(Point{-10, -10, -10}, 1);
+    index.index(Point{-10.2, -10, -9.9}, 2);
+    index.index(Point{-8, -10, -10}, 3);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{-10, -10, -10}, 1, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
+TEST(DenseCubeIndex, pointsWithinDistance_sameAsNoIndex) {
+    DenseCubeIndex<Point> denseIndex(3);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 5000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23)};
+        denseIndex.index(p, i);
+        bruteForce.index(p, i);
+    }
+    denseIndex.completed();
+    
+    const Point referencePoint{1.5, -2.5, 10.25};
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    bruteForce.pointsWithinDistance(referencePoint, 9, expected);
+    denseIndex.pointsWithinDistance(referencePoint, 9, result);
+    
+    ASSERT_EQ(expected.size(), result.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+}
+
+TEST(DenseCubeIndex, completedTwice) {
+    DenseCubeIndex<Point> index(1);
+    index.index(Point{0, 0, 0}, 1);
+    index.completed();
+    index.index(Point{0.5, 0, 0}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(2, result.size());
+}
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(DenseCubeIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+    const Point anyPoint{1, 55, 2};
+  
+    DenseCubeIndex<Point> index(1);
+    index.index(anyPoint, 1);
+    // No call to completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    ASSERT_ANY_THROW(index.pointsWithinDistance(anyPoint, 0.01, result));
+}
+
+TEST(DenseCubeIndex, invalidCubeSize) {
+    ASSERT_ANY_THROW(DenseCubeIndex<Point> index(-1));
+}
+#endif
+
+}
@@ -0,0 +1,322 @@
+#ifndef GEOINDEX_DISTANCE_KERNELS
+#define GEOINDEX_DISTANCE_KERNELS
+
+#include <vector>
+#include <cstdint>
+
+#include "BasicGeometry.hpp"
+#include "Common.hpp"
+
+/* The vectorized loops are used only if the compiler is told it can use the instructions
+ * (-mavx2, -mavx512f or simply -march=native). The checked version never uses them:
+ * the plain loop is the one that does the overflow checks. */
+#if !defined(GEO_INDEX_SAFETY_CHECKS) && defined(__AVX512F__)
+    #define GEO_INDEX_AVX512_KERNELS
+    #include <immintrin.h>
+#elif !defined(GEO_INDEX_SAFETY_CHECKS) && defined(__AVX2__)
+    #define GEO_INDEX_AVX2_KERNELS
+    #include <immintrin.h>
+#endif
+
+namespace geoIndex {
+
+/** This file has the "innermost loop" of brute force searches: compare a reference point
+ *  against a block of points and keep those that are close enough.
+ *
+ *  The points must be stored as a "structure of arrays": all the x in an array, all the y in another...
+ *  plus one more array for the point indices. This is what allows to load several coordinates in a
+ *  single SIMD register.
+ */
+
+
+/** Processes the longest prefix of the points that fits in whole SIMD registers.
+ *  Returns how many points it processed. The generic version does nothing: the caller will
+ *  take care of all the points with plain code.
+ *  There are specializations for double and float, if the CPU allows. */
+template <typename COORDINATE>
+struct SquaredDistanceLanes {
+    template <typename POINT>
+    static size_t scan(const POINT&,
+                       const typename PointTraits<POINT>::coordinate,
+                       const typename PointTraits<POINT>::coordinate*,
+                       const typename PointTraits<POINT>::coordinate*,
+                       const typename PointTraits<POINT>::coordinate*,
+                       const typename PointTraits<POINT>::index*,
+                       const size_t,
+                       std::vector<IndexAndSquaredDistance<POINT> >&)
+    {
+        return 0;
+    }
+};
+
+
+#ifdef GEO_INDEX_AVX512_KERNELS
+
+/* The hits in a register are compressed to the front of small buffers, then copied to the output.
+ * The lane number, not the point index, is compressed: the index type is up to the user. */
+template <>
+struct SquaredDistanceLanes<double> {
+    template <typename POINT>
+    static size_t scan(const POINT& reference,
+                       const double squaredLimit,
+                       const double* coordinatesX,
+                       const double* coordinatesY,
+                       const double* coordinatesZ,
+                       const typename PointTraits<POINT>::index* indices,
+                       const size_t count,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output)
+    {
+        const __m512d referenceX = _mm512_set1_pd(reference.x);
+        const __m512d referenceY = _mm512_set1_pd(reference.y);
+        const __m512d referenceZ = _mm512_set1_pd(reference.z);
+        const __m512d limit = _mm512_set1_pd(squaredLimit);
+        const __m512i lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+
+        alignas(64) double hitDistances[8];
+        alignas(64) int64_t hitLanes[8];
+
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m512d dx = _mm512_sub_pd(referenceX, _mm512_loadu_pd(coordinatesX + i));
+            const __m512d dy = _mm512_sub_pd(referenceY, _mm512_loadu_pd(coordinatesY + i));
+            const __m512d dz = _mm512_sub_pd(referenceZ, _mm512_loadu_pd(coordinatesZ + i));
+            const __m512d squaredDistance = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx),
+                                                                        _mm512_mul_pd(dy, dy)),
+                                                          _mm512_mul_pd(dz, dz));
+
+            const __mmask8 hits = _mm512_cmp_pd_mask(squaredDistance, limit, _CMP_LT_OQ);
+            if (hits == 0)
+                continue;
+
+            _mm512_mask_compressstoreu_pd(hitDistances, hits, squaredDistance);
+            _mm512_mask_compressstoreu_epi64(hitLanes, hits, lanes);
+            const int hitCount = __builtin_popcount(hits);
+            for (int h = 0; h < hitCount; ++h)
+                output.push_back({indices[i + hitLanes[h]], hitDistances[h]});
+        }
+        return i;
+    }
+};
+
+template <>
+struct SquaredDistanceLanes<float> {
+    template <typename POINT>
+    static size_t scan(const POINT& reference,
+                       const float squaredLimit,
+                       const float* coordinatesX,
+                       const float* coordinatesY,
+                       const float* coordinatesZ,
+                       const typename PointTraits<POINT>::index* indices,
+                       const size_t count,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output)
+    {
+        const __m512 referenceX = _mm512_set1_ps(reference.x);
+        const __m512 referenceY = _mm512_set1_ps(reference.y);
+        const __m512 referenceZ = _mm512_set1_ps(reference.z);
+        const __m512 limit = _mm512_set1_ps(squaredLimit);
+        const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+        alignas(64) float hitDistances[16];
+        alignas(64) int32_t hitLanes[16];
+
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m512 dx = _mm512_sub_ps(referenceX, _mm512_loadu_ps(coordinatesX + i));
+            const __m512 dy = _mm512_sub_ps(referenceY, _mm512_loadu_ps(coordinatesY + i));
+            const __m512 dz = _mm512_sub_ps(referenceZ, _mm512_loadu_ps(coordinatesZ + i));
+            const __m512 squaredDistance = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx),
+                                                                       _mm512_mul_ps(dy, dy)),
+                                                         _mm512_mul_ps(dz, dz));
+
+            const __mmask16 hits = _mm512_cmp_ps_mask(squaredDistance, limit, _CMP_LT_OQ);
+            if (hits == 0)
+                continue;
+
+            _mm512_mask_compressstoreu_ps(hitDistances, hits, squaredDistance);
+            _mm512_mask_compressstoreu_epi32(hitLanes, hits, lanes);
+            const int hitCount = __builtin_popcount(hits);
+            for (int h = 0; h < hitCount; ++h)
+                output.push_back({indices[i + hitLanes[h]], hitDistances[h]});
+        }
+        return i;
+    }
+};
+
+#endif
+
+
+#ifdef GEO_INDEX_AVX2_KERNELS
+
+/* No compress instruction in AVX2: walk the bits of the comparison mask instead. */
+template <>
+struct SquaredDistanceLanes<double> {
+    template <typename POINT>
+    static size_t scan(const POINT& reference,
+                       const double squaredLimit,
+                       const double* coordinatesX,
+                       const double* coordinatesY,
+                       const double* coordinatesZ,
+                       const typename PointTraits<POINT>::index* indices,
+                       const size_t count,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output)
+    {
+        const __m256d referenceX = _mm256_set1_pd(reference.x);
+        const __m256d referenceY = _mm256_set1_pd(reference.y);
+        const __m256d referenceZ = _mm256_set1_pd(reference.z);
+        const __m256d limit = _mm256_set1_pd(squaredLimit);
+
+        alignas(32) double distances[4];
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m256d dx = _mm256_sub_pd(referenceX, _mm256_loadu_pd(coordinatesX + i));
+            const __m256d dy = _mm256_sub_pd(referenceY, _mm256_loadu_pd(coordinatesY + i));
+            const __m256d dz = _mm256_sub_pd(referenceZ, _mm256_loadu_pd(coordinatesZ + i));
+            const __m256d squaredDistance = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                                        _mm256_mul_pd(dy, dy)),
+                                                          _mm256_mul_pd(dz, dz));
+
+            int hits = _mm256_movemask_pd(_mm256_cmp_pd(squaredDistance, limit, _CMP_LT_OQ));
+            if (hits == 0)
+                continue;
+
+            _mm256_store_pd(distances, squaredDistance);
+            while (hits != 0) {
+                const int lane = __builtin_ctz(hits);
+                output.push_back({indices[i + lane], distances[lane]});
+                hits &= hits - 1;
+            }
+        }
+        return i;
+    }
+};
+
+template <>
+struct SquaredDistanceLanes<float> {
+    template <typename POINT>
+    static size_t scan(const POINT& reference,
+                       const float squaredLimit,
+                       const float* coordinatesX,
+                       const float* coordinatesY,
+                       const float* coordinatesZ,
+                       const typename PointTraits<POINT>::index* indices,
+                       const size_t count,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output)
+    {
+        const __m256 referenceX = _mm256_set1_ps(reference.x);
+        const __m256 referenceY = _mm256_set1_ps(reference.y);
+        const __m256 referenceZ = _mm256_set1_ps(reference.z);
+        const __m256 limit = _mm256_set1_ps(squaredLimit);
+
+        alignas(32) float distances[8];
+
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256 dx = _mm256_sub_ps(referenceX, _mm256_loadu_ps(coordinatesX + i));
+            const __m256 dy = _mm256_sub_ps(referenceY, _mm256_loadu_ps(coordinatesY + i));
+            const __m256 dz = _mm256_sub_ps(referenceZ, _mm256_loadu_ps(coordinatesZ + i));
+            const __m256 squaredDistance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                                                       _mm256_mul_ps(dy, dy)),
+                                                         _mm256_mul_ps(dz, dz));
+
+            int hits = _mm256_movemask_ps(_mm256_cmp_ps(squaredDistance, limit, _CMP_LT_OQ));
+            if (hits == 0)
+                continue;
+
+            _mm256_store_ps(distances, squaredDistance);
+            while (hits != 0) {
+                const int lane = __builtin_ctz(hits);
+                output.push_back({indices[i + lane], distances[lane]});
+                hits &= hits - 1;
+            }
+        }
+        return i;
+    }
+};
+
+#endif
+
+
+/** Appends to the output the points strictly closer than the limit (a squared distance!) to the reference.
+ *  Does not clean the output and does not sort it: the caller may call this on several blocks of points
+ *  before doing so.
+ *
+ *  Uses the SIMD versions for as many points as possible, then finishes the job with normal code.
+ */
+template <typename POINT>
+void AppendPointsWithinSquaredDistance(const POINT& reference,
+                                       const typename PointTraits<POINT>::coordinate squaredLimit,
+                                       const typename PointTraits<POINT>::coordinate* coordinatesX,
+                                       const typename PointTraits<POINT>::coordinate* coordinatesY,
+                                       const typename PointTraits<POINT>::coordinate* coordinatesZ,
+                                       const typename PointTraits<POINT>::index* indices,
+                                       const size_t count,
+                                       std::vector<IndexAndSquaredDistance<POINT> >& output)
+{
+    typedef typename PointTraits<POINT>::coordinate Coordinate;
+
+    const size_t doneWithSimd = SquaredDistanceLanes<Coordinate>::scan(reference,
+                                                                       squaredLimit,
+                                                                       coordinatesX,
+                                                                       coordinatesY,
+                                                                       coordinatesZ,
+                                                                       indices,
+                                                                       count,
+                                                                       output);
+
+    for (size_t i = doneWithSimd; i < count; ++i) {
+        const Coordinate xDistance = reference.x - coordinatesX[i];
+        const Coordinate yDistance = reference.y - coordinatesY[i];
+        const Coordinate zDistance = reference.z - coordinatesZ[i];
+        const Coordinate squaredDistance = xDistance * xDistance +
+                                           yDistance * yDistance +
+                                           zDistance * zDistance;
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(squaredDistance);
+        #endif
+
+        if (squaredDistance < squaredLimit)
+            output.push_back({indices[i], squaredDistance});
+    }
+}
+
+
+/** Appends to the output all the points, with their squared distance from the reference. For blocks of points
+ *  that are known to be close enough: no comparison at all. The output is not cleaned and not sorted.
+ *
+ *  Writes in place after a single resize: the loop has no branch and the compiler can vectorize it.
+ */
+template <typename POINT>
+void AppendPointsWithSquaredDistance(const POINT& reference,
+                                     const typename PointTraits<POINT>::coordinate* coordinatesX,
+                                     const typename PointTraits<POINT>::coordinate* coordinatesY,
+                                     const typename PointTraits<POINT>::coordinate* coordinatesZ,
+                                     const typename PointTraits<POINT>::index* indices,
+                                     const size_t count,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output)
+{
+    typedef typename PointTraits<POINT>::coordinate Coordinate;
+
+    const size_t firstNew = output.size();
+    output.resize(firstNew + count);
+    IndexAndSquaredDistance<POINT>* const destination = output.data() + firstNew;
+
+    for (size_t i = 0; i < count; ++i) {
+        const Coordinate xDistance = reference.x - coordinatesX[i];
+        const Coordinate yDistance = reference.y - coordinatesY[i];
+        const Coordinate zDistance = reference.z - coordinatesZ[i];
+        const Coordinate squaredDistance = xDistance * xDistance +
+                                           yDistance * yDistance +
+                                           zDistance * zDistance;
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(squaredDistance);
+        #endif
+
+        destination[i].pointIndex = indices[i];
+        destination[i].geometricValue = squaredDistance;
+    }
+}
+
+}
+
+#endif
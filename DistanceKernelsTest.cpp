@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+
+#include "DistanceKernels.hpp"
+
+#include <vector>
+
+#include "BasicGeometry.hpp"
+#include "Common.hpp"
+#include "DomainAssertions.hpp"
+
+namespace geoIndex {
+
+/* Lay points on the x axis, one unit apart. Enough of them to fill some SIMD registers and leave a remainder. */
+template <typename COORDINATE>
+static void pointsOnXAxis(const size_t count,
+                          std::vector<COORDINATE>& coordinatesX,
+                          std::vector<COORDINATE>& coordinatesY,
+                          std::vector<COORDINATE>& coordinatesZ,
+                          std::vector<PointIndex>& indices)
+{
+    for (size_t i = 0; i < count; ++i) {
+        coordinatesX.push_back(static_cast<COORDINATE>(i));
+        coordinatesY.push_back(0);
+        coordinatesZ.push_back(0);
+        indices.push_back(i + 100);  // Not the position in the arrays, to be sure the right value is used.
+    }
+}
+
+
+TEST(AppendPointsWithinSquaredDistance, noPoints) {
+    const Point reference{0, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > output;
+
+    AppendPointsWithinSquaredDistance(reference, 1.0, nullptr, nullptr, nullptr, nullptr, 0, output);
+
+    ASSERT_TRUE(output.empty());
+}
+
+TEST(AppendPointsWithinSquaredDistance, doesNotCleanOutput) {
+    std::vector<double> x, y, z;
+    std::vector<PointIndex> indices;
+    pointsOnXAxis<double>(1, x, y, z, indices);
+
+    const Point reference{0, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > output{{7, 0.5}};
+
+    AppendPointsWithinSquaredDistance(reference, 1.0, x.data(), y.data(), z.data(), indices.data(), indices.size(), output);
+
+    ASSERT_EQ(2, output.size());
+    ASSERT_INDEX_PRESENT(output, 7);
+    ASSERT_INDEX_PRESENT(output, 100);
+}
+
+TEST(AppendPointsWithinSquaredDistance, hitsAcrossRegisters) {
+    std::vector<double> x, y, z;
+    std::vector<PointIndex> indices;
+    pointsOnXAxis<double>(37, x, y, z, indices);
+
+    const Point reference{20, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > output;
+
+    // Distance 10: points from 11 to 29 (strictly inside).
+    AppendPointsWithinSquaredDistance(reference, 100.0, x.data(), y.data(), z.data(), indices.data(), indices.size(), output);
+
+    ASSERT_EQ(19, output.size());
+    for (PointIndex i = 11; i < 30; ++i)
+        ASSERT_INDEX_PRESENT(output, i + 100);
+}
+
+TEST(AppendPointsWithinSquaredDistance, squaredDistances) {
+    std::vector<double> x, y, z;
+    std::vector<PointIndex> indices;
+    pointsOnXAxis<double>(21, x, y, z, indices);
+
+    const Point reference{0, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > output;
+
+    AppendPointsWithinSquaredDistance(reference, 1000.0, x.data(), y.data(), z.data(), indices.data(), indices.size(), output);
+
+    ASSERT_EQ(21, output.size());
+    for (const auto& hit : output)
+        ASSERT_EQ((hit.pointIndex - 100) * (hit.pointIndex - 100), hit.geometricValue);
+}
+
+TEST(AppendPointsWithinSquaredDistance, floatPoints) {
+    std::vector<float> x, y, z;
+    std::vector<PointIndex> indices;
+    pointsOnXAxis<float>(37, x, y, z, indices);
+
+    const FloatPoint reference{36, 0, 0};
+    std::vector<IndexAndSquaredDistance<FloatPoint> > output;
+
+    AppendPointsWithinSquaredDistance(reference, 4.0f, x.data(), y.data(), z.data(), indices.data(), indices.size(), output);
+
+    ASSERT_EQ(2, output.size());
+    ASSERT_EQ(135 + 136, output.at(0).pointIndex + output.at(1).pointIndex);  // In any order.
+}
+
+
+TEST(AppendPointsWithSquaredDistance, allPoints) {
+    std::vector<double> x, y, z;
+    std::vector<PointIndex> indices;
+    pointsOnXAxis<double>(11, x, y, z, indices);
+
+    const Point reference{0, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > output{{7, 0.5}};
+
+    AppendPointsWithSquaredDistance(reference, x.data(), y.data(), z.data(), indices.data(), indices.size(), output);
+
+    ASSERT_EQ(12, output.size());
+    ASSERT_EQ(7, output.at(0).pointIndex);
+    for (size_t i = 1; i < output.size(); ++i) {
+        ASSERT_EQ(i + 99, output.at(i).pointIndex);  // Same order as the input.
+        ASSERT_EQ((i - 1) * (i - 1), output.at(i).geometricValue);
+    }
+}
+
+}
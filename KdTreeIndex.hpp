@@ -0,0 +1,345 @@
+#ifndef GEOINDEX_KD_TREE_INDEX
+#define GEOINDEX_KD_TREE_INDEX
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+
+#include "Common.hpp"
+#include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+
+namespace geoIndex {
+
+/** The classic answer for k nearest neighbors among points that do not move: a kd-tree.
+ *
+ *  Balanced and implicit: each node splits its points in two halves at the median of the axis where its cell
+ *  (the box of the points, cut by the splits above) is the widest, down to leaves of at most bucketSize points.
+ *  All the leaves are at the same depth, so the tree is complete and needs no pointers: the children of node i
+ *  are 2i + 1 and 2i + 2, and the points of a node are the range its parent gives it (the first half for the left
+ *  child, the rest for the right one). A node is just a split value and an axis.
+ *
+ *  The points are sorted so that the points of each leaf are contiguous ("structure of arrays", as in NoIndex):
+ *  a leaf is scanned with the SIMD distance kernel.
+ *
+ *  Lookups go down the side of the split where the reference is first, and visit the other side only if the cell
+ *  beyond the split plane is closer than the distance limit (or than the k-th point found so far). The distance
+ *  to that cell is updated incrementally, one axis at a time (Arya and Mount): no bounding boxes to store.
+ *
+ *  The user must call completed() between modifications and lookups.
+ */
+template <typename POINT>
+class KdTreeIndex {
+public:
+    /** bucketSize is the most points a leaf can hold.
+     *  If you know how many points you are going to use, tell it to the constructor to reserve memory. */
+    explicit KdTreeIndex(const size_t bucketSize = 16,
+                         const size_t expectedCollectionSize = 0) :
+        bucketSize(bucketSize)
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (bucketSize == 0)
+                throw std::runtime_error("KdTreeIndex Buckets can not be empty.");
+            readyForLookups = true;  // Nothing inside, nothing to prepare.
+        #endif
+
+        coordinatesX.reserve(expectedCollectionSize);
+        coordinatesY.reserve(expectedCollectionSize);
+        coordinatesZ.reserve(expectedCollectionSize);
+        indices.reserve(expectedCollectionSize);
+    }
+
+    /** Adds a point to the index. Remember its name too. */
+    void index(const POINT& p, const typename PointTraits<POINT>::index index) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = false;
+
+            if (std::find(begin(indices), end(indices), index) != end(indices))
+                throw std::runtime_error("KdTreeIndex::index Point indexed twice");
+        #endif
+
+        coordinatesX.push_back(p.x);
+        coordinatesY.push_back(p.y);
+        coordinatesZ.push_back(p.z);
+        indices.push_back(index);
+    }
+
+    /** Builds the tree over all the points indexed so far.
+     *  It can be called again after indexing more points, but it redoes all the work.
+     *
+     *  One nth_element per node, on whole points (the three coordinates and the index together, so the partitions
+     *  move contiguous memory), then the points go back to the separate arrays in leaf order.
+     *  Each level costs a pass over the points: O(n log(n / bucketSize)). */
+    void completed() {
+        unsigned depth = 0;  // Of the leaves. 0: the root is the only leaf.
+        while ((bucketSize << depth) < indices.size())
+            ++depth;
+
+        const size_t internalNodes = (static_cast<size_t>(1) << depth) - 1;
+        splitValues.assign(internalNodes, 0);
+        splitAxes.assign(internalNodes, 0);
+
+        std::vector<PointRecord> points(indices.size());
+        for (size_t i = 0; i < points.size(); ++i)
+            points[i] = {coordinatesX[i], coordinatesY[i], coordinatesZ[i], indices[i]};
+
+        if (internalNodes > 0) {
+            const auto xRange = std::minmax_element(std::begin(coordinatesX), std::end(coordinatesX));
+            const auto yRange = std::minmax_element(std::begin(coordinatesY), std::end(coordinatesY));
+            const auto zRange = std::minmax_element(std::begin(coordinatesZ), std::end(coordinatesZ));
+            typename PointTraits<POINT>::coordinate lowest[3] = {*xRange.first, *yRange.first, *zRange.first};
+            typename PointTraits<POINT>::coordinate highest[3] = {*xRange.second, *yRange.second, *zRange.second};
+            split(0, points.data(), points.data() + points.size(), lowest, highest);
+        }
+
+        for (size_t i = 0; i < points.size(); ++i) {
+            coordinatesX[i] = points[i].coordinates[0];
+            coordinatesY[i] = points[i].coordinates[1];
+            coordinatesZ[i] = points[i].coordinates[2];
+            indices[i] = points[i].pointIndex;
+        }
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = true;
+        #endif
+    }
+
+    /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
+    *  Returns the points sorted in distance order from p (to simplify computing the k-nearest-neighbor).
+    *  The returned structure also gives the squared distance. The client can do a sqrt and use it for its computations.
+    *
+    *  Returns only points strictly within the distance.
+    */
+    void pointsWithinDistance(const POINT& p,
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+
+        output.clear();
+        if (indices.empty())
+            return;
+
+        WithinDistance visitor{distanceLimit, output};
+        typename PointTraits<POINT>::coordinate offsets[3] = {0, 0, 0};
+        visit(p, 0, 0, indices.size(), 0, offsets, visitor);
+
+        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    }
+
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements.
+     *  The limit shrinks to the k-th point found so far: the far sides of the splits are skipped more and more.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p,
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+        nearestPointsWithinSquaredDistance(p, distanceLimit, k, output);
+    }
+
+    /** Finds the k points closest to p, wherever they are: no culling distance to guess.
+     *  Returns less than k points only if the index has less than k points.
+     */
+    void nearestPoints(const POINT& p,
+                       const size_t k,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        checkReady();
+        nearestPointsWithinSquaredDistance(p, std::numeric_limits<typename PointTraits<POINT>::coordinate>::max(), k, output);
+    }
+
+private:
+    const size_t bucketSize;
+
+    /** The internal nodes, in the implicit layout: root first, children of i at 2i + 1 and 2i + 2. */
+    std::vector<typename PointTraits<POINT>::coordinate> splitValues;
+    std::vector<unsigned char> splitAxes;  ///< 0 for x, 1 for y, 2 for z.
+
+    // The points, sorted by leaf after completed().
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+    std::vector<typename PointTraits<POINT>::index> indices;
+
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        bool readyForLookups;
+    #endif
+
+    /** A whole point, to sort the points during the build. */
+    struct PointRecord {
+        typename PointTraits<POINT>::coordinate coordinates[3];
+        typename PointTraits<POINT>::index pointIndex;
+    };
+
+    /** Adds the points of a leaf within the limit to the output. */
+    struct WithinDistance {
+        const typename PointTraits<POINT>::coordinate squaredLimit;
+        std::vector<IndexAndSquaredDistance<POINT> >& output;
+
+        typename PointTraits<POINT>::coordinate limit() const {
+            return squaredLimit;
+        }
+
+        void leaf(const KdTreeIndex& tree, const POINT& p, const size_t begin, const size_t end) {
+            tree.appendLeafPoints(p, squaredLimit, begin, end, output);
+        }
+    };
+
+    /** Offers the points of a leaf to the k nearest so far. */
+    struct Nearest {
+        KNearestCandidates<POINT>& nearest;
+        std::vector<IndexAndSquaredDistance<POINT> >& leafHits;
+
+        typename PointTraits<POINT>::coordinate limit() const {
+            return nearest.squaredLimit();
+        }
+
+        void leaf(const KdTreeIndex& tree, const POINT& p, const size_t begin, const size_t end) {
+            leafHits.clear();
+            tree.appendLeafPoints(p, nearest.squaredLimit(), begin, end, leafHits);
+            for (const auto& hit : leafHits)
+                nearest.offer(hit.pointIndex, hit.geometricValue);
+        }
+    };
+
+
+    /** Splits the points of the node at the median of the axis where its cell is widest, then goes on with its
+     *  children. The cell is the box of all the points cut by the splits above: it comes down from the parent,
+     *  no need to look at the points for it. */
+    void split(const size_t node,
+               PointRecord* begin,
+               PointRecord* end,
+               typename PointTraits<POINT>::coordinate lowest[3],
+               typename PointTraits<POINT>::coordinate highest[3]) {
+        unsigned char axis = 0;
+        for (unsigned char a = 1; a < 3; ++a)
+            if (highest[a] - lowest[a] > highest[axis] - lowest[axis])
+                axis = a;
+
+        PointRecord* const middle = begin + (end - begin) / 2;
+        std::nth_element(begin, middle, end, [axis](const PointRecord& first, const PointRecord& second) {
+            return first.coordinates[axis] < second.coordinates[axis];
+        });
+        const typename PointTraits<POINT>::coordinate splitValue = middle == end ? lowest[axis] : middle->coordinates[axis];
+        splitAxes[node] = axis;
+        splitValues[node] = splitValue;
+
+        if (2 * node + 1 < splitValues.size()) {
+            const typename PointTraits<POINT>::coordinate cellHighest = highest[axis];
+            highest[axis] = splitValue;
+            split(2 * node + 1, begin, middle, lowest, highest);
+            highest[axis] = cellHighest;
+
+            const typename PointTraits<POINT>::coordinate cellLowest = lowest[axis];
+            lowest[axis] = splitValue;
+            split(2 * node + 2, middle, end, lowest, highest);
+            lowest[axis] = cellLowest;
+        }
+    }
+
+    /** Goes down the tree from the node, whose points are [begin, end).
+     *  squaredCellDistance is the squared distance of p from the cell of the node, offsets its components per axis
+     *  (0 where p is within the cell on that axis). */
+    template <typename VISITOR>
+    void visit(const POINT& p,
+               const size_t node,
+               const size_t begin,
+               const size_t end,
+               const typename PointTraits<POINT>::coordinate squaredCellDistance,
+               typename PointTraits<POINT>::coordinate offsets[3],
+               VISITOR& visitor) const {
+        if (! (squaredCellDistance < visitor.limit()))
+            return;  // The k-th nearest may have come closer since the parent checked.
+        if (node >= splitValues.size()) {
+            visitor.leaf(*this, p, begin, end);
+            return;
+        }
+
+        const unsigned char axis = splitAxes[node];
+        const typename PointTraits<POINT>::coordinate fromSplit = coordinate(p, axis) - splitValues[node];
+        const size_t middle = begin + (end - begin) / 2;
+        const bool leftFirst = fromSplit < 0;
+
+        if (leftFirst)
+            visit(p, 2 * node + 1, begin, middle, squaredCellDistance, offsets, visitor);
+        else
+            visit(p, 2 * node + 2, middle, end, squaredCellDistance, offsets, visitor);
+
+        // The other side: only the offset on the axis of the split changes.
+        const typename PointTraits<POINT>::coordinate previousOffset = offsets[axis];
+        const typename PointTraits<POINT>::coordinate farCellDistance = squaredCellDistance - previousOffset * previousOffset +
+                                                                        fromSplit * fromSplit;
+        if (! (farCellDistance < visitor.limit()))
+            return;
+
+        offsets[axis] = fromSplit;
+        if (leftFirst)
+            visit(p, 2 * node + 2, middle, end, farCellDistance, offsets, visitor);
+        else
+            visit(p, 2 * node + 1, begin, middle, farCellDistance, offsets, visitor);
+        offsets[axis] = previousOffset;
+    }
+
+    void appendLeafPoints(const POINT& p,
+                          const typename PointTraits<POINT>::coordinate squaredLimit,
+                          const size_t begin,
+                          const size_t end,
+                          std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        AppendPointsWithinSquaredDistance(p,
+                                          squaredLimit,
+                                          coordinatesX.data() + begin,
+                                          coordinatesY.data() + begin,
+                                          coordinatesZ.data() + begin,
+                                          indices.data() + begin,
+                                          end - begin,
+                                          output);
+    }
+
+    void nearestPointsWithinSquaredDistance(const POINT& p,
+                                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                                            const size_t k,
+                                            std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        KNearestCandidates<POINT> nearest(k, squaredLimit, output);
+        if (! indices.empty()) {
+            std::vector<IndexAndSquaredDistance<POINT> > leafHits;
+            Nearest visitor{nearest, leafHits};
+            typename PointTraits<POINT>::coordinate offsets[3] = {0, 0, 0};
+            visit(p, 0, 0, indices.size(), 0, offsets, visitor);
+        }
+        nearest.sort();
+    }
+
+    static typename PointTraits<POINT>::coordinate coordinate(const POINT& p, const unsigned char axis) {
+        return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+    }
+
+    void checkReady() const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (! readyForLookups)
+                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
+        #endif
+    }
+
+    typename PointTraits<POINT>::coordinate squaredDistanceLimit(const typename PointTraits<POINT>::coordinate d) const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+
+        const typename PointTraits<POINT>::coordinate distanceLimit = d * d;
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(distanceLimit);
+        #endif
+
+        return distanceLimit;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,233 @@
+#include "gtest/gtest.h"
+
+#include "KdTreeIndex.hpp"
+
+#include <vector>
+#include <limits>
+#include "Common.hpp"
+#include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+using namespace std;
+
+namespace geoIndex {
+
+static const size_t bucketSize = 2;  // Small, so that even the small tests have a few levels.
+
+TEST(KdTreeIndex, pointsWithinDistance_samePoint) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_samePoint(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_coincidentPoints) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_coincidentPoints(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_noPoints) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_noPoints(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_onlyFarPoints) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_onlyFarPoints(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_inAndOutPoints) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_inAndOutPoints(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_exactDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_exactDistance(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_outputOrder) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_outputOrder(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_squareDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_squareDistance(index);
+}
+
+TEST(KdTreeIndex, nearestPointsWithinDistance_closestK) {
+    KdTreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(KdTreeIndex, nearestPointsWithinDistance_lessThanK) {
+    KdTreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(KdTreeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(KdTreeIndex, index_duplicatedIndex) {
+    KdTreeIndex<Point> index(bucketSize);
+    index_duplicatedIndex(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_negativeDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_negativeDistance(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_zeroDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_zeroDistance(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_NanDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_NanDistance(index);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_overflowDistance) {
+    KdTreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_overflowDistance(index);
+}
+
+#endif
+
+
+/* Specific tests for this implementation. */
+
+/* Compares with a brute force search, for a few references and distances. */
+static void sameAsNoIndex(const std::vector<Point>& points, const size_t bucketSize) {
+    KdTreeIndex<Point> kdTree(bucketSize);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < points.size(); ++i) {
+        kdTree.index(points[i], i);
+        bruteForce.index(points[i], i);
+    }
+    kdTree.completed();
+    
+    const std::vector<Point> references{{0, 0, 0}, {1.5, -2.5, 10.25}, {-50, -30, 0}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (double d : {0.5, 3.0, 20.0, 1000.0}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, d, expected);
+            kdTree.pointsWithinDistance(referencePoint, d, result);
+            
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t i = 0; i < expected.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+            
+            kdTree.nearestPointsWithinDistance(referencePoint, d, 5, result);
+            ASSERT_EQ(std::min<size_t>(5, expected.size()), result.size());
+            for (size_t i = 0; i < result.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+        }
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_denseAndSparse) {
+    // A dense blob in a sparse background: the medians follow the points, not the space.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50,
+                               static_cast<double>((i * 104729) % 61) - 30,
+                               static_cast<double>((i * 31) % 23)});
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{0.001 * ((i * 7919) % 97), 0.001 * ((i * 31) % 89), 0.001 * ((i * 104729) % 83)});
+    
+    sameAsNoIndex(points, 1);
+    sameAsNoIndex(points, 4);
+    sameAsNoIndex(points, 100000);  // A single leaf.
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_flat) {
+    // All on a plane: z never splits.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 2000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50, static_cast<double>((i * 31) % 37), 3});
+    
+    sameAsNoIndex(points, 3);
+}
+
+TEST(KdTreeIndex, pointsWithinDistance_coincidentPointsBeyondTheBucket) {
+    std::vector<Point> points(100, Point{1, 2, 3});
+    points.push_back(Point{1, 2, 4});
+    
+    sameAsNoIndex(points, 4);
+}
+
+TEST(KdTreeIndex, nearestPoints_sameAsNoIndex) {
+    KdTreeIndex<Point> kdTree(8);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 2000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23) + 0.5 * (i % 3)};
+        kdTree.index(p, i);
+        bruteForce.index(p, i);
+    }
+    kdTree.completed();
+    
+    const std::vector<Point> references{{1.5, -2.5, 10.25}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (size_t k : {1, 7, 100}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, 100000, expected);
+            kdTree.nearestPoints(referencePoint, k, result);
+            
+            ASSERT_EQ(k, result.size());
+            for (size_t i = 0; i < k; ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+        }
+}
+
+TEST(KdTreeIndex, nearestPoints_lessThanK) {
+    KdTreeIndex<Point> kdTree;
+    kdTree.index(Point{0, 0, 0}, 1);
+    kdTree.index(Point{30, -20, 10}, 2);
+    kdTree.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    kdTree.nearestPoints(Point{5, 5, 5}, 10, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
+TEST(KdTreeIndex, completedTwice) {
+    KdTreeIndex<Point> index(1);
+    index.index(Point{0, 0, 0}, 1);
+    index.completed();
+    index.index(Point{0.5, 0, 0}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(2, result.size());
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(KdTreeIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+    const Point anyPoint{1, 55, 2};
+  
+    KdTreeIndex<Point> index;
+    index.index(anyPoint, 1);
+    // No call to completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    ASSERT_ANY_THROW(index.pointsWithinDistance(anyPoint, 0.01, result));
+}
+
+TEST(KdTreeIndex, emptyBuckets) {
+    ASSERT_ANY_THROW(KdTreeIndex<Point> index(0));
+}
+#endif
+
+}
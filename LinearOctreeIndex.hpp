@@ -0,0 +1,300 @@
+#ifndef GEOINDEX_LINEAR_OCTREE_INDEX
+#define GEOINDEX_LINEAR_OCTREE_INDEX
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "Common.hpp"
+#include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+#include "MortonCode.hpp"
+#include "RadixSort.hpp"
+#include "SpaceFillingCurve.hpp"
+
+namespace geoIndex {
+
+/** An octree without nodes: the points sorted along the Z-order curve.
+ *
+ *  The bounding box of the points is cut in 2^21 cells per axis, and each point gets the Morton code of its cell
+ *  (63 bits, see MortonCode). Sorted by code, the points of every octree node, at every depth, are a contiguous
+ *  range: the whole index is a few sorted arrays (codes, coordinates, indices), no pointers, easy to save and load,
+ *  and points close in space are mostly close in memory.
+ *
+ *  A lookup takes the cells of the box around the reference: the codes between the corners of the box, minus the
+ *  stretches where the curve goes out of the box and back in. Those are skipped with LITMAX and BIGMIN (Tropf and
+ *  Herzog): a binary search in the range, and where the middle point is out of the box, the two sides go on with
+ *  the last code of the box before it and the first after it. Small ranges are scanned with the SIMD distance kernel
+ *  (the points out of the box are farther than the distance anyway).
+ *
+ *  A table on the first levels of the octree gives where each of their nodes starts: the binary searches start
+ *  from there, in a few cache lines.
+ *
+ *  The user must call completed() between modifications and lookups.
+ */
+template <typename POINT>
+class LinearOctreeIndex {
+public:
+    /** If you know how many points you are going to use, tell it to the constructor to reserve memory. */
+    explicit LinearOctreeIndex(const size_t expectedCollectionSize = 0) :
+        tableShift(3 * mortonBitsPerAxis),
+        table(2, 0)
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = true;  // Nothing inside, nothing to prepare.
+        #endif
+
+        coordinatesX.reserve(expectedCollectionSize);
+        coordinatesY.reserve(expectedCollectionSize);
+        coordinatesZ.reserve(expectedCollectionSize);
+        indices.reserve(expectedCollectionSize);
+    }
+
+    /** Adds a point to the index. Remember its name too. */
+    void index(const POINT& p, const typename PointTraits<POINT>::index index) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = false;
+
+            if (std::find(begin(indices), end(indices), index) != end(indices))
+                throw std::runtime_error("LinearOctreeIndex::index Point indexed twice");
+        #endif
+
+        coordinatesX.push_back(p.x);
+        coordinatesY.push_back(p.y);
+        coordinatesZ.push_back(p.z);
+        indices.push_back(index);
+    }
+
+    /** Sorts the points by Morton code (radix sort) and fills the table.
+     *  It can be called again after indexing more points, but it redoes all the work. */
+    void completed() {
+        const size_t count = indices.size();
+        codes.resize(count);
+        if (count > 0) {
+            grid.fit(count, [this](const size_t i, const unsigned axis) {
+                return axis == 0 ? coordinatesX[i] : (axis == 1 ? coordinatesY[i] : coordinatesZ[i]);
+            });
+            for (size_t i = 0; i < count; ++i)
+                codes[i] = MortonCode(grid.cell(0, coordinatesX[i]), grid.cell(1, coordinatesY[i]), grid.cell(2, coordinatesZ[i]));
+
+            std::vector<size_t> positions(count);
+            for (size_t i = 0; i < count; ++i)
+                positions[i] = i;
+            RadixSortByKey(codes, positions, 3 * mortonBitsPerAxis);
+
+            gather(coordinatesX, positions);
+            gather(coordinatesY, positions);
+            gather(coordinatesZ, positions);
+            gather(indices, positions);
+        }
+        fillTable();
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = true;
+        #endif
+    }
+
+    /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
+    *  Returns the points sorted in distance order from p (to simplify computing the k-nearest-neighbor).
+    *  The returned structure also gives the squared distance. The client can do a sqrt and use it for its computations.
+    *
+    *  Returns only points strictly within the distance.
+    */
+    void pointsWithinDistance(const POINT& p,
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+
+        output.clear();
+        visitRangesInBox(p, d, [&](const size_t begin, const size_t end) {
+            appendPointsWithin(p, distanceLimit, begin, end, output);
+        });
+
+        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    }
+
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements, without sorting all the points in the box.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p,
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+
+        KNearestCandidates<POINT> nearest(k, distanceLimit, output);
+        std::vector<IndexAndSquaredDistance<POINT> > rangeHits;
+        visitRangesInBox(p, d, [&](const size_t begin, const size_t end) {
+            rangeHits.clear();
+            appendPointsWithin(p, nearest.squaredLimit(), begin, end, rangeHits);
+            for (const auto& hit : rangeHits)
+                nearest.offer(hit.pointIndex, hit.geometricValue);
+        });
+        nearest.sort();
+    }
+
+private:
+    /** Ranges up to this many points are scanned, not split. */
+    static const size_t linearScanSize = 32;
+    /** The table covers at most this many levels of the octree (8^7 nodes, 16 MB with 64 bit positions). */
+    static const unsigned maximumTableLevels = 7;
+
+    // The points, sorted by Morton code after completed().
+    std::vector<uint64_t> codes;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+    std::vector<typename PointTraits<POINT>::index> indices;
+
+    /** The grid of the codes, over the bounding box of the points. */
+    CurveGrid<typename PointTraits<POINT>::coordinate> grid;
+
+    /** The octree nodes of the table are the codes shifted right by this. */
+    unsigned tableShift;
+    /** Where the points of each node of the table start, and the end of the points at the end. */
+    std::vector<size_t> table;
+
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        bool readyForLookups;
+    #endif
+
+
+    template <typename VALUE>
+    static void gather(std::vector<VALUE>& values, const std::vector<size_t>& positions) {
+        std::vector<VALUE> sorted(values.size());
+        for (size_t i = 0; i < positions.size(); ++i)
+            sorted[i] = values[positions[i]];
+        values.swap(sorted);
+    }
+
+    /** As many levels as fit the number of points (about one node per point at most). */
+    void fillTable() {
+        unsigned levels = 0;
+        while (levels < maximumTableLevels && (static_cast<size_t>(8) << (3 * levels)) <= codes.size())
+            ++levels;
+        tableShift = 3 * (mortonBitsPerAxis - levels);
+
+        const size_t nodes = static_cast<size_t>(1) << (3 * levels);
+        table.assign(nodes + 1, codes.size());
+        size_t position = 0;
+        for (size_t node = 0; node < nodes; ++node) {
+            while (position < codes.size() && (codes[position] >> tableShift) < node)
+                ++position;
+            table[node] = position;
+        }
+    }
+
+    /** The first position in [begin, end) with a code not below the given one. */
+    size_t firstNotBelow(const uint64_t code, const size_t begin, const size_t end) const {
+        const size_t node = code >> tableShift;
+        const size_t from = std::min(std::max(begin, table[node]), end);
+        const size_t to = std::max(std::min(end, table[node + 1]), from);
+        return std::lower_bound(codes.begin() + from, codes.begin() + to, code) - codes.begin();
+    }
+
+    /** The first position in [begin, end) with a code above the given one. */
+    size_t firstAbove(const uint64_t code, const size_t begin, const size_t end) const {
+        const size_t node = code >> tableShift;
+        const size_t from = std::min(std::max(begin, table[node]), end);
+        const size_t to = std::max(std::min(end, table[node + 1]), from);
+        return std::upper_bound(codes.begin() + from, codes.begin() + to, code) - codes.begin();
+    }
+
+    /** Calls visitor(begin, end) on ranges of positions that together hold all the points in the cells of the box
+     *  of side 2d around p (and some others, close to it). */
+    template <typename VISITOR>
+    void visitRangesInBox(const POINT& p, const typename PointTraits<POINT>::coordinate d, VISITOR visitor) const {
+        if (codes.empty())
+            return;
+        const typename PointTraits<POINT>::coordinate center[3] = {p.x, p.y, p.z};
+        uint32_t lowCell[3];
+        uint32_t highCell[3];
+        for (unsigned axis = 0; axis < 3; ++axis) {
+            if (center[axis] + d < grid.lowest(axis) || center[axis] - d > grid.highest(axis))
+                return;  // Nothing on this side of the box.
+            lowCell[axis] = grid.cell(axis, center[axis] - d);
+            highCell[axis] = grid.cell(axis, center[axis] + d);
+        }
+        const uint64_t low = MortonCode(lowCell[0], lowCell[1], lowCell[2]);
+        const uint64_t high = MortonCode(highCell[0], highCell[1], highCell[2]);
+        visitRange(0, codes.size(), low, high, low, high, visitor);
+    }
+
+    /** The points of the box in [begin, end) with a code between rangeLow and rangeHigh. */
+    template <typename VISITOR>
+    void visitRange(size_t begin,
+                    size_t end,
+                    const uint64_t rangeLow,
+                    const uint64_t rangeHigh,
+                    const uint64_t boxLow,
+                    const uint64_t boxHigh,
+                    VISITOR& visitor) const {
+        begin = firstNotBelow(rangeLow, begin, end);
+        end = firstAbove(rangeHigh, begin, end);
+        if (begin >= end)
+            return;
+        if (end - begin <= linearScanSize) {
+            visitor(begin, end);
+            return;
+        }
+
+        const size_t middle = begin + (end - begin) / 2;
+        const uint64_t middleCode = codes[middle];
+        if (InMortonBox(middleCode, boxLow, boxHigh)) {
+            visitRange(begin, middle, rangeLow, middleCode, boxLow, boxHigh, visitor);
+            visitRange(middle, end, middleCode, rangeHigh, boxLow, boxHigh, visitor);
+            return;
+        }
+
+        // No code of the box between these two.
+        uint64_t litMax;
+        uint64_t bigMin;
+        LitMaxBigMin(middleCode, boxLow, boxHigh, litMax, bigMin);
+        visitRange(begin, middle, rangeLow, litMax, boxLow, boxHigh, visitor);
+        visitRange(middle + 1, end, bigMin, rangeHigh, boxLow, boxHigh, visitor);
+    }
+
+    void appendPointsWithin(const POINT& p,
+                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                            const size_t begin,
+                            const size_t end,
+                            std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        AppendPointsWithinSquaredDistance(p,
+                                          squaredLimit,
+                                          coordinatesX.data() + begin,
+                                          coordinatesY.data() + begin,
+                                          coordinatesZ.data() + begin,
+                                          indices.data() + begin,
+                                          end - begin,
+                                          output);
+    }
+
+    void checkReady() const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (! readyForLookups)
+                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
+        #endif
+    }
+
+    typename PointTraits<POINT>::coordinate squaredDistanceLimit(const typename PointTraits<POINT>::coordinate d) const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+
+        const typename PointTraits<POINT>::coordinate distanceLimit = d * d;
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(distanceLimit);
+        #endif
+
+        return distanceLimit;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+#include "gtest/gtest.h"
+
+#include "LinearOctreeIndex.hpp"
+
+#include <vector>
+#include <limits>
+#include "Common.hpp"
+#include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+using namespace std;
+
+namespace geoIndex {
+
+TEST(LinearOctreeIndex, pointsWithinDistance_samePoint) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_samePoint(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_coincidentPoints) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_coincidentPoints(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_noPoints) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_noPoints(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_onlyFarPoints) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_onlyFarPoints(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_inAndOutPoints) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_inAndOutPoints(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_exactDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_exactDistance(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_outputOrder) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_outputOrder(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_squareDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_squareDistance(index);
+}
+
+TEST(LinearOctreeIndex, nearestPointsWithinDistance_closestK) {
+    LinearOctreeIndex<Point> index;
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(LinearOctreeIndex, nearestPointsWithinDistance_lessThanK) {
+    LinearOctreeIndex<Point> index;
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(LinearOctreeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    LinearOctreeIndex<Point> index;
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(LinearOctreeIndex, index_duplicatedIndex) {
+    LinearOctreeIndex<Point> index;
+    index_duplicatedIndex(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_negativeDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_negativeDistance(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_zeroDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_zeroDistance(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_NanDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_NanDistance(index);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_overflowDistance) {
+    LinearOctreeIndex<Point> index;
+    pointsWithinDistance_overflowDistance(index);
+}
+
+#endif
+
+
+/* Specific tests for this implementation. */
+
+/* Compares with a brute force search, for a few references and distances. */
+static void sameAsNoIndex(const std::vector<Point>& points) {
+    LinearOctreeIndex<Point> linearOctree;
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < points.size(); ++i) {
+        linearOctree.index(points[i], i);
+        bruteForce.index(points[i], i);
+    }
+    linearOctree.completed();
+    
+    const std::vector<Point> references{{0, 0, 0}, {1.5, -2.5, 10.25}, {-50, -30, 0}, {500, 10, 10}, {0.05, 0.04, 0.03}};
+    for (const Point& referencePoint : references)
+        for (double d : {0.01, 0.5, 3.0, 20.0, 1000.0}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, d, expected);
+            linearOctree.pointsWithinDistance(referencePoint, d, result);
+            
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t i = 0; i < expected.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+            
+            linearOctree.nearestPointsWithinDistance(referencePoint, d, 5, result);
+            ASSERT_EQ(std::min<size_t>(5, expected.size()), result.size());
+            for (size_t i = 0; i < result.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+        }
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_denseAndSparse) {
+    // A dense blob in a sparse background: many codes between the corners of a box are out of it.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50,
+                               static_cast<double>((i * 104729) % 61) - 30,
+                               static_cast<double>((i * 31) % 23)});
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{0.001 * ((i * 7919) % 97), 0.001 * ((i * 31) % 89), 0.001 * ((i * 104729) % 83)});
+    
+    sameAsNoIndex(points);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_flat) {
+    // All on a plane: a single cell on z.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 2000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50, static_cast<double>((i * 31) % 37), 3});
+    
+    sameAsNoIndex(points);
+}
+
+TEST(LinearOctreeIndex, pointsWithinDistance_coincidentPointsInOneCell) {
+    // All the points in the same cell: more than a scan, with the same code.
+    std::vector<Point> points(100, Point{1, 2, 3});
+    points.push_back(Point{1, 2, 4});
+    
+    sameAsNoIndex(points);
+}
+
+TEST(LinearOctreeIndex, completedTwice) {
+    LinearOctreeIndex<Point> index;
+    index.index(Point{0, 0, 0}, 1);
+    index.completed();
+    index.index(Point{0.5, 0, 0}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(2, result.size());
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(LinearOctreeIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+    const Point anyPoint{1, 55, 2};
+  
+    LinearOctreeIndex<Point> index;
+    index.index(anyPoint, 1);
+    // No call to completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    ASSERT_ANY_THROW(index.pointsWithinDistance(anyPoint, 0.01, result));
+}
+#endif
+
+}
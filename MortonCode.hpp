@@ -0,0 +1,88 @@
+#ifndef GEOINDEX_MORTON_CODE
+#define GEOINDEX_MORTON_CODE
+
+#include <cstdint>
+
+namespace geoIndex {
+
+    /** Bits per axis in a Morton code: 3 * 21 = 63 bits fit a uint64_t. */
+    static const unsigned mortonBitsPerAxis = 21;
+    static const uint32_t mortonMaximumCell = (static_cast<uint32_t>(1) << mortonBitsPerAxis) - 1;
+
+    /** The bits of the code that belong to x (the highest of each group of 3), y and z. */
+    static const uint64_t mortonAxisMasks[3] = {0x4924924924924924ull, 0x2492492492492492ull, 0x1249249249249249ull};
+
+    /** The lowest 21 bits of the value, two zeros between each bit and the next. */
+    inline uint64_t SpreadBits(const uint32_t value) {
+        uint64_t bits = value & mortonMaximumCell;
+        bits = (bits | (bits << 32)) & 0x1f00000000ffffull;
+        bits = (bits | (bits << 16)) & 0x1f0000ff0000ffull;
+        bits = (bits | (bits << 8)) & 0x100f00f00f00f00full;
+        bits = (bits | (bits << 4)) & 0x10c30c30c30c30c3ull;
+        bits = (bits | (bits << 2)) & 0x1249249249249249ull;
+        return bits;
+    }
+
+    /** Z-order (Morton) code of a cell: the bits of the three cell coordinates (at most 21 bits each) interleaved,
+     *  x highest. Sorting cells by code puts cells close in space (mostly) close in the order: all the cells of an
+     *  octree node come one after the other. */
+    inline uint64_t MortonCode(const uint32_t x, const uint32_t y, const uint32_t z) {
+        return (SpreadBits(x) << 2) | (SpreadBits(y) << 1) | SpreadBits(z);
+    }
+
+    /** Whether the cell of the code is in the box of cells that goes from the cell of low to the cell of high
+     *  (included). Axis by axis: the bits of one axis compare like its cell coordinate. */
+    inline bool InMortonBox(const uint64_t code, const uint64_t low, const uint64_t high) {
+        for (unsigned axis = 0; axis < 3; ++axis) {
+            const uint64_t mask = mortonAxisMasks[axis];
+            if ((code & mask) < (low & mask) || (code & mask) > (high & mask))
+                return false;
+        }
+        return true;
+    }
+
+    /** For a code between low and high but outside their box (see InMortonBox), the highest code in the box
+     *  before it (LITMAX) and the lowest code in the box after it (BIGMIN): the curve leaves the box in between.
+     *  Tropf and Herzog, "Multidimensional range search in dynamically balanced trees", 1981.
+     *
+     *  Goes down the bits from the highest, like a binary search in the octree: wherever low and high differ, the
+     *  box is split in two halves at that bit, and the search goes on in the half with the code (moving the other
+     *  end of the box to the split), until the code is out of both ends. */
+    inline void LitMaxBigMin(const uint64_t code, uint64_t low, uint64_t high, uint64_t& litMax, uint64_t& bigMin) {
+        litMax = low;
+        bigMin = high;
+        for (int bit = 3 * mortonBitsPerAxis - 1; bit >= 0; --bit) {
+            const uint64_t bitMask = static_cast<uint64_t>(1) << bit;
+            // The bits of the same axis, below this one.
+            const uint64_t lowerBitsOfAxis = mortonAxisMasks[(3 * mortonBitsPerAxis - 1 - bit) % 3] & (bitMask - 1);
+            // Lowest code of the upper half, highest of the lower half.
+            const uint64_t upperHalfLow = (low | bitMask) & ~lowerBitsOfAxis;
+            const uint64_t lowerHalfHigh = (high & ~bitMask) | lowerBitsOfAxis;
+
+            const bool codeBit = (code & bitMask) != 0;
+            const bool lowBit = (low & bitMask) != 0;
+            const bool highBit = (high & bitMask) != 0;
+            if (lowBit == highBit) {
+                if (codeBit == lowBit)
+                    continue;
+                if (codeBit) {  // Above the whole box.
+                    litMax = high;
+                    return;
+                }
+                bigMin = low;  // Below the whole box.
+                return;
+            }
+            // Only low = 0, high = 1 is left: the box has both halves.
+            if (codeBit) {
+                litMax = lowerHalfHigh;
+                low = upperHalfLow;
+            } else {
+                bigMin = upperHalfLow;
+                high = lowerHalfHigh;
+            }
+        }
+    }
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "gtest/gtest.h"
+
+#include "MortonCode.hpp"
+
+#include <vector>
+#include <cstdint>
+
+namespace geoIndex {
+
+TEST(MortonCode, interleavesTheBits) {
+    ASSERT_EQ(0, MortonCode(0, 0, 0));
+    ASSERT_EQ(4, MortonCode(1, 0, 0));
+    ASSERT_EQ(2, MortonCode(0, 1, 0));
+    ASSERT_EQ(1, MortonCode(0, 0, 1));
+    ASSERT_EQ(7 << 3, MortonCode(2, 2, 2));
+    ASSERT_EQ((static_cast<uint64_t>(1) << 63) - 1, MortonCode(mortonMaximumCell, mortonMaximumCell, mortonMaximumCell));
+    ASSERT_EQ(mortonAxisMasks[0], MortonCode(mortonMaximumCell, 0, 0));
+    ASSERT_EQ(mortonAxisMasks[1], MortonCode(0, mortonMaximumCell, 0));
+    ASSERT_EQ(mortonAxisMasks[2], MortonCode(0, 0, mortonMaximumCell));
+}
+
+TEST(MortonCode, inBoxSameAsCells) {
+    const uint64_t low = MortonCode(1, 2, 0);
+    const uint64_t high = MortonCode(5, 3, 6);
+    for (uint32_t x = 0; x < 8; ++x)
+        for (uint32_t y = 0; y < 8; ++y)
+            for (uint32_t z = 0; z < 8; ++z) {
+                const bool inside = 1 <= x && x <= 5 && 2 <= y && y <= 3 && z <= 6;
+                ASSERT_EQ(inside, InMortonBox(MortonCode(x, y, z), low, high));
+            }
+}
+
+TEST(MortonCode, litMaxBigMinSameAsScan) {
+    // Every box of an 8 x 8 x 8 grid with a corner on a few given cells, every code outside it between its ends.
+    const std::vector<uint32_t> lows{0, 1, 3};
+    const std::vector<uint32_t> highs{3, 4, 6, 7};
+    for (uint32_t lowX : lows) for (uint32_t lowY : lows) for (uint32_t lowZ : lows)
+    for (uint32_t highX : highs) for (uint32_t highY : highs) for (uint32_t highZ : highs) {
+        if (highX < lowX || highY < lowY || highZ < lowZ)
+            continue;
+        const uint64_t low = MortonCode(lowX, lowY, lowZ);
+        const uint64_t high = MortonCode(highX, highY, highZ);
+
+        uint64_t lastInBox = low;
+        for (uint64_t code = low + 1; code < high; ++code) {
+            if (InMortonBox(code, low, high)) {
+                lastInBox = code;
+                continue;
+            }
+            uint64_t nextInBox = code + 1;
+            while (! InMortonBox(nextInBox, low, high))
+                ++nextInBox;
+
+            uint64_t litMax;
+            uint64_t bigMin;
+            LitMaxBigMin(code, low, high, litMax, bigMin);
+            ASSERT_EQ(lastInBox, litMax);
+            ASSERT_EQ(nextInBox, bigMin);
+        }
+    }
+}
+
+}
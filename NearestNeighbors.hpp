@@ -32,6 +32,36 @@ void BuildIndex(
     resultingIndex.completed();
 }
 
+/** The k nearest points within distance d, from the index's own nearestPointsWithinDistance when it has one
+ *  (chosen by the int argument: this overload is the better match, if it compiles). */
+template <typename POINT, typename GEOMETRY_INDEX>
+auto NearestPointsWithinDistance(
+    const GEOMETRY_INDEX& geometryIndex,
+    const POINT& referencePoint,
+    const typename PointTraits<POINT>::coordinate d,
+    const size_t k,
+    typename std::vector<IndexAndSquaredDistance<POINT> >& output,
+    int
+    ) -> decltype(geometryIndex.nearestPointsWithinDistance(referencePoint, d, k, output), void()) {
+    geometryIndex.nearestPointsWithinDistance(referencePoint, d, k, output);
+}
+
+/** Same as above, for the indexes that only have pointsWithinDistance (e. g. user indexes written for older
+ *  versions): all the points within the distance, sorted by the index, cut after the first k. */
+template <typename POINT, typename GEOMETRY_INDEX>
+void NearestPointsWithinDistance(
+    const GEOMETRY_INDEX& geometryIndex,
+    const POINT& referencePoint,
+    const typename PointTraits<POINT>::coordinate d,
+    const size_t k,
+    typename std::vector<IndexAndSquaredDistance<POINT> >& output,
+    long
+    ) {
+    geometryIndex.pointsWithinDistance(referencePoint, d, output);
+    if (output.size() > k)
+        output.erase(output.begin() + k, output.end());
+}
+
 /** "Top level" algorithm of the library that solves the k-nearest-neighbor problem. 
  *   It takes the collection of points and the "speed-up-lookups" index that must have been previously built.
  *   Any point outside the culling distance won't be considered as a close neighbor, for speed.
@@ -42,6 +72,9 @@ void BuildIndex(
  *   May return less than K if not enough points are within the culling distance from the reference.
  *   It is up to the user to remedy (e. g. to try a bigger distance).
  * 
+ *   The indexes only keep the best k points while they search, they never sort all the points within the culling distance.
+ *   An index with only pointsWithinDistance works too: it sorts all of them, then the first k are kept.
+ * 
  *   Notice that it also returns the (squared) distance from the points. I assume the user wants to do math with it
  *   (...because the only existing user told me so).
  */
@@ -62,12 +95,27 @@ void KNearestNeighbor(
             throw std::runtime_error("KNearestNeighbor Non-positive culling distance.");
     #endif
     
-    output.clear();
-    output.reserve(k); // We want k points, we find at least this many.
-    geometryIndex.pointsWithinDistance(referencePoint, cullingDistance, output);
+    NearestPointsWithinDistance(geometryIndex, referencePoint, cullingDistance, k, output, 0);
+}
 
-    if (output.size() > k)
-        output.resize(k);
+/** Same as above, but without culling distance: always returns K points (or all of them, if the index has less than K).
+ *  Only for the indexes that can search without a distance limit (e. g. CubeIndex). 
+ *  No need to guess a distance and retry with a bigger one when not enough points are found.
+ */
+template <typename POINT, typename GEOMETRY_INDEX>
+void KNearestNeighbor(
+    const GEOMETRY_INDEX& geometryIndex,
+    const POINT& referencePoint,
+    const size_t k,
+    typename std::vector<IndexAndSquaredDistance<POINT> >& output
+    ) {
+    
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        if (k == 0)
+            throw std::runtime_error("KNearestNeighbor K can't be 0");
+    #endif
+    
+    geometryIndex.nearestPoints(referencePoint, k, output);
 }
 
 
@@ -150,6 +150,32 @@ TEST(KNearestNeighbor, GenericCase) {
     ASSERT_INDEX_PRESENT(result, 1);
 }
 
+TEST(KNearestNeighbor, noCullingDistance) {
+    std::vector<Point> points;
+    const Point referencePoint{0, 0, 0};
+    points.push_back(Point{700, 1, 2});
+    points.push_back(Point{11, 1, 2});
+    points.push_back(Point{-7, 1, 2});
+    points.push_back(Point{7, 2, -225});
+    
+    CubeIndex<Point> geometryIndex(1);  // Tiny cubes: the points are many cubes away.
+    BuildIndex(points, geometryIndex);
+    
+    const size_t k = 3;
+    std::vector<IndexAndSquaredDistance<Point> > result;
+    
+    KNearestNeighbor(
+        geometryIndex,
+        referencePoint,
+        k,
+        result);
+    
+    ASSERT_EQ(3, result.size());
+    ASSERT_EQ(2, result.at(0).pointIndex);
+    ASSERT_EQ(1, result.at(1).pointIndex);
+    ASSERT_EQ(3, result.at(2).pointIndex);
+}
+
 #ifdef GEO_INDEX_SAFETY_CHECKS
 
 TEST(KNearestNeighbor, zeroDistance) {
@@ -195,6 +221,45 @@ TEST(KNearestNeighbor, zeroK) {
 }
 
 #endif
+/** A user index from before nearestPointsWithinDistance: only pointsWithinDistance. */
+class OnlyPointsWithinDistance {
+public:
+    void index(const Point& p, const PointIndex i) {
+        bruteForce.index(p, i);
+    }
+    
+    void completed() {
+        bruteForce.completed();
+    }
+    
+    void pointsWithinDistance(const Point& p,
+                              const PointTraits<Point>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<Point> >& output) const {
+        bruteForce.pointsWithinDistance(p, d, output);
+    }
+    
+private:
+    NoIndex<Point> bruteForce;
+};
+
+TEST(KNearestNeighbor, indexWithOnlyPointsWithinDistance) {
+    std::vector<Point> points;
+    for (int i = 0; i < 10; ++i)
+        points.push_back(Point{static_cast<double>(10 - i), 0, 0});
+    OnlyPointsWithinDistance geometryIndex;
+    BuildIndex(points, geometryIndex);
+    
+    std::vector<IndexAndSquaredDistance<Point> > result;
+    KNearestNeighbor(geometryIndex, 5.5, Point{0, 0, 0}, 3, result);
+    ASSERT_EQ(3, result.size());
+    ASSERT_EQ(9, result[0].pointIndex);
+    ASSERT_EQ(8, result[1].pointIndex);
+    ASSERT_EQ(7, result[2].pointIndex);
+    
+    KNearestNeighbor(geometryIndex, 2.5, Point{0, 0, 0}, 3, result);
+    ASSERT_EQ(2, result.size());
+}
+
 /** This class makes little sense. It is just to show how to use custom classes. */
 class PointAndClick {
 public:
@@ -6,6 +6,8 @@
 
 #include "BasicGeometry.hpp"
 #include "Common.hpp"
+#include "DistanceKernels.hpp"
+#include "WorkerPool.hpp"
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
   #include <stdexcept>
@@ -19,6 +21,9 @@ namespace geoIndex {
  *
  *  It offers no "smart" optimization to find the close points.
  *  On the plus side, it can be modified after calling "completed" and still work.
+ *
+ *  The coordinates are kept in separate x, y, z arrays, so that the brute force loop can use
+ *  SIMD instructions (see DistanceKernels.hpp).
  */
 
 template <typename POINT>
@@ -28,7 +33,10 @@ public:
   /** If you know how many points you are going to use, tell it to this constructor to 
    *  reserve memory. */
   NoIndex(const size_t expectedCollectionSize = 0) {
-    points.reserve(expectedCollectionSize);
+    coordinatesX.reserve(expectedCollectionSize);
+    coordinatesY.reserve(expectedCollectionSize);
+    coordinatesZ.reserve(expectedCollectionSize);
+    indices.reserve(expectedCollectionSize);
   }
   
   /** Adds a point to the index. Remember its name too. */
@@ -38,7 +46,9 @@ public:
       throw std::runtime_error("NoIndex::index Point indexed twice");
 #endif
     
-    points.push_back(p);
+    coordinatesX.push_back(p.x);
+    coordinatesY.push_back(p.y);
+    coordinatesZ.push_back(p.z);
     indices.push_back(index);
   }
   
@@ -62,6 +72,127 @@ public:
     void pointsWithinDistance(const POINT& p, 
                               const typename PointTraits<POINT>::coordinate d,
                               std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+    const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        
+    output.clear();
+    AppendPointsWithinSquaredDistance(p,
+                                      distanceLimit,
+                                      coordinatesX.data(),
+                                      coordinatesY.data(),
+                                      coordinatesZ.data(),
+                                      indices.data(),
+                                      indices.size(),
+                                      output);
+    
+    std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+  }
+  
+  
+  /** Same as above, but the points are split in chunks that are scanned in parallel by the workers.
+   *  Each worker sorts its own hits, then the sorted chunks are merged (in parallel too) into the output.
+   * 
+   *  Worth it only for big collections: small ones are scanned in fewer chunks (maybe just one),
+   *  since waking up the threads costs more than the scan. */
+    void pointsWithinDistance(const POINT& p, 
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output,
+                              WorkerPool& workers) const {
+    const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+    
+    const size_t pointCount = indices.size();
+    const size_t maxChunks = (pointCount + minimumChunkSize - 1) / minimumChunkSize;
+    const size_t chunks = std::max<size_t>(1, std::min(workers.size(), maxChunks));
+    const size_t chunkSize = (pointCount + chunks - 1) / chunks;
+    
+    std::vector<std::vector<IndexAndSquaredDistance<POINT> > > hitsPerChunk(chunks);
+    workers.run(chunks, [&](const size_t chunk) {
+        const size_t begin = std::min(chunk * chunkSize, pointCount);
+        const size_t end = std::min(begin + chunkSize, pointCount);
+        std::vector<IndexAndSquaredDistance<POINT> >& hits = hitsPerChunk[chunk];
+        
+        AppendPointsWithinSquaredDistance(p,
+                                          distanceLimit,
+                                          coordinatesX.data() + begin,
+                                          coordinatesY.data() + begin,
+                                          coordinatesZ.data() + begin,
+                                          indices.data() + begin,
+                                          end - begin,
+                                          hits);
+        std::sort(std::begin(hits), std::end(hits), SortByGeometry<POINT>);
+    });
+    
+    // Concatenate the chunks, remembering where each one starts.
+    std::vector<size_t> chunkStart(chunks + 1, 0);
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+        chunkStart[chunk + 1] = chunkStart[chunk] + hitsPerChunk[chunk].size();
+    
+    output.clear();
+    output.reserve(chunkStart[chunks]);
+    for (const auto& hits : hitsPerChunk)
+        output.insert(std::end(output), std::begin(hits), std::end(hits));
+    
+    // Merge neighbor chunks two by two, doubling the width of the sorted runs at each round.
+    for (size_t width = 1; width < chunks; width *= 2) {
+        const size_t merges = (chunks + 2 * width - 1) / (2 * width);
+        workers.run(merges, [&](const size_t merge) {
+            const size_t first = merge * 2 * width;
+            const size_t middle = std::min(first + width, chunks);
+            const size_t last = std::min(first + 2 * width, chunks);
+            std::inplace_merge(std::begin(output) + chunkStart[first],
+                               std::begin(output) + chunkStart[middle],
+                               std::begin(output) + chunkStart[last],
+                               SortByGeometry<POINT>);
+        });
+    }
+  }
+                    
+  /** Finds the k points closest to p, but only among those within distance d from p.
+   *  Same output as pointsWithinDistance cut after the first k elements, but it never holds more than k points:
+   *  the points are scanned in blocks, and each block is compared with the distance of the k-th point found so far.
+   * 
+   *  May return less than k points, if there are not enough within d. */
+    void nearestPointsWithinDistance(const POINT& p, 
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+    KNearestCandidates<POINT> nearest(k, squaredDistanceLimit(d), output);
+    
+    std::vector<IndexAndSquaredDistance<POINT> > blockHits;
+    for (size_t begin = 0; begin < indices.size(); begin += blockSize) {
+        const size_t count = std::min(blockSize, indices.size() - begin);
+        
+        blockHits.clear();
+        AppendPointsWithinSquaredDistance(p,
+                                          nearest.squaredLimit(),
+                                          coordinatesX.data() + begin,
+                                          coordinatesY.data() + begin,
+                                          coordinatesZ.data() + begin,
+                                          indices.data() + begin,
+                                          count,
+                                          blockHits);
+        
+        for (const auto& hit : blockHits)
+            nearest.offer(hit.pointIndex, hit.geometricValue);
+    }
+    
+    nearest.sort();
+  }
+                    
+private:
+  // Internal data: parallel arrays, one per coordinate ("structure of arrays").
+  std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+  std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+  std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+  std::vector<typename PointTraits<POINT>::index> indices;
+  
+  /** Below this many points per chunk, the parallel scan does not split the work further. */
+  static const size_t minimumChunkSize = 16384;
+  
+  /** The k-nearest search tightens its limit after this many points. */
+  static const size_t blockSize = 1024;
+  
+  
+  typename PointTraits<POINT>::coordinate squaredDistanceLimit(const typename PointTraits<POINT>::coordinate d) const {
     #ifdef GEO_INDEX_SAFETY_CHECKS
         CheckMeaningfulDistance(d);
     #endif
@@ -72,24 +203,17 @@ public:
     #ifdef GEO_INDEX_SAFETY_CHECKS
         CheckOverflow(distanceLimit);
     #endif
-        
-    output.clear();
-    size_t i = 0;
-    for (i = 0; i < points.size(); ++i) {
-        const auto squaredDistance = SquaredDistance(p, points[i]);
-        if (squaredDistance < distanceLimit)
-            output.push_back({indices[i], squaredDistance});
-    }
     
-    std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    return distanceLimit;
   }
-                    
-private:
-  // Internal data: parallel arrays.
-  std::vector<POINT> points;
-  std::vector<typename PointTraits<POINT>::index> indices;
 };
 
+template <typename POINT>
+const size_t NoIndex<POINT>::minimumChunkSize;
+
+template <typename POINT>
+const size_t NoIndex<POINT>::blockSize;
+
 }
 
 
@@ -3,6 +3,7 @@
 #include "NoIndex.hpp"
 
 #include "Common.hpp"
+#include "WorkerPool.hpp"
 #include "TestsForAllIndexes.hpp"
 
 using namespace std;
@@ -50,6 +51,21 @@ TEST(NoIndex, pointsWithinDistance_squareDistance) {
     pointsWithinDistance_squareDistance(index);
 }
 
+TEST(NoIndex, nearestPointsWithinDistance_closestK) {
+    NoIndex<Point> index;
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(NoIndex, nearestPointsWithinDistance_lessThanK) {
+    NoIndex<Point> index;
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(NoIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    NoIndex<Point> index;
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(NoIndex, index_duplicatedIndex) {
@@ -79,4 +95,53 @@ TEST(NoIndex, pointsWithinDistance_overflowDistance) {
 
 #endif
 
-}
\ No newline at end of file
+/* Specific tests for this implementation. */
+TEST(NoIndex, pointsWithinDistance_floatPoints) {
+    NoIndex<FloatPoint> index;
+    for (PointIndex i = 0; i < 50; ++i)
+        index.index(FloatPoint{static_cast<float>(i), 0, 0}, i);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<FloatPoint>> result;
+    index.pointsWithinDistance(FloatPoint{20, 0, 0}, 2.5, result);
+    
+    ASSERT_EQ(5, result.size());
+    ASSERT_EQ(20, result.at(0).pointIndex);
+    ASSERT_EQ(4, result.at(4).geometricValue);
+}
+
+TEST(NoIndex, pointsWithinDistance_parallelSameAsSerial) {
+    NoIndex<Point> index;
+    for (PointIndex i = 0; i < 50000; ++i)  // Enough for a few chunks.
+        index.index(Point{static_cast<double>(i % 100), static_cast<double>(i % 37), static_cast<double>(i % 11)}, i);
+    index.completed();
+    
+    const Point referencePoint{50, 18, 5};
+    std::vector<IndexAndSquaredDistance<Point>> serialResult;
+    index.pointsWithinDistance(referencePoint, 10, serialResult);
+    
+    WorkerPool workers(4);
+    std::vector<IndexAndSquaredDistance<Point>> parallelResult;
+    index.pointsWithinDistance(referencePoint, 10, parallelResult, workers);
+    
+    ASSERT_EQ(serialResult.size(), parallelResult.size());
+    ASSERT_TRUE(std::is_sorted(std::begin(parallelResult), std::end(parallelResult), SortByGeometry<Point>));
+    for (size_t i = 0; i < serialResult.size(); ++i)
+        ASSERT_EQ(serialResult[i].geometricValue, parallelResult[i].geometricValue);
+}
+
+TEST(NoIndex, pointsWithinDistance_parallelFewPoints) {
+    NoIndex<Point> index;
+    WorkerPool workers(4);
+    pointsWithinDistance_outputOrder(index);
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 4, result, workers);
+    
+    ASSERT_EQ(3, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+    ASSERT_EQ(3, result.at(2).pointIndex);
+}
+
+}
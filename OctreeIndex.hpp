@@ -0,0 +1,435 @@
+#ifndef GEOINDEX_OCTREE_INDEX
+#define GEOINDEX_OCTREE_INDEX
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+
+#include "Common.hpp"
+#include "BasicGeometry.hpp"
+#include "DistanceKernels.hpp"
+
+namespace geoIndex {
+
+/** Cubes of many sizes: for point sets where the density changes a lot from place to place
+ *  (a few very dense regions in a sparse background), where no single cube size suits a CubeIndex.
+ *
+ *  A sparse octree with buckets in the leaves. The root is a cube around all the points; any cube that holds more
+ *  than bucketSize points is split in its 8 octants, and so on. Only the octants that have points exist.
+ *  Dense regions get deep, small cubes; sparse ones stay with a few big cubes.
+ *
+ *  The points are sorted so that the points under each node are contiguous ("structure of arrays", as in NoIndex):
+ *  a leaf is scanned with the SIMD distance kernel, and a node that is all within the search distance is taken
+ *  as a whole, without looking at its children. Each node keeps the bounding box of its points (tighter than its cube).
+ *
+ *  The user must call completed() between modifications and lookups.
+ */
+template <typename POINT>
+class OctreeIndex {
+public:
+    /** bucketSize is the most points a leaf can hold (unless they are so close that the tree would get too deep).
+     *  If you know how many points you are going to use, tell it to the constructor to reserve memory. */
+    explicit OctreeIndex(const size_t bucketSize = 32,
+                         const size_t expectedCollectionSize = 0) :
+        bucketSize(bucketSize)
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (bucketSize == 0)
+                throw std::runtime_error("OctreeIndex Buckets can not be empty.");
+            readyForLookups = true;  // Nothing inside, nothing to prepare.
+        #endif
+
+        coordinatesX.reserve(expectedCollectionSize);
+        coordinatesY.reserve(expectedCollectionSize);
+        coordinatesZ.reserve(expectedCollectionSize);
+        indices.reserve(expectedCollectionSize);
+    }
+
+    /** Adds a point to the index. Remember its name too. */
+    void index(const POINT& p, const typename PointTraits<POINT>::index index) {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = false;
+
+            if (std::find(begin(indices), end(indices), index) != end(indices))
+                throw std::runtime_error("OctreeIndex::index Point indexed twice");
+        #endif
+
+        coordinatesX.push_back(p.x);
+        coordinatesY.push_back(p.y);
+        coordinatesZ.push_back(p.z);
+        indices.push_back(index);
+    }
+
+    /** Builds the tree over all the points indexed so far.
+     *  It can be called again after indexing more points, but it redoes all the work.
+     *
+     *  The tree is built one level at a time: the children of a node are created together, next to each other,
+     *  and split in turn when the loop gets to them. */
+    void completed() {
+        nodes.clear();
+
+        if (! indices.empty()) {
+            std::vector<Cell> cells;
+            cells.push_back(rootCell());
+            nodes.push_back(Node());
+            nodes[0].begin = 0;
+            nodes[0].end = indices.size();
+
+            SortingSpace sortingSpace(indices.size());
+            for (size_t node = 0; node < nodes.size(); ++node) {
+                fitBoundingBox(nodes[node]);
+                if (nodes[node].end - nodes[node].begin > bucketSize && cells[node].depth < maximumDepth)
+                    split(node, cells, sortingSpace);
+            }
+        }
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            readyForLookups = true;
+        #endif
+    }
+
+    /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
+    *  Returns the points sorted in distance order from p (to simplify computing the k-nearest-neighbor).
+    *  The returned structure also gives the squared distance. The client can do a sqrt and use it for its computations.
+    *
+    *  Returns only points strictly within the distance.
+    */
+    void pointsWithinDistance(const POINT& p,
+                              const typename PointTraits<POINT>::coordinate d,
+                              std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+
+        output.clear();
+        if (nodes.empty())
+            return;
+
+        uint32_t toVisit[maximumPendingNodes];
+        size_t pending = 0;
+        toVisit[pending++] = 0;
+
+        while (pending > 0) {
+            const Node& node = nodes[toVisit[--pending]];
+            if (! (squaredDistanceToBox(p, node) < distanceLimit))
+                continue;
+
+            if (squaredDistanceToFarthestCorner(p, node) < distanceLimit)
+                AppendPointsWithSquaredDistance(p,
+                                                coordinatesX.data() + node.begin,
+                                                coordinatesY.data() + node.begin,
+                                                coordinatesZ.data() + node.begin,
+                                                indices.data() + node.begin,
+                                                node.end - node.begin,
+                                                output);
+            else if (node.childCount == 0)
+                AppendPointsWithinSquaredDistance(p,
+                                                  distanceLimit,
+                                                  coordinatesX.data() + node.begin,
+                                                  coordinatesY.data() + node.begin,
+                                                  coordinatesZ.data() + node.begin,
+                                                  indices.data() + node.begin,
+                                                  node.end - node.begin,
+                                                  output);
+            else
+                for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; ++child)
+                    toVisit[pending++] = child;
+        }
+
+        std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
+    }
+
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements.
+     *  Visits the closest children first, and skips the nodes that are farther than the k-th point found so far.
+     *  May return less than k points, if there are not enough within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p,
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        const typename PointTraits<POINT>::coordinate distanceLimit = squaredDistanceLimit(d);
+        checkReady();
+        nearestPointsWithinSquaredDistance(p, distanceLimit, k, output);
+    }
+
+    /** Finds the k points closest to p, wherever they are: no culling distance to guess.
+     *  Returns less than k points only if the index has less than k points.
+     */
+    void nearestPoints(const POINT& p,
+                       const size_t k,
+                       std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        checkReady();
+        nearestPointsWithinSquaredDistance(p, std::numeric_limits<typename PointTraits<POINT>::coordinate>::max(), k, output);
+    }
+
+private:
+    /** Deeper than this, the points are left in the same leaf even if there are too many.
+     *  Only happens with (almost) coincident points. */
+    static const unsigned maximumDepth = 32;
+    /** A depth first visit leaves at most 7 siblings per level on the stack, plus the 8 children of the deepest node. */
+    static const size_t maximumPendingNodes = 7 * maximumDepth + 8;
+
+    const size_t bucketSize;
+
+    /** A node of the tree. The children of a node are next to each other in the nodes vector. */
+    struct Node {
+        // Bounding box of the points under the node.
+        typename PointTraits<POINT>::coordinate lowestX, lowestY, lowestZ;
+        typename PointTraits<POINT>::coordinate highestX, highestY, highestZ;
+        // The points under the node, in the coordinate and index arrays.
+        size_t begin;
+        size_t end;
+        uint32_t firstChild;
+        uint32_t childCount;  ///< 0 for the leaves.
+
+        Node() : begin(0), end(0), firstChild(0), childCount(0) {}
+    };
+
+    /** The cube of the octree that a node stands for. Only needed to build the tree. */
+    struct Cell {
+        typename PointTraits<POINT>::coordinate centerX, centerY, centerZ;
+        typename PointTraits<POINT>::coordinate halfSide;
+        unsigned depth;
+    };
+
+    /** Room to sort the points of a node by octant. Only needed to build the tree. */
+    struct SortingSpace {
+        explicit SortingSpace(const size_t points) :
+            octantOfPoint(points),
+            coordinatesX(points),
+            coordinatesY(points),
+            coordinatesZ(points),
+            indices(points)
+        {}
+
+        std::vector<unsigned char> octantOfPoint;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+        std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+        std::vector<typename PointTraits<POINT>::index> indices;
+    };
+
+    /** A node waiting to be visited, with its distance from the reference. */
+    struct PendingNode {
+        uint32_t node;
+        typename PointTraits<POINT>::coordinate squaredDistance;
+    };
+
+    std::vector<Node> nodes;  ///< The root first, if any.
+
+    // The points, sorted by node after completed().
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
+    std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
+    std::vector<typename PointTraits<POINT>::index> indices;
+
+    #ifdef GEO_INDEX_SAFETY_CHECKS
+        bool readyForLookups;
+    #endif
+
+
+    /** The smallest cube around all the points. */
+    Cell rootCell() const {
+        const auto xRange = std::minmax_element(std::begin(coordinatesX), std::end(coordinatesX));
+        const auto yRange = std::minmax_element(std::begin(coordinatesY), std::end(coordinatesY));
+        const auto zRange = std::minmax_element(std::begin(coordinatesZ), std::end(coordinatesZ));
+
+        Cell root;
+        root.centerX = (*xRange.first + *xRange.second) / 2;
+        root.centerY = (*yRange.first + *yRange.second) / 2;
+        root.centerZ = (*zRange.first + *zRange.second) / 2;
+        root.halfSide = std::max(std::max(*xRange.second - *xRange.first,
+                                          *yRange.second - *yRange.first),
+                                 *zRange.second - *zRange.first) / 2;
+        root.depth = 0;
+        return root;
+    }
+
+    void fitBoundingBox(Node& node) const {
+        node.lowestX = node.highestX = coordinatesX[node.begin];
+        node.lowestY = node.highestY = coordinatesY[node.begin];
+        node.lowestZ = node.highestZ = coordinatesZ[node.begin];
+        for (size_t point = node.begin + 1; point < node.end; ++point) {
+            node.lowestX = std::min(node.lowestX, coordinatesX[point]);
+            node.highestX = std::max(node.highestX, coordinatesX[point]);
+            node.lowestY = std::min(node.lowestY, coordinatesY[point]);
+            node.highestY = std::max(node.highestY, coordinatesY[point]);
+            node.lowestZ = std::min(node.lowestZ, coordinatesZ[point]);
+            node.highestZ = std::max(node.highestZ, coordinatesZ[point]);
+        }
+    }
+
+    /** Sorts the points of the node by octant (a counting sort, as in DenseCubeIndex) and adds a child for each
+     *  octant that has points. */
+    void split(const size_t node, std::vector<Cell>& cells, SortingSpace& sorting) {
+        const Cell cell = cells[node];
+        const size_t begin = nodes[node].begin;
+        const size_t end = nodes[node].end;
+
+        size_t octantStart[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};  // Relative to begin.
+        for (size_t point = begin; point < end; ++point) {
+            const unsigned char octant = static_cast<unsigned char>((coordinatesX[point] >= cell.centerX ? 4 : 0) |
+                                                                    (coordinatesY[point] >= cell.centerY ? 2 : 0) |
+                                                                    (coordinatesZ[point] >= cell.centerZ ? 1 : 0));
+            sorting.octantOfPoint[point] = octant;
+            ++octantStart[octant + 1];
+        }
+        for (size_t octant = 0; octant < 8; ++octant)
+            octantStart[octant + 1] += octantStart[octant];
+
+        size_t nextFree[8];
+        for (size_t octant = 0; octant < 8; ++octant)
+            nextFree[octant] = begin + octantStart[octant];
+        for (size_t point = begin; point < end; ++point) {
+            const size_t destination = nextFree[sorting.octantOfPoint[point]]++;
+            sorting.coordinatesX[destination] = coordinatesX[point];
+            sorting.coordinatesY[destination] = coordinatesY[point];
+            sorting.coordinatesZ[destination] = coordinatesZ[point];
+            sorting.indices[destination] = indices[point];
+        }
+        std::copy(sorting.coordinatesX.begin() + begin, sorting.coordinatesX.begin() + end, coordinatesX.begin() + begin);
+        std::copy(sorting.coordinatesY.begin() + begin, sorting.coordinatesY.begin() + end, coordinatesY.begin() + begin);
+        std::copy(sorting.coordinatesZ.begin() + begin, sorting.coordinatesZ.begin() + end, coordinatesZ.begin() + begin);
+        std::copy(sorting.indices.begin() + begin, sorting.indices.begin() + end, indices.begin() + begin);
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (nodes.size() + 8 > std::numeric_limits<uint32_t>::max())
+                throw std::runtime_error("OctreeIndex Too many nodes. Use bigger buckets.");
+        #endif
+
+        nodes[node].firstChild = static_cast<uint32_t>(nodes.size());
+        const typename PointTraits<POINT>::coordinate quarterSide = cell.halfSide / 2;
+        for (size_t octant = 0; octant < 8; ++octant) {
+            if (octantStart[octant] == octantStart[octant + 1])
+                continue;
+
+            Node child;
+            child.begin = begin + octantStart[octant];
+            child.end = begin + octantStart[octant + 1];
+            nodes.push_back(child);
+
+            Cell childCell;
+            childCell.centerX = cell.centerX + ((octant & 4) ? quarterSide : -quarterSide);
+            childCell.centerY = cell.centerY + ((octant & 2) ? quarterSide : -quarterSide);
+            childCell.centerZ = cell.centerZ + ((octant & 1) ? quarterSide : -quarterSide);
+            childCell.halfSide = quarterSide;
+            childCell.depth = cell.depth + 1;
+            cells.push_back(childCell);
+
+            ++nodes[node].childCount;
+        }
+    }
+
+    void nearestPointsWithinSquaredDistance(const POINT& p,
+                                            const typename PointTraits<POINT>::coordinate squaredLimit,
+                                            const size_t k,
+                                            std::vector<IndexAndSquaredDistance<POINT> >& output) const {
+        KNearestCandidates<POINT> nearest(k, squaredLimit, output);
+        if (nodes.empty()) {
+            nearest.sort();
+            return;
+        }
+
+        // The nodes wait with their distance: the limit may have shrunk when their turn comes.
+        PendingNode toVisit[maximumPendingNodes];
+        size_t pending = 0;
+        toVisit[pending++] = {0, squaredDistanceToBox(p, nodes[0])};
+
+        std::vector<IndexAndSquaredDistance<POINT> > leafHits;
+        while (pending > 0) {
+            const PendingNode next = toVisit[--pending];
+            if (! (next.squaredDistance < nearest.squaredLimit()))
+                continue;
+
+            const Node& node = nodes[next.node];
+            if (node.childCount == 0) {
+                leafHits.clear();
+                AppendPointsWithinSquaredDistance(p,
+                                                  nearest.squaredLimit(),
+                                                  coordinatesX.data() + node.begin,
+                                                  coordinatesY.data() + node.begin,
+                                                  coordinatesZ.data() + node.begin,
+                                                  indices.data() + node.begin,
+                                                  node.end - node.begin,
+                                                  leafHits);
+                for (const auto& hit : leafHits)
+                    nearest.offer(hit.pointIndex, hit.geometricValue);
+                continue;
+            }
+
+            // The closest child must be on top of the stack: push them from the farthest.
+            const size_t firstPushed = pending;
+            for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; ++child) {
+                const typename PointTraits<POINT>::coordinate childDistance = squaredDistanceToBox(p, nodes[child]);
+                if (childDistance < nearest.squaredLimit())
+                    toVisit[pending++] = {child, childDistance};
+            }
+            std::sort(toVisit + firstPushed, toVisit + pending, FartherFirst);
+        }
+
+        nearest.sort();
+    }
+
+    static bool FartherFirst(const PendingNode& a, const PendingNode& b) {
+        return a.squaredDistance > b.squaredDistance;
+    }
+
+    /** Distance of p from the closest point of the bounding box of the node, 0 if p is inside. Squared, as usual. */
+    static typename PointTraits<POINT>::coordinate squaredDistanceToBox(const POINT& p, const Node& node) {
+        const typename PointTraits<POINT>::coordinate xDistance = distanceFromInterval(p.x, node.lowestX, node.highestX);
+        const typename PointTraits<POINT>::coordinate yDistance = distanceFromInterval(p.y, node.lowestY, node.highestY);
+        const typename PointTraits<POINT>::coordinate zDistance = distanceFromInterval(p.z, node.lowestZ, node.highestZ);
+        return xDistance * xDistance + yDistance * yDistance + zDistance * zDistance;
+    }
+
+    /** Distance of p from the farthest corner of the bounding box of the node. Squared, as usual. */
+    static typename PointTraits<POINT>::coordinate squaredDistanceToFarthestCorner(const POINT& p, const Node& node) {
+        const typename PointTraits<POINT>::coordinate xDistance = std::max(p.x - node.lowestX, node.highestX - p.x);
+        const typename PointTraits<POINT>::coordinate yDistance = std::max(p.y - node.lowestY, node.highestY - p.y);
+        const typename PointTraits<POINT>::coordinate zDistance = std::max(p.z - node.lowestZ, node.highestZ - p.z);
+        return xDistance * xDistance + yDistance * yDistance + zDistance * zDistance;
+    }
+
+    static typename PointTraits<POINT>::coordinate distanceFromInterval(const typename PointTraits<POINT>::coordinate coordinate,
+                                                                        const typename PointTraits<POINT>::coordinate lowest,
+                                                                        const typename PointTraits<POINT>::coordinate highest) {
+        if (coordinate < lowest)
+            return lowest - coordinate;
+        if (coordinate > highest)
+            return coordinate - highest;
+        return 0;
+    }
+
+    void checkReady() const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            if (! readyForLookups)
+                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
+        #endif
+    }
+
+    typename PointTraits<POINT>::coordinate squaredDistanceLimit(const typename PointTraits<POINT>::coordinate d) const {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+
+        const typename PointTraits<POINT>::coordinate distanceLimit = d * d;
+
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(distanceLimit);
+        #endif
+
+        return distanceLimit;
+    }
+};
+
+template <typename POINT>
+const unsigned OctreeIndex<POINT>::maximumDepth;
+
+template <typename POINT>
+const size_t OctreeIndex<POINT>::maximumPendingNodes;
+
+}
+
+#endif
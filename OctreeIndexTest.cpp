@@ -0,0 +1,223 @@
+#include "gtest/gtest.h"
+
+#include "OctreeIndex.hpp"
+
+#include <vector>
+#include <limits>
+#include "Common.hpp"
+#include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+using namespace std;
+
+namespace geoIndex {
+
+static const size_t bucketSize = 4;  // Small, so that even the small tests have a few levels.
+
+TEST(OctreeIndex, pointsWithinDistance_samePoint) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_samePoint(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_coincidentPoints) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_coincidentPoints(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_noPoints) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_noPoints(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_onlyFarPoints) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_onlyFarPoints(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_inAndOutPoints) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_inAndOutPoints(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_exactDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_exactDistance(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_outputOrder) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_outputOrder(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_squareDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_squareDistance(index);
+}
+
+TEST(OctreeIndex, nearestPointsWithinDistance_closestK) {
+    OctreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(OctreeIndex, nearestPointsWithinDistance_lessThanK) {
+    OctreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(OctreeIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(OctreeIndex, index_duplicatedIndex) {
+    OctreeIndex<Point> index(bucketSize);
+    index_duplicatedIndex(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_negativeDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_negativeDistance(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_zeroDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_zeroDistance(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_NanDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_NanDistance(index);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_overflowDistance) {
+    OctreeIndex<Point> index(bucketSize);
+    pointsWithinDistance_overflowDistance(index);
+}
+
+#endif
+
+
+/* Specific tests for this implementation. */
+
+/* Compares with a brute force search, for a few references and distances. */
+static void sameAsNoIndex(const std::vector<Point>& points, const size_t bucketSize) {
+    OctreeIndex<Point> octree(bucketSize);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < points.size(); ++i) {
+        octree.index(points[i], i);
+        bruteForce.index(points[i], i);
+    }
+    octree.completed();
+    
+    const std::vector<Point> references{{0, 0, 0}, {1.5, -2.5, 10.25}, {-50, -30, 0}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (double d : {0.5, 3.0, 20.0, 1000.0}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, d, expected);
+            octree.pointsWithinDistance(referencePoint, d, result);
+            
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t i = 0; i < expected.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+            
+            octree.nearestPointsWithinDistance(referencePoint, d, 5, result);
+            ASSERT_EQ(std::min<size_t>(5, expected.size()), result.size());
+            for (size_t i = 0; i < result.size(); ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+        }
+}
+
+TEST(OctreeIndex, pointsWithinDistance_denseAndSparse) {
+    // A dense blob in a sparse background: the octree gets deep only in the blob.
+    std::vector<Point> points;
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 101) - 50,
+                               static_cast<double>((i * 104729) % 61) - 30,
+                               static_cast<double>((i * 31) % 23)});
+    for (PointIndex i = 0; i < 3000; ++i)
+        points.push_back(Point{0.001 * ((i * 7919) % 97), 0.001 * ((i * 31) % 89), 0.001 * ((i * 104729) % 83)});
+    
+    sameAsNoIndex(points, 4);
+    sameAsNoIndex(points, 64);
+}
+
+TEST(OctreeIndex, pointsWithinDistance_coincidentPointsBeyondTheBucket) {
+    std::vector<Point> points(100, Point{1, 2, 3});
+    points.push_back(Point{1, 2, 4});
+    
+    sameAsNoIndex(points, 4);
+}
+
+TEST(OctreeIndex, nearestPoints_sameAsNoIndex) {
+    OctreeIndex<Point> octree(8);
+    NoIndex<Point> bruteForce;
+    for (PointIndex i = 0; i < 2000; ++i) {
+        const Point p{static_cast<double>((i * 7919) % 101) - 50,
+                      static_cast<double>((i * 104729) % 61) - 30,
+                      static_cast<double>((i * 31) % 23) + 0.5 * (i % 3)};
+        octree.index(p, i);
+        bruteForce.index(p, i);
+    }
+    octree.completed();
+    
+    const std::vector<Point> references{{1.5, -2.5, 10.25}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (size_t k : {1, 7, 100}) {
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            bruteForce.pointsWithinDistance(referencePoint, 100000, expected);
+            octree.nearestPoints(referencePoint, k, result);
+            
+            ASSERT_EQ(k, result.size());
+            for (size_t i = 0; i < k; ++i)
+                ASSERT_NEAR(expected[i].geometricValue, result[i].geometricValue, 1e-9);  // The SIMD kernels may round differently.
+        }
+}
+
+TEST(OctreeIndex, nearestPoints_lessThanK) {
+    OctreeIndex<Point> octree;
+    octree.index(Point{0, 0, 0}, 1);
+    octree.index(Point{30, -20, 10}, 2);
+    octree.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    octree.nearestPoints(Point{5, 5, 5}, 10, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
+    ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
+TEST(OctreeIndex, completedTwice) {
+    OctreeIndex<Point> index(1);
+    index.index(Point{0, 0, 0}, 1);
+    index.completed();
+    index.index(Point{0.5, 0, 0}, 2);
+    index.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    index.pointsWithinDistance(Point{0, 0, 0}, 1, result);
+    ASSERT_EQ(2, result.size());
+}
+
+
+#ifdef GEO_INDEX_SAFETY_CHECKS
+TEST(OctreeIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+    const Point anyPoint{1, 55, 2};
+  
+    OctreeIndex<Point> index;
+    index.index(anyPoint, 1);
+    // No call to completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    ASSERT_ANY_THROW(index.pointsWithinDistance(anyPoint, 0.01, result));
+}
+
+TEST(OctreeIndex, emptyBuckets) {
+    ASSERT_ANY_THROW(OctreeIndex<Point> index(0));
+}
+#endif
+
+}
@@ -2,15 +2,25 @@
 
 #include <iostream>
 #include <ctime>
+#include <chrono>
 #include <sstream>
+#include <thread>
+#include <atomic>
 
 #include "NoIndex.hpp"
 #include "AabbIndex.hpp"
 #include "CubeIndex.hpp"
+#include "DenseCubeIndex.hpp"
+#include "OctreeIndex.hpp"
+#include "KdTreeIndex.hpp"
+#include "LinearOctreeIndex.hpp"
+#include "ConcurrentCubeIndex.hpp"
 #include "PermutationAabbIndex.hpp"
 #include "BoostIndex.hpp"
 
 #include "NearestNeighbors.hpp"
+#include "SpaceFillingCurve.hpp"
+#include "WorkerPool.hpp"
 
 namespace geoIndex {
   
@@ -94,6 +104,24 @@ void singleLookupTest_tabulated(INDEX index, const std::vector<Point>& redMesh,
     printf("%20lu|%20f|%20f|%20lu|%20f\n", redMesh.size(), indexPreparation, lookup, results.size(), distance);
 }
 
+template<typename INDEX>
+void singleLookupTest_tabulated(INDEX index, const std::vector<Point>& redMesh, double distance, WorkerPool& workers) {
+    
+        PoorMansTimerString tPreparation;
+        BuildIndex(redMesh, index);
+        double indexPreparation = tPreparation.stop();
+    
+
+    const Point lookupPoint{0, 0, 0};
+    std::vector<IndexAndSquaredDistance<Point> > results;
+    
+        PoorMansTimerString tLookup;
+        index.pointsWithinDistance(lookupPoint, distance, results, workers);
+        double lookup = tLookup.stop();
+    
+    printf("%20lu|%20f|%20f|%20lu|%20f\n", redMesh.size(), indexPreparation, lookup, results.size(), distance);
+}
+
 template<typename INDEX>
 void multipleLookupTest(INDEX index, const std::vector<Point>& redMesh, const std::vector<Point>& greenMesh, double distance) {
     BuildIndex(redMesh, index);
@@ -110,6 +138,21 @@ void multipleLookupTest(INDEX index, const std::vector<Point>& redMesh, const st
                redMesh.size(), greenMesh.size(), distance, results.size(), elapsed);
 }
 
+template<typename INDEX>
+void multipleExactLookupTest(INDEX index, const std::vector<Point>& redMesh, const std::vector<Point>& greenMesh) {
+    BuildIndex(redMesh, index);
+    static const size_t neededNearest = 2;
+
+    std::vector<IndexAndSquaredDistance<Point> > results;
+    
+        PoorMansTimerString t;
+        for (const auto& p : greenMesh)
+            KNearestNeighbor(index, p, neededNearest, results);
+        double elapsed = t.stop();
+        
+        printf("Red mesh size: %20lu, Green mesh size: %20lu, no culling distance, points found %20lu, time %20f\n",
+               redMesh.size(), greenMesh.size(), results.size(), elapsed);
+}
 
 TEST(PerformanceTest, collectionSize_noIndex) {
     tableHeader();
@@ -138,6 +181,35 @@ TEST(PerformanceTest, collectionSize_noIndex) {
 }
 
 
+/* Careful: std::clock measures the CPU time of all the threads. Compare with the wall clock. */
+TEST(PerformanceTest, collectionSize_noIndexParallel) {
+    WorkerPool workers;
+    tableHeader();
+    {
+        NoIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<1000>(), 100, workers);
+    }
+    {
+        NoIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<10000>(), 100, workers);
+    }
+    {
+        NoIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<100000>(), 100, workers);
+    }
+    {
+        NoIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<200000>(), 100, workers);
+    }
+    {
+        NoIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<1000000>(), 100, workers);
+    }
+    
+    std::cout << std::endl;
+}
+
+
 TEST(PerformanceTest, collectionSize_aabb) {
     tableHeader();
     {
@@ -190,6 +262,113 @@ TEST(PerformanceTest, collectionSize_cube) {
     std::cout << std::endl;
 }
 
+TEST(PerformanceTest, collectionSize_denseCube) {
+    tableHeader();
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<1000>(), 100);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<10000>(), 100);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<100000>(), 100);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<200000>(), 100);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<1000000>(), 100);
+    }
+    
+    std::cout << std::endl;
+}
+
+
+TEST(PerformanceTest, collectionSize_octree) {
+    tableHeader();
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000>(), 100);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<10000>(), 100);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<100000>(), 100);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 100);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000000>(), 100);
+    }
+    
+    std::cout << std::endl;
+}
+
+
+TEST(PerformanceTest, collectionSize_kdTree) {
+    tableHeader();
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000>(), 100);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<10000>(), 100);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<100000>(), 100);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 100);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000000>(), 100);
+    }
+    
+    std::cout << std::endl;
+}
+
+
+TEST(PerformanceTest, collectionSize_linearOctree) {
+    tableHeader();
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000>(), 100);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<10000>(), 100);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<100000>(), 100);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 100);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<1000000>(), 100);
+    }
+    
+    std::cout << std::endl;
+}
+
 
 TEST(PerformanceTest, collectionSize_aabbWithPermutation) {
     tableHeader();
@@ -298,6 +477,78 @@ TEST(PerformanceTest, searchDistance_cube) {
     std::cout << std::endl;
 }
 
+TEST(PerformanceTest, searchDistance_denseCube) {
+    tableHeader();
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<200000>(), 1);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<200000>(), 10);
+    }
+    {
+        DenseCubeIndex<Point> index(10);
+        singleLookupTest_tabulated(index, redMesh<200000>(), 50);
+    }
+   
+    std::cout << std::endl;
+}
+
+TEST(PerformanceTest, searchDistance_octree) {
+    tableHeader();
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 1);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 10);
+    }
+    {
+        OctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 50);
+    }
+   
+    std::cout << std::endl;
+}
+
+TEST(PerformanceTest, searchDistance_kdTree) {
+    tableHeader();
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 1);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 10);
+    }
+    {
+        KdTreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 50);
+    }
+   
+    std::cout << std::endl;
+}
+
+TEST(PerformanceTest, searchDistance_linearOctree) {
+    tableHeader();
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 1);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 10);
+    }
+    {
+        LinearOctreeIndex<Point> index;
+        singleLookupTest_tabulated(index, redMesh<200000>(), 50);
+    }
+   
+    std::cout << std::endl;
+}
+
 TEST(PerformanceTest, searchDistance_permutation) {
     tableHeader();
     {
@@ -354,6 +605,33 @@ TEST(PerformanceTest, multipleLookups) {
         CubeIndex<Point> index(10);
         multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
     }
+    { 
+        printf ("cube, suggested side - ");
+        CubeSideHints<Point> hints;
+        hints.queryRadius = 30;
+        CubeIndex<Point> index(SuggestCubeSide(redMesh<200000>(), hints));
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+    }
+    { 
+        printf ("dense cube - ");
+        DenseCubeIndex<Point> index(10);
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+    }
+    { 
+        printf ("octree - ");
+        OctreeIndex<Point> index;
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+    }
+    { 
+        printf ("kd-tree - ");
+        KdTreeIndex<Point> index;
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+    }
+    { 
+        printf ("linear octree - ");
+        LinearOctreeIndex<Point> index;
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+    }
     { 
         printf ("permutation - ");
         PermutationAabbIndex<Point> index;
@@ -368,4 +646,454 @@ TEST(PerformanceTest, multipleLookups) {
     std::cout << std::endl;
 }
 
+/* All the points at once, with the workers, against one index() call per point. */
+TEST(PerformanceTest, bulkBuild_cube) {
+    WorkerPool workers;
+    for (const std::vector<Point>* points : {&redMesh<200000>(), &redMesh<1000000>()}) {
+        // Wall clock for both: processor time would add up all the threads.
+        const auto beginOneByOne = std::chrono::steady_clock::now();
+        CubeIndex<Point> oneByOne(10);
+        BuildIndex(*points, oneByOne);
+        const double oneByOneTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginOneByOne).count();
+        
+        const auto beginBulk = std::chrono::steady_clock::now();
+        CubeIndex<Point> bulk(10);
+        BuildIndex(*points, bulk, workers);
+        const double bulkTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginBulk).count();
+        
+        printf("Mesh size: %20lu, wall clock one by one %20f, bulk with %2lu threads %20f\n",
+               points->size(), oneByOneTime, workers.size(), bulkTime);
+    }
+
+    std::cout << std::endl;
+}
+
+/* Sorting the three axes is most of the preparation of the AABB indexes. */
+template<typename INDEX>
+static void completedTest(const char* name, const std::vector<Point>& points, WorkerPool& workers) {
+    INDEX alone(points.size());
+    INDEX withWorkers(points.size());
+    for (PointIndex i = 0; i < points.size(); ++i) {
+        alone.index(points[i], i);
+        withWorkers.index(points[i], i);
+    }
+    
+    // Wall clock for both: processor time would add up all the threads.
+    const auto beginAlone = std::chrono::steady_clock::now();
+    alone.completed();
+    const double aloneTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginAlone).count();
+    
+    const auto beginWorkers = std::chrono::steady_clock::now();
+    withWorkers.completed(workers);
+    const double workersTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - beginWorkers).count();
+    
+    printf("%s - Mesh size: %20lu, wall clock completed() %20f, with %2lu threads %20f\n",
+           name, points.size(), aloneTime, workers.size(), workersTime);
+}
+
+TEST(PerformanceTest, completed_aabb) {
+    WorkerPool workers;
+    for (const std::vector<Point>* points : {&redMesh<200000>(), &redMesh<1000000>()}) {
+        completedTest<AabbIndex<Point> >("aabb", *points, workers);
+        completedTest<PermutationAabbIndex<Point> >("aabbWithPermutation", *points, workers);
+    }
+
+    std::cout << std::endl;
+}
+
+/* Points arrive a batch at a time, with lookups in between. The index keeps the latest points in sorted runs
+   of growing size; calling completed() after each batch merges them all every time. */
+template<typename INDEX>
+static void streamingTest(const char* name, const std::vector<Point>& points, const bool completeEachBatch) {
+    static const size_t batchSize = 1000;
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    std::vector<IndexAndSquaredDistance<Point> > results;
+    size_t found = 0;
+    
+    PoorMansTimerString timer;
+    INDEX index;
+    for (PointIndex i = 0; i < points.size(); ++i) {
+        index.index(points[i], i);
+        if ((i + 1) % batchSize == 0) {
+            if (completeEachBatch)
+                index.completed();
+            for (size_t lookup = 0; lookup < 10; ++lookup) {
+                index.pointsWithinDistance(greenPoints[lookup], 100, results);
+                found += results.size();
+            }
+        }
+    }
+    const double time = timer.stop();
+    
+    printf("%s - Mesh size: %20lu, batches of %lu points, completed() after each batch: %3s, points found %10lu, time %20f\n",
+           name, points.size(), batchSize, completeEachBatch ? "yes" : "no", found, time);
+}
+
+TEST(PerformanceTest, streaming_aabb) {
+    const std::vector<Point>& points = redMesh<200000>();
+    streamingTest<AabbIndex<Point> >("aabb", points, true);
+    streamingTest<AabbIndex<Point> >("aabb", points, false);
+    streamingTest<PermutationAabbIndex<Point> >("aabbWithPermutation", points, true);
+    streamingTest<PermutationAabbIndex<Point> >("aabbWithPermutation", points, false);
+
+    std::cout << std::endl;
+}
+
+/* The r-tree built inserting the points one by one (what BoostIndex used to do) against the packed build of
+   BoostIndex::completed(). Both trees are then queried with the same boxes. */
+TEST(PerformanceTest, packedBuild_boost) {
+    typedef boost::geometry::index::rtree<geoIndex_PointWithIndex, boost::geometry::index::linear<16> > OneByOneTree;
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    for (const std::vector<Point>* points : {&redMesh<200000>(), &redMesh<1000000>()}) {
+        PoorMansTimerString oneByOneTimer;
+        OneByOneTree oneByOne;
+        for (PointIndex i = 0; i < points->size(); ++i)
+            oneByOne.insert(geoIndex_PointWithIndex((*points)[i].x, (*points)[i].y, (*points)[i].z, i));
+        const double oneByOneTime = oneByOneTimer.stop();
+        
+        PoorMansTimerString packedTimer;
+        BoostIndex<Point> packed;
+        BuildIndex(*points, packed);
+        const double packedTime = packedTimer.stop();
+        
+        std::vector<geoIndex_PointWithIndex> inBox;
+        size_t found = 0;
+        PoorMansTimerString oneByOneLookupTimer;
+        for (const Point& p : greenPoints) {
+            const boostBox box(boostPoint(p.x - 30, p.y - 30, p.z - 30), boostPoint(p.x + 30, p.y + 30, p.z + 30));
+            inBox.clear();
+            oneByOne.query(boost::geometry::index::intersects(box), std::back_inserter(inBox));
+            found += inBox.size();
+        }
+        const double oneByOneLookupTime = oneByOneLookupTimer.stop();
+        
+        std::vector<IndexAndSquaredDistance<Point> > results;
+        PoorMansTimerString packedLookupTimer;
+        for (const Point& p : greenPoints)
+            packed.pointsWithinDistance(p, 30, results);
+        const double packedLookupTime = packedLookupTimer.stop();
+        
+        printf("boost - Mesh size: %20lu, build one by one %10f, packed %10f; %lu box lookups one by one %10f (%lu points), packed (with distances) %10f\n",
+               points->size(), oneByOneTime, packedTime, greenPoints.size(), oneByOneLookupTime, found, packedLookupTime);
+    }
+
+    std::cout << std::endl;
+}
+
+/* The 2 nearest points from all the points within the distance (what a box query gives), against boost's
+   nearest query: the bigger the distance, the more points in the box. */
+TEST(PerformanceTest, nearestQuery_boost) {
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    BoostIndex<Point> index;
+    BuildIndex(redMesh<200000>(), index);
+    std::vector<IndexAndSquaredDistance<Point> > results;
+    for (const double distance : {10.0, 30.0, 100.0, 300.0}) {
+        size_t inBox = 0;
+        PoorMansTimerString boxTimer;
+        for (const Point& p : greenPoints) {
+            index.pointsWithinDistance(p, distance, results);
+            inBox += results.size();
+        }
+        const double boxTime = boxTimer.stop();
+        
+        PoorMansTimerString nearestTimer;
+        for (const Point& p : greenPoints)
+            index.nearestPointsWithinDistance(p, distance, 2, results);
+        const double nearestTime = nearestTimer.stop();
+        
+        printf("boost - distance %10f, points within distance %10lu, all of them %10f, nearest query for 2 %10f\n",
+               distance, inBox, boxTime, nearestTime);
+    }
+
+    std::cout << std::endl;
+}
+
+/* One set of r-tree parameters: packed build, lookups, and the insertions in the completed tree
+   (a batch at a time, each batch small enough not to rebuild the tree). */
+template<typename PARAMETERS>
+static void boostParametersTest(const char* name, const PARAMETERS& parameters) {
+    const std::vector<Point>& points = redMesh<1000000>();
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    std::vector<IndexAndSquaredDistance<Point> > results;
+    
+    PoorMansTimerString buildTimer;
+    BoostIndex<Point, PARAMETERS> index(parameters);
+    BuildIndex(points, index);
+    const double buildTime = buildTimer.stop();
+    
+    PoorMansTimerString lookupTimer;
+    for (const Point& p : greenPoints)
+        index.pointsWithinDistance(p, 30, results);
+    const double lookupTime = lookupTimer.stop();
+    
+    PoorMansTimerString nearestTimer;
+    for (const Point& p : greenPoints)
+        index.nearestPoints(p, 2, results);
+    const double nearestTime = nearestTimer.stop();
+    
+    const std::vector<Point>& morePoints = redMesh<200000>();
+    PoorMansTimerString insertTimer;
+    for (PointIndex i = 0; i < morePoints.size(); ++i) {
+        index.index(morePoints[i], points.size() + i);
+        if ((i + 1) % 10000 == 0)
+            index.completed();
+    }
+    const double insertTime = insertTimer.stop();
+    
+    printf("%-26s - Mesh size: %10lu, packed build %10f, 1000 lookups within 30 %10f, 1000 nearest 2 %10f, insert %lu more %10f\n",
+           name, points.size(), buildTime, lookupTime, nearestTime, morePoints.size(), insertTime);
+}
+
+TEST(PerformanceTest, parameters_boost) {
+    namespace bgi = boost::geometry::index;
+    // By algorithm, the same node fills for the compile time and the runtime parameters.
+    boostParametersTest("linear<16>", bgi::linear<16>());
+    boostParametersTest("linear<32>", bgi::linear<32>());
+    boostParametersTest("linear<64>", bgi::linear<64>());
+    boostParametersTest("dynamic_linear(16)", bgi::dynamic_linear(16));
+    boostParametersTest("dynamic_linear(32)", bgi::dynamic_linear(32));
+    boostParametersTest("dynamic_linear(64)", bgi::dynamic_linear(64));
+    
+    boostParametersTest("quadratic<16>", bgi::quadratic<16>());
+    boostParametersTest("quadratic<32>", bgi::quadratic<32>());
+    boostParametersTest("quadratic<64>", bgi::quadratic<64>());
+    boostParametersTest("dynamic_quadratic(16)", bgi::dynamic_quadratic(16));
+    boostParametersTest("dynamic_quadratic(32)", bgi::dynamic_quadratic(32));
+    boostParametersTest("dynamic_quadratic(64)", bgi::dynamic_quadratic(64));
+    
+    boostParametersTest("rstar<16>", bgi::rstar<16>());
+    boostParametersTest("rstar<32>", bgi::rstar<32>());
+    boostParametersTest("rstar<64>", bgi::rstar<64>());
+    boostParametersTest("dynamic_rstar(16)", bgi::dynamic_rstar(16));
+    boostParametersTest("dynamic_rstar(32)", bgi::dynamic_rstar(32));
+    boostParametersTest("dynamic_rstar(64)", bgi::dynamic_rstar(64));
+
+    std::cout << std::endl;
+}
+
+/* How long completed() takes for the trees, against sorting the points on one axis. */
+TEST(PerformanceTest, build_kdTree) {
+    for (const std::vector<Point>* points : {&redMesh<200000>(), &redMesh<1000000>()}) {
+        std::vector<double> xs;
+        for (const Point& p : *points)
+            xs.push_back(p.x);
+        PoorMansTimerString sortTimer;
+        std::sort(xs.begin(), xs.end());
+        const double sortTime = sortTimer.stop();
+        
+        KdTreeIndex<Point> kdTree(16, points->size());
+        OctreeIndex<Point> octree(32, points->size());
+        BoostIndex<Point> boost;
+        for (PointIndex i = 0; i < points->size(); ++i) {
+            kdTree.index((*points)[i], i);
+            octree.index((*points)[i], i);
+            boost.index((*points)[i], i);
+        }
+        PoorMansTimerString kdTreeTimer;
+        kdTree.completed();
+        const double kdTreeTime = kdTreeTimer.stop();
+        PoorMansTimerString octreeTimer;
+        octree.completed();
+        const double octreeTime = octreeTimer.stop();
+        PoorMansTimerString boostTimer;
+        boost.completed();
+        const double boostTime = boostTimer.stop();
+        
+        printf("Mesh size: %10lu, std::sort of x %10f, completed() kd-tree %10f, octree %10f, boost (packed) %10f\n",
+               points->size(), sortTime, kdTreeTime, octreeTime, boostTime);
+    }
+
+    std::cout << std::endl;
+}
+
+/* Bucket sizes of the kd-tree, for the lookups within a distance and for the nearest points. */
+TEST(PerformanceTest, bucketSize_kdTree) {
+    for (const size_t bucketSize : {4, 8, 16, 32, 64}) {
+        printf("bucket %2lu - ", bucketSize);
+        KdTreeIndex<Point> index(bucketSize);
+        multipleLookupTest(index, redMesh<200000>(), redMesh<1000>(), 30);
+        printf("bucket %2lu - ", bucketSize);
+        KdTreeIndex<Point> exact(bucketSize);
+        multipleExactLookupTest(exact, redMesh<200000>(), redMesh<1000>());
+    }
+
+    std::cout << std::endl;
+}
+
+template<typename INDEX>
+void curveOrderTest(const INDEX& emptyIndex, const std::vector<Point>& redMesh, const std::vector<Point>& greenMesh, double distance) {
+    static const size_t neededNearest = 2;
+    std::vector<Point> sortedGreenMesh;
+    for (const size_t position : SpaceFillingCurveOrder(greenMesh))
+        sortedGreenMesh.push_back(greenMesh[position]);
+
+    const char* names[] = {"input order", "morton", "hilbert"};
+    for (unsigned order = 0; order < 3; ++order) {
+        INDEX index(emptyIndex);
+        PoorMansTimerString buildTimer;
+        if (order == 0)
+            BuildIndex(redMesh, index);
+        else
+            BuildIndex(redMesh, index, order == 1 ? SpaceFillingCurve::morton : SpaceFillingCurve::hilbert);
+        const double build = buildTimer.stop();
+
+        std::vector<IndexAndSquaredDistance<Point> > results;
+        PoorMansTimerString lookupTimer;
+        for (const auto& p : greenMesh)
+            KNearestNeighbor(index, distance, p, neededNearest, results);
+        const double lookups = lookupTimer.stop();
+        PoorMansTimerString sortedLookupTimer;
+        for (const auto& p : sortedGreenMesh)
+            KNearestNeighbor(index, distance, p, neededNearest, results);
+        const double sortedLookups = sortedLookupTimer.stop();
+
+        printf("%12s: red mesh size %10lu, build %10f, lookups %10f, lookups in hilbert order %10f\n",
+               names[order], redMesh.size(), build, lookups, sortedLookups);
+    }
+}
+
+/* Adding the points in the order of a space filling curve, and looking them up in that order. */
+TEST(PerformanceTest, curveOrder) {
+    printf("no index\n");
+    curveOrderTest(NoIndex<Point>(), redMesh<200000>(), redMesh<1000>(), 30);
+    printf("cube\n");
+    curveOrderTest(CubeIndex<Point>(10), redMesh<1000000>(), redMesh<100000>(), 30);
+    printf("aabb\n");
+    curveOrderTest(AabbIndex<Point>(), redMesh<1000000>(), redMesh<10000>(), 30);
+
+    std::cout << std::endl;
+}
+
+/* Memory of the permutations and of the indices, plain or bit packed, and what it does to the lookups. */
+TEST(PerformanceTest, compactStorage_aabbWithPermutation) {
+    const std::vector<Point>& points = redMesh<1000000>();
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    for (const IntegerStorage storage : {IntegerStorage::wide, IntegerStorage::compact}) {
+        PermutationAabbIndex<Point> index(points.size(), storage);
+        BuildIndex(points, index);
+        
+        std::vector<IndexAndSquaredDistance<Point> > results;
+        size_t found = 0;
+        PoorMansTimerString timer;
+        for (const Point& green : greenPoints) {
+            index.pointsWithinDistance(green, 100, results);
+            found += results.size();
+        }
+        const double time = timer.stop();
+        
+        printf("%8s - Mesh size: %20lu, memory %10.1f MB, %lu lookups, points found %10lu, time %20f\n",
+               storage == IntegerStorage::wide ? "wide" : "compact", points.size(), index.memoryUsage() / 1048576.0,
+               greenPoints.size(), found, time);
+    }
+
+    std::cout << std::endl;
+}
+
+/* A deforming mesh: move 1% of the points, instead of building the index again. */
+TEST(PerformanceTest, movePoints_cube) {
+    const std::vector<Point>& points = redMesh<1000000>();
+    
+    PoorMansTimerString tBuild;
+    CubeIndex<Point> index(10);
+    BuildIndex(points, index);
+    const double build = tBuild.stop();
+    
+    index.move(0, points[0]);  // The first update maps every point to its cube.
+    
+    for (int round = 0; round < 3; ++round) {
+        const double shift = round + 1;
+        PoorMansTimerString tMove;
+        for (PointIndex i = 0; i < points.size(); i += 100)
+            index.move(i, Point{points[i].x + shift, points[i].y - shift, points[i].z + shift});
+        const double move = tMove.stop();
+        
+        PoorMansTimerString tPack;
+        index.completed();
+        const double pack = tPack.stop();
+        
+        printf("Mesh size: %20lu, build %20f, moving 1%% of the points %20f, packing after that %20f\n",
+               points.size(), build, move, pack);
+    }
+
+    std::cout << std::endl;
+}
+
+/* Some threads look up while another one adds points and publishes them, a batch at a time. No locks at all:
+ * each lookup reads the version counter, and a reader loads the new snapshot only once per batch. */
+TEST(PerformanceTest, concurrentLookups_cube) {
+    const std::vector<Point>& redPoints = redMesh<200000>();
+    const std::vector<Point>& greenPoints = redMesh<1000>();
+    static const size_t batchSize = 10000;
+    static const size_t readers = 4;
+    
+    ConcurrentCubeIndex<Point> index(10);
+    std::atomic<bool> writing(true);
+    std::vector<size_t> lookups(readers, 0);
+    
+    std::vector<std::thread> readerThreads;
+    for (size_t r = 0; r < readers; ++r)
+        readerThreads.emplace_back([&, r]() {
+            std::vector<IndexAndSquaredDistance<Point> > results;
+            for (size_t g = 0; writing; g = (g + 1) % greenPoints.size(), ++lookups[r])
+                KNearestNeighbor(index, 30.0, greenPoints[g], 2, results);
+        });
+    
+    PoorMansTimerString t;
+    for (PointIndex i = 0; i < redPoints.size(); ++i) {
+        index.index(redPoints[i], i);
+        if ((i + 1) % batchSize == 0)
+            index.completed();
+    }
+    index.completed();
+    const double elapsed = t.stop();  // Processor time of all the threads.
+    writing = false;
+    for (auto& reader : readerThreads)
+        reader.join();
+    
+    size_t totalLookups = 0;
+    for (size_t l : lookups)
+        totalLookups += l;
+    printf("Red mesh size: %20lu, batches of %20lu, lookups while writing %20lu, time %20f\n",
+           redPoints.size(), batchSize, totalLookups, elapsed);
+
+    std::cout << std::endl;
+}
+
+TEST(PerformanceTest, multipleLookups_noCullingDistance) {
+    { 
+        printf ("cube - ");
+        CubeIndex<Point> index(10);
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+    { 
+        printf ("cube, bigger cubes - ");
+        CubeIndex<Point> index(50);
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+    { 
+        printf ("cube, suggested side - ");
+        CubeSideHints<Point> hints;
+        hints.neighbors = 2;
+        CubeIndex<Point> index(SuggestCubeSide(redMesh<200000>(), hints));
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+    { 
+        printf ("octree - ");
+        OctreeIndex<Point> index;
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+    { 
+        printf ("kd-tree - ");
+        KdTreeIndex<Point> index;
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+    { 
+        printf ("boost - ");
+        BoostIndex<Point> index;
+        multipleExactLookupTest(index, redMesh<200000>(), redMesh<1000>());
+    }
+
+    std::cout << std::endl;
+}
+
 }
@@ -4,92 +4,145 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
-#include <numeric>
-#include <unordered_map>
+#include <cmath>
 
 #include "Common.hpp"
+#include "RadixSort.hpp"
+#include "WorkerPool.hpp"
+#include "WaveletMatrix.hpp"
+#include "BitPackedVector.hpp"
 
 namespace geoIndex {
     
  
-  /** Variation on the AABB index that uses a different structure to store the position of the points.
-   *  It uses 3 arrays for the point coordinates, sorted by coordinates.
-   *  Then it uses 3 more arrays to store the permutation that gives the point index for each of the other 
-   *  arrays.
+  /** Variation on the AABB index that answers the box queries in "rank space", with wavelet matrices.
+   *  The permutations and the grids are those of "Compact Data Strucutres, a practical approach" (by Gonzalo Navarro),
+   *  section 5.4.1 (permutations) and 10.1 (grids). The grids there are 2D: this is not a 3D structure, only three
+   *  2D grids, one per pair of axes.
    * 
-   * Inspired by the much, much more optimized data structure in "Compact Data Strucutres, a practical approach"
-   * (by Gonzalo Navarro). See its section 5.4.1.
+   *  The coordinates stay in the order the points were indexed. For each axis there is a permutation: the points
+   *  in the order of their coordinate on that axis (the rank of a point on the axis is its place in there).
+   *  A box of coordinates becomes a box of ranks with two binary searches per axis.
+   *  Then, for each axis a, a wavelet matrix over the ranks on the next axis (b), in the order of a: a grid with one
+   *  point per row and column. It counts, or lists, the points in a rectangle of ranks on a and b in O(log n) time
+   *  (per listed point). 
    * 
-   * It's still rubbish, but that's likely to be my fault. It was worth an attempt, but it did not work as hoped.
+   *  A lookup counts the points in the rectangles of the three pairs of axes, then lists those in the smallest one
+   *  and tests their distance. The third coordinate is not in the grid: it is filtered afterwards, with the distance.
+   *  So a lookup costs O(log n) per point in the 2D rectangle, i.e. in the column of the box along the third axis,
+   *  from one side of the points to the other; not per point in the box. That is less than a slab (the AABB index
+   *  scans a 1D slab), but a lot more than the box where the points are spread in depth along all three axes.
+   *  A true 3D range reporting (e. g. a range tree of wavelet matrices) would cost another log n factor of memory.
+   *  Each wavelet matrix takes n log n bits.
+   *
+   *  The permutations and the point indices can be bit packed (IntegerStorage::compact): log n bits per position
+   *  instead of 32 or 64, and as many bits as the biggest point index needs.
+   *
+   *  Points added after completed() stay at the end of the coordinate arrays, out of the permutations (the delta): 
+   *  the lookups check all of them. When the delta gets as big as the rest, the structure is built again with 
+   *  all the points: each build at least doubles the points in there, so it costs O(log n) amortized per point.
    */
 template <typename POINT>
 class PermutationAabbIndex {
 public:
     
     /** If you know how many points you are going to use, tell it to this constructor to 
-    *  reserve memory. */
-    PermutationAabbIndex(const size_t expectedCollectionSize = 0) {
+    *  reserve memory. With IntegerStorage::compact the positions and the indices are bit packed. */
+    PermutationAabbIndex(const size_t expectedCollectionSize = 0,
+                         const IntegerStorage storage = IntegerStorage::wide) :
+        storage(storage)
+    {
         coordinatesX.reserve(expectedCollectionSize);
         coordinatesY.reserve(expectedCollectionSize);
         coordinatesZ.reserve(expectedCollectionSize);
         
-        permuatationX.reserve(expectedCollectionSize);
-        permuatationY.reserve(expectedCollectionSize);
-        permuatationZ.reserve(expectedCollectionSize);
-        
-        #ifdef GEO_INDEX_SAFETY_CHECKS
-            // There is nothing in the index, so it is sorted (you can't misplace... nothing). You can do lookups.
-            readyForLookups = true;
-        #endif
+        sortedCount = 0;
     }
     
     
-    /** Adds a point to the index. Remember its name too. */
+    /** Adds a point to the index. Remember its name too. The point can be found right away. */
     void index(const POINT& p, const typename PointTraits<POINT>::index index){
         #ifdef GEO_INDEX_SAFETY_CHECKS
-            // Adding points probably breaks the order. Use X indexes for the check, y and z are equal at this stage.
-            readyForLookups = false;
-            
-            if (std::find(begin(indices), end(indices), index)
-                    != end(indices))
+            if (std::find(begin(deltaIndices), end(deltaIndices), index) != end(deltaIndices))
                 throw std::runtime_error("Point indexed twice");
+            for (size_t position = 0; position < sortedCount; ++position)
+                if (static_cast<typename PointTraits<POINT>::index>(sortedIndices[position]) == index)
+                    throw std::runtime_error("Point indexed twice");
         #endif
             
        coordinatesX.push_back(p.x);
        coordinatesY.push_back(p.y);
        coordinatesZ.push_back(p.z);
        
-       indices.push_back(index);
+       deltaIndices.push_back(index);
        
-       // Just make sure the permutation vectors grow as much as the coordinates vectors.
-       // Values are to be calculated later on.
-       permuatationX.push_back(0);
-       permuatationY.push_back(0);
-       permuatationZ.push_back(0);
+       if (deltaIndices.size() > maximumDeltaSize())
+           completed();
     }
     
     
-    /** "Close" the index and allows lookups.
-     *   Basically, sort its entries. It is best done "once and forever" as testing proves it can be a significant bottleneck.
-     *   If the user forgets to call it he will get garbage results.
+    /** Builds the permutations and the wavelet matrices again, with the points added since the last call.
+     *   Lookups are correct without it too, but they check every point of the delta.
      */
     void completed() {
-        std::iota(std::begin(permuatationX), std::end(permuatationX), 0);
-        std::copy(std::begin(permuatationX), std::end(permuatationX), std::begin(permuatationY));
-        std::copy(std::begin(permuatationX), std::end(permuatationX), std::begin(permuatationZ));
-                
-        permutationIndex(coordinatesX, permuatationX);
-        permutationIndex(coordinatesY, permuatationY);
-        permutationIndex(coordinatesZ, permuatationZ);
+        WorkerPool justThisThread(1);
+        completed(justThisThread);
+    }
+    
+    /** Same as above, with the help of some threads. Radix sort on the bits of the coordinates, the three axes
+     *  in the same passes sharing all the workers; then the grids are built one axis per worker. */
+    void completed(WorkerPool& workers) {
+        if (deltaIndices.empty())
+            return;
         
+        const size_t count = coordinatesX.size();
+        std::vector<size_t> order[3];
+        RadixSortedPositionsOfEach(std::vector<const std::vector<typename PointTraits<POINT>::coordinate>*>{&coordinatesX, &coordinatesY, &coordinatesZ},
+                                   std::vector<std::vector<size_t>*>{&order[0], &order[1], &order[2]},
+                                   workers);
         
-        std::sort(std::begin(coordinatesX), std::end(coordinatesX));
-        std::sort(std::begin(coordinatesY), std::end(coordinatesY));
-        std::sort(std::begin(coordinatesZ), std::end(coordinatesZ));
+        std::vector<size_t> rankOfPosition[3];
+        workers.run(3, [count, &order, &rankOfPosition](const size_t axis) {
+            rankOfPosition[axis].resize(count);
+            for (size_t rank = 0; rank < count; ++rank)
+                rankOfPosition[axis][order[axis][rank]] = rank;
+        });
         
-        #ifdef GEO_INDEX_SAFETY_CHECKS
-            readyForLookups = true;
-        #endif
+        const unsigned rankBits = std::max(1u, BitsToRepresent(count - 1));
+        const unsigned positionBits = BitPackedVector::BitsFor(count - 1, storage);
+        workers.run(3, [this, count, rankBits, positionBits, &order, &rankOfPosition](const size_t axis) {
+            const std::vector<size_t>& rankOnNextAxis = rankOfPosition[(axis + 1) % 3];
+            if (rankBits <= 32) {
+                // Half the memory to move around while building.
+                std::vector<uint32_t> ranks(count);
+                for (size_t rank = 0; rank < count; ++rank)
+                    ranks[rank] = static_cast<uint32_t>(rankOnNextAxis[order[axis][rank]]);
+                grids[axis] = WaveletMatrix(ranks, rankBits);
+            } else {
+                std::vector<size_t> ranks(count);
+                for (size_t rank = 0; rank < count; ++rank)
+                    ranks[rank] = rankOnNextAxis[order[axis][rank]];
+                grids[axis] = WaveletMatrix(ranks, rankBits);
+            }
+            
+            permutations[axis] = BitPackedVector(count, positionBits);
+            for (size_t rank = 0; rank < count; ++rank)
+                permutations[axis].set(rank, order[axis][rank]);
+        });
+        
+        packIndices();
+        sortedCount = count;
+    }
+    
+    /** Bytes taken by the index (the memory reserved in advance included). */
+    size_t memoryUsage() const {
+        size_t bytes = (coordinatesX.capacity() + coordinatesY.capacity() + coordinatesZ.capacity()) * 
+                            sizeof(typename PointTraits<POINT>::coordinate) +
+                       deltaIndices.capacity() * sizeof(typename PointTraits<POINT>::index) +
+                       sortedIndices.memoryUsage();
+        for (size_t axis = 0; axis < 3; ++axis)
+            bytes += permutations[axis].memoryUsage() + grids[axis].memoryUsage();
+        return bytes;
     }
     
     /** Finds the points that are within distance d from p. Cleans the output vector before filling it.
@@ -106,125 +159,232 @@ public:
     {
         #ifdef GEO_INDEX_SAFETY_CHECKS
             CheckMeaningfulDistance(d);
-            if (! readyForLookups)
-                throw std::runtime_error("Index not ready. Did you call completed() after the last call to index(...)?");
         #endif
         
-        // Count if the point is present in all the 3 sets of candidates, assuming the sets are
-        // sparse, much less than the whole amount of points.
-        std::unordered_map<typename PointTraits<POINT>::index, uint8_t> hitsPerIndex;
-        std::unordered_map<typename PointTraits<POINT>::index, POINT> candidatePoints;
-            
-        const auto extremesOnX = candidatesOnDimension(coordinatesX, d, p.x);
-        const auto extremesOnY = candidatesOnDimension(coordinatesY, d, p.y);
-        const auto extremesOnZ = candidatesOnDimension(coordinatesZ, d, p.z);
-        
-        // We know the points between the extremes on X may be good.
-        // Now we fetch their index, then look into Y and Z by index.
-        for (size_t point = extremesOnX.first; point < extremesOnX.second; ++point)
-        {
-            const auto indexOfPoint = indices[permuatationX[point]];
-            hitsPerIndex[indexOfPoint] = 1;
-            candidatePoints[indexOfPoint] = POINT{coordinatesX[point], 0, 0};
-        }
-        
-        for (size_t point = extremesOnY.first; point < extremesOnY.second; ++point)
-        {
-            const auto indexOfPoint = indices[permuatationY[point]];
-            if (hitsPerIndex.find(indexOfPoint) != std::end(hitsPerIndex))
-            {
-                hitsPerIndex[indexOfPoint] += 1;
-                candidatePoints[indexOfPoint].y = coordinatesY[point];
-            }
-        }
-        
-        for (size_t point = extremesOnZ.first; point < extremesOnZ.second; ++point)
-        {
-            const auto indexOfPoint = indices[permuatationZ[point]];
-            if (hitsPerIndex.find(indexOfPoint) != std::end(hitsPerIndex))
-            {
-                hitsPerIndex[indexOfPoint] += 1;
-                candidatePoints[indexOfPoint].z = coordinatesZ[point];
-            }
-        }
-        
         const typename PointTraits<POINT>::coordinate referenceSquareDistance = d * d; 
         #ifdef GEO_INDEX_SAFETY_CHECKS
             CheckOverflow(referenceSquareDistance);
         #endif
        
         output.clear();
-        for (const auto& candidatePoint : candidatePoints)
-        {
-            const auto pointIndex = candidatePoint.first;
-            if (hitsPerIndex[pointIndex] == 3) // Point found in all the 3 candidate sets.
-            {
-                const auto candidateSquareDistance = SquaredDistance(p, candidatePoint.second);
-                if (candidateSquareDistance < referenceSquareDistance)
-                    output.push_back({pointIndex, candidateSquareDistance});
-            }
-        }
+        visitPointsInAabb(p, d, [&](const typename PointTraits<POINT>::index pointIndex,
+                                    const typename PointTraits<POINT>::coordinate candidateSquareDistance) {
+            if (candidateSquareDistance < referenceSquareDistance)
+                output.push_back({pointIndex, candidateSquareDistance});
+        });
         
         // Don't forget we have to give the closests point first.
         std::sort(std::begin(output), std::end(output), SortByGeometry<POINT>);
     }
     
+    /** Finds the k points closest to p, but only among those within distance d from p.
+     *  Same output as pointsWithinDistance cut after the first k elements, without sorting all the points in the AABB.
+     *  May return less than k points, if there are not enough within d.
+     *
+     *  The wavelet matrices report a whole box at once, so the box grows instead: it starts where k points would be
+     *  if they were spread evenly in the bounding box of the points, and doubles its side until the k-th candidate
+     *  is closer than the side of the box (no point out of it can be closer) or the box reaches d. A box is only
+     *  reported if it holds at least k points, its count is a few rank queries. With a d much bigger than the 
+     *  distance of the k-th point the cost follows the points near the reference, not those within d.
+     */
+    void nearestPointsWithinDistance(const POINT& p, 
+                                     const typename PointTraits<POINT>::coordinate d,
+                                     const size_t k,
+                                     std::vector<IndexAndSquaredDistance<POINT> >& output) const 
+    {
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckMeaningfulDistance(d);
+        #endif
+        
+        const typename PointTraits<POINT>::coordinate referenceSquareDistance = d * d; 
+        #ifdef GEO_INDEX_SAFETY_CHECKS
+            CheckOverflow(referenceSquareDistance);
+        #endif
+        
+        // The k nearest of the delta, once: it has no box, all its points are checked.
+        std::vector<IndexAndSquaredDistance<POINT> > nearestInDelta;
+        KNearestCandidates<POINT> inDelta(k, referenceSquareDistance, nearestInDelta);
+        visitDelta(p, [&inDelta](const typename PointTraits<POINT>::index pointIndex,
+                                 const typename PointTraits<POINT>::coordinate candidateSquareDistance) {
+            inDelta.offer(pointIndex, candidateSquareDistance);
+        });
+        
+        for (typename PointTraits<POINT>::coordinate halfSide = firstHalfSide(k, d); ; halfSide *= 2) {
+            const bool lastBox = ! (halfSide < d);
+            const RankBox box = rankBox(p, lastBox ? d : halfSide);
+            if (! lastBox && box.count + nearestInDelta.size() < k)
+                continue;  // Not enough points yet, no need to list them.
+            
+            KNearestCandidates<POINT> nearest(k, referenceSquareDistance, output);
+            for (const auto& candidate : nearestInDelta)
+                nearest.offer(candidate.pointIndex, candidate.geometricValue);
+            visitPointsInRankBox(p, box, [&nearest](const typename PointTraits<POINT>::index pointIndex,
+                                                    const typename PointTraits<POINT>::coordinate candidateSquareDistance) {
+                nearest.offer(pointIndex, candidateSquareDistance);
+            });
+            
+            // The points out of the box are at least halfSide away.
+            if (lastBox || nearest.squaredLimit() <= halfSide * halfSide) {
+                nearest.sort();
+                return;
+            }
+        }
+    }
+    
 private:
+    // The points, in the order they were indexed.
     std::vector<typename PointTraits<POINT>::coordinate> coordinatesX;
     std::vector<typename PointTraits<POINT>::coordinate> coordinatesY;
     std::vector<typename PointTraits<POINT>::coordinate> coordinatesZ;
     
-    std::vector<size_t> permuatationX;
-    std::vector<size_t> permuatationY;
-    std::vector<size_t> permuatationZ;
+    IntegerStorage storage;
     
-    std::vector<typename PointTraits<POINT>::index> indices;
+    /** The indices of the first sortedCount points, then those of the delta. */
+    BitPackedVector sortedIndices;
+    std::vector<typename PointTraits<POINT>::index> deltaIndices;
     
-    #ifdef GEO_INDEX_SAFETY_CHECKS
-        bool readyForLookups;
-    #endif
+    /** For x, y and z: the positions of the first sortedCount points, in the order of that coordinate. */
+    BitPackedVector permutations[3];
+    
+    /** For each axis, the ranks on the next axis (y for x, z for y, x for z) in the order of this axis. */
+    WaveletMatrix grids[3];
+    
+    size_t sortedCount;  ///< The points after these are the delta, not in the permutations yet.
+    
+    /** Below this size the delta is always cheap to check. */
+    static const size_t minimumMergeSize = 1024;
+    
+    size_t maximumDeltaSize() const {
+        return sortedCount > minimumMergeSize ? sortedCount : minimumMergeSize;
+    }
   
+    
+    /** Moves the indices of the delta after the others, all packed with the bits they need. */
+    void packIndices() {
+        uint64_t maxIndex = 0;
+        for (size_t position = 0; position < sortedCount; ++position)
+            maxIndex = std::max<uint64_t>(maxIndex, sortedIndices[position]);
+        for (const auto index : deltaIndices)
+            maxIndex = std::max<uint64_t>(maxIndex, static_cast<uint64_t>(index));
         
-    /** Shuffle the positions so that it gets permutated just like the coordinate vector would be
-        if it is sorted. Acts on the indexes in place.
+        BitPackedVector packed(sortedCount + deltaIndices.size(), BitPackedVector::BitsFor(maxIndex, storage));
+        for (size_t position = 0; position < sortedCount; ++position)
+            packed.set(position, sortedIndices[position]);
+        for (size_t i = 0; i < deltaIndices.size(); ++i)
+            packed.set(sortedCount + i, static_cast<uint64_t>(deltaIndices[i]));
         
-        Rip off of https://stackoverflow.com/questions/17554242/how-to-obtain-the-index-permutation-after-the-sorting
-    */
-    static void permutationIndex(const std::vector<typename PointTraits<POINT>::coordinate>& coordinates,
-                                 std::vector<size_t>& positions)
-    {
-        std::sort(std::begin(positions), std::end(positions),
-            [&](const size_t& a, const size_t& b) {
-                return (coordinates[a] < coordinates[b]);
-            });
+        sortedIndices = std::move(packed);
+        deltaIndices.clear();
+    }
+    
+    /** The rank of the first point (among the sorted ones) whose coordinate on the axis is not less than the value. */
+    size_t firstRankNotBelow(const size_t axis, const typename PointTraits<POINT>::coordinate value) const {
+        const std::vector<typename PointTraits<POINT>::coordinate>* coordinates[3] = {&coordinatesX, &coordinatesY, &coordinatesZ};
+        const std::vector<typename PointTraits<POINT>::coordinate>& onAxis = *coordinates[axis];
+        const BitPackedVector& permutation = permutations[axis];
+        
+        size_t low = 0;
+        size_t high = sortedCount;
+        while (low < high) {
+            const size_t middle = low + (high - low) / 2;
+            if (onAxis[permutation[middle]] < value)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
     }
-   
-
        
-    /** Scan the given index and returns the position in the array of the "extreme" points that 
-        mark the begin and "past end" of the desired points.*/
-    std::pair<size_t, size_t>
-    candidatesOnDimension(const std::vector<typename PointTraits<POINT>::coordinate>& indexForDimension,
-                          const typename PointTraits<POINT>::coordinate searchDistance,
-                          const typename PointTraits<POINT>::coordinate referenceCoordnate) const 
-    {
-        const typename PointTraits<POINT>::coordinate minAcceptedCoordinate = referenceCoordnate - searchDistance;
-        const typename PointTraits<POINT>::coordinate maxAcceptedCoordinate = referenceCoordnate + searchDistance;
-
-        const auto beginCandidates = std::lower_bound(std::begin(indexForDimension),
-                                                      std::end(indexForDimension),
-                                                      minAcceptedCoordinate);
+    /** The AABB of side 2d around p in rank space, [c - d, c + d) on each axis, with the pair of axes whose
+     *  rectangle has less points (the candidates). */
+    struct RankBox {
+        size_t firstRank[3];
+        size_t endRank[3];
+        size_t bestAxis;
+        size_t count;  ///< Of points in the rectangle of the best pair of axes.
+    };
+    
+    RankBox rankBox(const POINT& p, const typename PointTraits<POINT>::coordinate d) const {
+        RankBox box{{0, 0, 0}, {0, 0, 0}, 0, 0};
+        if (sortedCount == 0)
+            return box;
         
-        const auto endCandidates = std::lower_bound(beginCandidates,  // the bigger values must be after, skip some elements.
-                                                    std::end(indexForDimension),
-                                                    maxAcceptedCoordinate);
+        const typename PointTraits<POINT>::coordinate center[3] = {p.x, p.y, p.z};
+        for (size_t axis = 0; axis < 3; ++axis) {
+            box.firstRank[axis] = firstRankNotBelow(axis, center[axis] - d);
+            box.endRank[axis] = firstRankNotBelow(axis, center[axis] + d);
+        }
+        
+        for (size_t axis = 0; axis < 3; ++axis) {
+            const size_t nextAxis = (axis + 1) % 3;
+            const size_t count = grids[axis].count(box.firstRank[axis], box.endRank[axis], 
+                                                   box.firstRank[nextAxis], box.endRank[nextAxis]);
+            if (axis == 0 || count < box.count) {
+                box.bestAxis = axis;
+                box.count = count;
+            }
+        }
+        return box;
+    }
+    
+    /** Half the side of the first box of nearestPointsWithinDistance: the one that would have k points if they were
+     *  spread evenly in the bounding box of the sorted points (taken as a cube on its longest side). */
+    typename PointTraits<POINT>::coordinate firstHalfSide(const size_t k, 
+                                                          const typename PointTraits<POINT>::coordinate d) const {
+        if (sortedCount == 0 || k >= sortedCount)
+            return d;
         
-        const size_t positionFirstGoodPoint = std::distance(begin(indexForDimension), beginCandidates);
-        const size_t positionPastLastPoint = std::distance(begin(indexForDimension), endCandidates);
-        return std::make_pair(positionFirstGoodPoint, positionPastLastPoint);
+        const std::vector<typename PointTraits<POINT>::coordinate>* coordinates[3] = {&coordinatesX, &coordinatesY, &coordinatesZ};
+        double side = 0;
+        for (size_t axis = 0; axis < 3; ++axis) {
+            const std::vector<typename PointTraits<POINT>::coordinate>& onAxis = *coordinates[axis];
+            const double extent = static_cast<double>(onAxis[permutations[axis][sortedCount - 1]]) - 
+                                  static_cast<double>(onAxis[permutations[axis][0]]);
+            side = std::max(side, extent);
+        }
         
-    }    
-
+        const auto halfSide = static_cast<typename PointTraits<POINT>::coordinate>(
+            side * std::cbrt(static_cast<double>(k) / static_cast<double>(sortedCount)) / 2);
+        return halfSide > 0 ? halfSide : d;  // All the points in one place, or integer coordinates rounded to 0.
+    }
+    
+    /** Calls visitor(point index, squared distance from p) for the sorted points in the rectangle of the best pair
+     *  of axes of the box. Some may be out of the box on the third axis: the distance tells. */
+    template <typename VISITOR>
+    void visitPointsInRankBox(const POINT& p, const RankBox& box, VISITOR visitor) const {
+        if (box.count == 0)
+            return;
+        
+        const size_t nextAxis = (box.bestAxis + 1) % 3;
+        const BitPackedVector& permutationOfNextAxis = permutations[nextAxis];
+        const auto visitCandidate = [&](const uint64_t rankOnNextAxis, const size_t) {
+            const size_t position = permutationOfNextAxis[rankOnNextAxis];
+            visitor(static_cast<typename PointTraits<POINT>::index>(sortedIndices[position]), 
+                    SquaredDistance(p, POINT{coordinatesX[position], coordinatesY[position], coordinatesZ[position]}));
+        };
+        grids[box.bestAxis].report(box.firstRank[box.bestAxis], box.endRank[box.bestAxis], 
+                                   box.firstRank[nextAxis], box.endRank[nextAxis],
+                                   visitCandidate);
+    }
+    
+    /** Calls visitor(point index, squared distance from p) for all the points of the delta: it is not sorted. */
+    template <typename VISITOR>
+    void visitDelta(const POINT& p, VISITOR visitor) const {
+        for (size_t point = sortedCount; point < coordinatesX.size(); ++point)
+            visitor(deltaIndices[point - sortedCount], 
+                    SquaredDistance(p, POINT{coordinatesX[point], coordinatesY[point], coordinatesZ[point]}));
+    }
+    
+    /** Calls visitor(point index, squared distance from p) for all the points inside the AABB of side 2d around p,
+     *  and for all the points in the delta. */
+    template <typename VISITOR>
+    void visitPointsInAabb(const POINT& p, 
+                           const typename PointTraits<POINT>::coordinate d,
+                           VISITOR visitor) const
+    {
+        visitPointsInRankBox(p, rankBox(p, d), visitor);
+        visitDelta(p, visitor);
+    }
     
 };
   
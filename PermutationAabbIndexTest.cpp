@@ -3,6 +3,9 @@
 #include "PermutationAabbIndex.hpp"
 
 #include "TestsForAllIndexes.hpp"
+#include "NoIndex.hpp"
+
+#include <vector>
 
 namespace geoIndex {
 
@@ -48,6 +51,21 @@ TEST(PermutationAabbIndex, pointsWithinDistance_squareDistance) {
     pointsWithinDistance_squareDistance(index);
 }
 
+TEST(PermutationAabbIndex, nearestPointsWithinDistance_closestK) {
+    PermutationAabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_closestK(index);
+}
+
+TEST(PermutationAabbIndex, nearestPointsWithinDistance_lessThanK) {
+    PermutationAabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_lessThanK(index);
+}
+
+TEST(PermutationAabbIndex, nearestPointsWithinDistance_sameAsPointsWithinDistance) {
+    PermutationAabbIndex<Point> index(expectedIndexSize);
+    nearestPointsWithinDistance_sameAsPointsWithinDistance(index);
+}
+
 
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(PermutationAabbIndex, index_duplicatedIndex) {
@@ -97,6 +115,92 @@ TEST(PermutationAabbIndex, pointsWithinDistance_aabbBoundaries) {
     ASSERT_INDEX_PRESENT(result, 2);
 }
     
+TEST(PermutationAabbIndex, completed_withWorkers) {
+    for (const size_t threads : {1, 2, 4}) {
+        WorkerPool workers(threads);
+        PermutationAabbIndex<Point> withWorkers;
+        PermutationAabbIndex<Point> alone;
+        for (PointIndex i = 0; i < 1000; ++i) {
+            const Point p{static_cast<double>(i % 10) - 5, static_cast<double>((i / 10) % 10) - 5, static_cast<double>(i / 100) - 5};
+            withWorkers.index(p, i);
+            alone.index(p, i);
+        }
+        withWorkers.completed(workers);
+        alone.completed();
+        
+        std::vector<IndexAndSquaredDistance<Point>> expected;
+        std::vector<IndexAndSquaredDistance<Point>> result;
+        alone.pointsWithinDistance(Point{-1, 0, 1}, 2.5, expected);
+        withWorkers.pointsWithinDistance(Point{-1, 0, 1}, 2.5, result);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(expected.size(), result.size());
+        for (size_t r = 0; r < result.size(); ++r)
+            ASSERT_EQ(expected[r].geometricValue, result[r].geometricValue);
+    }
+}
+
+TEST(PermutationAabbIndex, compactStorage_sameAsWide) {
+    PermutationAabbIndex<Point> wide(0, IntegerStorage::wide);
+    PermutationAabbIndex<Point> compact(0, IntegerStorage::compact);
+    for (PointIndex i = 0; i < 5000; ++i) {
+        const Point p{static_cast<double>(i % 17), static_cast<double>(i % 23), static_cast<double>(i % 29)};
+        wide.index(p, i * 1000);  // Indices that need more bits than the positions.
+        compact.index(p, i * 1000);
+    }
+    wide.completed();
+    compact.completed();
+    
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    for (double x = 0; x < 17; x += 2.5) {
+        wide.pointsWithinDistance(Point{x, 11, 14}, 3, expected);
+        compact.pointsWithinDistance(Point{x, 11, 14}, 3, result);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(expected.size(), result.size());
+        for (const auto& hit : expected)
+            ASSERT_INDEX_PRESENT(result, hit.pointIndex);
+    }
+    
+    ASSERT_LT(compact.memoryUsage(), wide.memoryUsage());
+}
+
+TEST(PermutationAabbIndex, nearestPointsWithinDistance_growingBoxes) {
+    // A dense cluster, a flat sheet and some lone points: the first box is too small here, too big there.
+    // The distance covers everything, only the growing boxes keep the search near the reference.
+    NoIndex<Point> reference;
+    PermutationAabbIndex<Point> gi;
+    PointIndex i = 0;
+    for (; i < 3000; ++i) {
+        const Point p = i % 2 == 0 ? Point{static_cast<double>(i % 13) * 0.01, static_cast<double>(i % 7) * 0.01, static_cast<double>(i % 5) * 0.01}
+                                   : Point{static_cast<double>(i % 41) * 2 + 50, static_cast<double>(i % 37) * 2, 20};
+        reference.index(p, i);
+        gi.index(p, i);
+    }
+    for (; i < 3010; ++i) {
+        const Point p{static_cast<double>(i) * 10 - 30000, -100, 300};
+        reference.index(p, i);
+        gi.index(p, i);
+    }
+    gi.completed();
+    for (; i < 3100; ++i) {  // Some in the delta too.
+        const Point p{static_cast<double>(i % 11), static_cast<double>(i % 3) + 30, 10};
+        reference.index(p, i);
+        gi.index(p, i);
+    }
+    
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    const std::vector<Point> lookups{{0, 0, 0}, {100, 40, 20}, {5, 31, 10}, {-500, -100, 300}, {1000, 1000, 1000}};
+    for (const Point& lookup : lookups)
+        for (const size_t k : {1, 5, 40, 3200}) {
+            reference.nearestPointsWithinDistance(lookup, 1e6, k, expected);
+            gi.nearestPointsWithinDistance(lookup, 1e6, k, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t r = 0; r < result.size(); ++r)
+                ASSERT_NEAR(expected[r].geometricValue, result[r].geometricValue, 1e-9 * (1 + expected[r].geometricValue));
+        }
+}
+
 #ifdef GEO_INDEX_SAFETY_CHECKS
 TEST(PermutationAabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupOfNothing) {
     const Point anyPoint{1, 55, 2};
@@ -106,19 +210,22 @@ TEST(PermutationAabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupOfNo
     std::vector<IndexAndSquaredDistance<Point>> result;
     ASSERT_NO_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
 }
+#endif
 
-TEST(PermutationAabbIndex, pointsWithinDistance_incorrectOrderOfUsage_lookupWithoutPreparation) {
+TEST(PermutationAabbIndex, pointsWithinDistance_lookupWithoutPreparation) {
     const Point anyPoint{1, 55, 2};
   
     PermutationAabbIndex<Point> gi;
     gi.index(anyPoint, 1);
-    // No call to completed();
+    // No call to completed(): the point is found anyway.
     
     std::vector<IndexAndSquaredDistance<Point>> result;
-    ASSERT_ANY_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(1, result.at(0).pointIndex);
 }
 
-TEST(PermutationAabbIndex, pointsWithinDistance_incorrectOrderOfUsage_addPointsAfterCompletition) {
+TEST(PermutationAabbIndex, pointsWithinDistance_addPointsAfterCompletition) {
     const Point anyPoint{1, 55, 2};
   
     PermutationAabbIndex<Point> gi;
@@ -127,8 +234,43 @@ TEST(PermutationAabbIndex, pointsWithinDistance_incorrectOrderOfUsage_addPointsA
     gi.index(anyPoint, 2);
     
     std::vector<IndexAndSquaredDistance<Point>> result;
-    ASSERT_ANY_THROW(gi.pointsWithinDistance(anyPoint, 0.01, result));
+    gi.pointsWithinDistance(anyPoint, 0.01, result);
+    ASSERT_EQ(2, result.size());
+    ASSERT_INDEX_PRESENT(result, 1);
+    ASSERT_INDEX_PRESENT(result, 2);
+}
+
+TEST(PermutationAabbIndex, index_streaming) {
+    // Lookups between the additions, never calling completed(): the points end up in runs of many sizes.
+    NoIndex<Point> reference;
+    PermutationAabbIndex<Point> gi;
+    std::vector<IndexAndSquaredDistance<Point>> expected;
+    std::vector<IndexAndSquaredDistance<Point>> result;
+    for (PointIndex i = 0; i < 20000; ++i) {
+        const Point p{static_cast<double>(i % 37), static_cast<double>(i % 101) / 3, static_cast<double>(i % 7) * 5};
+        reference.index(p, i);
+        gi.index(p, i);
+        
+        if (i % 997 == 0 || i == 19999) {
+            const Point lookup{static_cast<double>(i % 30), 10, 15};
+            reference.pointsWithinDistance(lookup, 4, expected);
+            gi.pointsWithinDistance(lookup, 4, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (const auto& hit : expected)
+                ASSERT_INDEX_PRESENT(result, hit.pointIndex);
+            
+            reference.nearestPointsWithinDistance(lookup, 4, 10, expected);
+            gi.nearestPointsWithinDistance(lookup, 4, 10, result);
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t r = 0; r < result.size(); ++r)
+                ASSERT_NEAR(expected[r].geometricValue, result[r].geometricValue, 1e-9);
+        }
+    }
+    
+    gi.completed();
+    gi.pointsWithinDistance(Point{20, 10, 15}, 4, result);
+    reference.pointsWithinDistance(Point{20, 10, 15}, 4, expected);
+    ASSERT_EQ(expected.size(), result.size());
 }
-#endif
 
 }
@@ -0,0 +1,264 @@
+#ifndef GEOINDEX_RADIX_SORT
+#define GEOINDEX_RADIX_SORT
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "WorkerPool.hpp"
+
+namespace geoIndex {
+
+    /** How many bits of the key each pass looks at: 2048 counters per chunk, they stay in the L1 cache. */
+    static const unsigned radixBits = 11;
+    static const size_t radixBuckets = static_cast<size_t>(1) << radixBits;
+
+    /** Below this, a chunk is not worth waking up a thread. */
+    static const size_t radixMinimumChunkSize = static_cast<size_t>(1) << 16;
+
+    /** Sorts several arrays of keys, each on its bits from firstBit (included) to lastBit (excluded), moving the
+     *  values along: values is either empty or has one array for each array of keys. Stable.
+     *
+     *  LSD radix sort, radixBits at a time. Each pass is split in chunks among the workers: every chunk counts its
+     *  digits, then (after a prefix sum over all the chunks of its array) moves its elements to their place. The chunks
+     *  write to disjoint positions, so no locks. The chunks of all the arrays are the tasks of the same pass, so the
+     *  arrays share all the workers: sorting the three axes of some points takes as many passes as sorting one.
+     *  A pass where all the keys of an array have the same digit is skipped for that array.
+     *
+     *  Needs as much memory again as the keys and values, for the passes go back and forth between two buffers. */
+    template <typename KEY, typename VALUE>
+    void RadixSortEachOnBits(const std::vector<std::vector<KEY>*>& keys,
+                             const std::vector<std::vector<VALUE>*>& values,
+                             const unsigned firstBit,
+                             const unsigned lastBit,
+                             WorkerPool& workers)
+    {
+        struct Sort {
+            size_t count;
+            size_t chunks;
+            size_t chunkSize;
+            size_t firstTask;
+            bool singleDigit;
+            std::vector<KEY> otherKeys;
+            std::vector<VALUE> otherValues;
+        };
+        
+        // The workers are split evenly among the arrays, but a chunk is never smaller than radixMinimumChunkSize.
+        const size_t chunksPerSort = keys.empty() ? 1 : (workers.size() + keys.size() - 1) / keys.size();
+        std::vector<Sort> sorts(keys.size());
+        std::vector<size_t> sortOfTask;
+        for (size_t s = 0; s < keys.size(); ++s) {
+            Sort& sort = sorts[s];
+            sort.count = keys[s]->size();
+            const size_t maxChunks = (sort.count + radixMinimumChunkSize - 1) / radixMinimumChunkSize;
+            sort.chunks = std::max<size_t>(1, std::min(chunksPerSort, maxChunks));
+            sort.chunkSize = (sort.count + sort.chunks - 1) / sort.chunks;
+            sort.firstTask = sortOfTask.size();
+            sort.otherKeys.resize(sort.count);
+            sort.otherValues.resize(values.empty() ? 0 : sort.count);
+            sortOfTask.insert(sortOfTask.end(), sort.chunks, s);
+        }
+        const size_t tasks = sortOfTask.size();
+        std::vector<size_t> counters(tasks * radixBuckets);  // The counters of a chunk, one after the other.
+
+        for (unsigned shift = firstBit; shift < lastBit; shift += radixBits) {
+            std::fill(counters.begin(), counters.end(), 0);
+            workers.run(tasks, [&](const size_t task) {
+                const Sort& sort = sorts[sortOfTask[task]];
+                const size_t begin = std::min((task - sort.firstTask) * sort.chunkSize, sort.count);
+                const size_t end = std::min(begin + sort.chunkSize, sort.count);
+                const KEY* chunkKeys = keys[sortOfTask[task]]->data();
+                size_t* chunkCounters = counters.data() + task * radixBuckets;
+                for (size_t i = begin; i < end; ++i)
+                    ++chunkCounters[(chunkKeys[i] >> shift) & (radixBuckets - 1)];
+            });
+
+            // Where each chunk starts writing each digit: all the smaller digits first, then the same digit of the
+            // previous chunks of the same array.
+            bool allSingleDigit = true;
+            for (Sort& sort : sorts) {
+                size_t position = 0;
+                sort.singleDigit = false;
+                for (size_t digit = 0; digit < radixBuckets; ++digit) {
+                    const size_t digitBegin = position;
+                    for (size_t task = sort.firstTask; task < sort.firstTask + sort.chunks; ++task) {
+                        size_t& counter = counters[task * radixBuckets + digit];
+                        const size_t digitCount = counter;
+                        counter = position;
+                        position += digitCount;
+                    }
+                    sort.singleDigit = sort.singleDigit || (sort.count > 0 && position - digitBegin == sort.count);
+                }
+                allSingleDigit = allSingleDigit && sort.singleDigit;
+            }
+            if (allSingleDigit)
+                continue;  // Nothing would move.
+
+            workers.run(tasks, [&](const size_t task) {
+                const size_t s = sortOfTask[task];
+                Sort& sort = sorts[s];
+                if (sort.singleDigit)
+                    return;
+                const size_t begin = std::min((task - sort.firstTask) * sort.chunkSize, sort.count);
+                const size_t end = std::min(begin + sort.chunkSize, sort.count);
+                size_t* chunkCounters = counters.data() + task * radixBuckets;
+                // Plain pointers: through the vectors the compiler reloads their buffers at every write.
+                const KEY* fromKeys = keys[s]->data();
+                KEY* toKeys = sort.otherKeys.data();
+                if (values.empty()) {
+                    for (size_t i = begin; i < end; ++i)
+                        toKeys[chunkCounters[(fromKeys[i] >> shift) & (radixBuckets - 1)]++] = fromKeys[i];
+                    return;
+                }
+                const VALUE* fromValues = values[s]->data();
+                VALUE* toValues = sort.otherValues.data();
+                for (size_t i = begin; i < end; ++i) {
+                    const size_t destination = chunkCounters[(fromKeys[i] >> shift) & (radixBuckets - 1)]++;
+                    toKeys[destination] = fromKeys[i];
+                    toValues[destination] = fromValues[i];
+                }
+            });
+
+            for (size_t s = 0; s < sorts.size(); ++s) {
+                if (sorts[s].singleDigit)
+                    continue;
+                keys[s]->swap(sorts[s].otherKeys);
+                if (! values.empty())
+                    values[s]->swap(sorts[s].otherValues);
+            }
+        }
+    }
+
+    /** Sorts the keys on their bits from firstBit (included) to lastBit (excluded), moving the values (if any) along.
+     *  Stable. See RadixSortEachOnBits. */
+    template <typename KEY, typename VALUE>
+    void RadixSortOnBits(std::vector<KEY>& keys,
+                         std::vector<VALUE>* values,
+                         const unsigned firstBit,
+                         const unsigned lastBit,
+                         WorkerPool& workers)
+    {
+        RadixSortEachOnBits(std::vector<std::vector<KEY>*>{&keys},
+                            values == nullptr ? std::vector<std::vector<VALUE>*>() : std::vector<std::vector<VALUE>*>{values},
+                            firstBit, lastBit, workers);
+    }
+
+    /** Sorts keys and values together, by key. Stable. Only the lowest keyBits bits of the keys count:
+     *  pass the smallest number that covers them (fewer bits, fewer passes). */
+    template <typename KEY, typename VALUE>
+    void RadixSortByKey(std::vector<KEY>& keys,
+                        std::vector<VALUE>& values,
+                        const unsigned keyBits,
+                        WorkerPool& workers)
+    {
+        RadixSortOnBits(keys, &values, 0, keyBits, workers);
+    }
+
+    /** Same as above, in the calling thread. */
+    template <typename KEY, typename VALUE>
+    void RadixSortByKey(std::vector<KEY>& keys,
+                        std::vector<VALUE>& values,
+                        const unsigned keyBits)
+    {
+        WorkerPool justThisThread(1);
+        RadixSortByKey(keys, values, keyBits, justThisThread);
+    }
+
+    /** Sorts the keys on their bits from firstBit (included) to lastBit (excluded). Stable.
+     *  With a value in the lowest bits and its key above, moves half the memory of RadixSortByKey. */
+    template <typename KEY>
+    void RadixSortOnBits(std::vector<KEY>& keys,
+                         const unsigned firstBit,
+                         const unsigned lastBit,
+                         WorkerPool& workers)
+    {
+        RadixSortOnBits(keys, static_cast<std::vector<KEY>*>(nullptr), firstBit, lastBit, workers);
+    }
+
+    /** The IEEE-754 bits of the value, as an unsigned integer that sorts like the value: negative numbers have all
+     *  their bits flipped (the bigger the magnitude, the smaller the key), positive ones only the sign bit (so they
+     *  come after all the negative ones). -0 comes just before +0, NaNs at the two ends. */
+    inline uint32_t SortableBits(const float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits & 0x80000000u) != 0 ? ~bits : (bits | 0x80000000u);
+    }
+
+    inline uint64_t SortableBits(const double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits & 0x8000000000000000ull) != 0 ? ~bits : (bits | 0x8000000000000000ull);
+    }
+
+    /** The positions of the coordinates of each array, in increasing order of coordinate: positions[a] for
+     *  coordinates[a]. Equal coordinates keep their order. Float or double coordinates: the sort works on their
+     *  SortableBits. All the arrays are sorted together by RadixSortEachOnBits, sharing the workers.
+     *
+     *  With float (and less than 2^32 of them) the position goes in the low bits of the same key and
+     *  only 3 passes move a single array. */
+    template <typename COORDINATE, typename POSITION>
+    void RadixSortedPositionsOfEach(const std::vector<const std::vector<COORDINATE>*>& coordinates,
+                                    const std::vector<std::vector<POSITION>*>& positions,
+                                    WorkerPool& workers)
+    {
+        const unsigned coordinateBits = 8 * sizeof(SortableBits(COORDINATE()));
+        size_t biggest = 0;
+        for (const std::vector<COORDINATE>* array : coordinates)
+            biggest = std::max(biggest, array->size());
+        const bool positionInTheKey = coordinateBits <= 32 && biggest <= UINT32_MAX;
+
+        std::vector<std::vector<uint64_t> > keys(coordinates.size());
+        std::vector<std::vector<uint64_t>*> keysToSort;
+        for (std::vector<uint64_t>& arrayKeys : keys)
+            keysToSort.push_back(&arrayKeys);
+        workers.run(coordinates.size(), [&](const size_t a) {
+            const std::vector<COORDINATE>& arrayCoordinates = *coordinates[a];
+            const size_t count = arrayCoordinates.size();
+            keys[a].resize(count);
+            positions[a]->resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                if (positionInTheKey) {
+                    keys[a][i] = (static_cast<uint64_t>(SortableBits(arrayCoordinates[i])) << 32) | i;
+                } else {
+                    keys[a][i] = SortableBits(arrayCoordinates[i]);
+                    (*positions[a])[i] = static_cast<POSITION>(i);
+                }
+            }
+        });
+
+        if (! positionInTheKey) {
+            RadixSortEachOnBits(keysToSort, positions, 0, coordinateBits, workers);
+            return;
+        }
+        RadixSortEachOnBits(keysToSort, std::vector<std::vector<uint64_t>*>(), 32, 32 + coordinateBits, workers);
+        workers.run(coordinates.size(), [&](const size_t a) {
+            std::vector<POSITION>& arrayPositions = *positions[a];
+            for (size_t i = 0; i < keys[a].size(); ++i)
+                arrayPositions[i] = static_cast<POSITION>(keys[a][i] & UINT32_MAX);
+        });
+    }
+
+    /** The positions of the coordinates, in increasing order of coordinate. See RadixSortedPositionsOfEach. */
+    template <typename COORDINATE, typename POSITION>
+    void RadixSortedPositions(const std::vector<COORDINATE>& coordinates,
+                              std::vector<POSITION>& positions,
+                              WorkerPool& workers)
+    {
+        RadixSortedPositionsOfEach(std::vector<const std::vector<COORDINATE>*>{&coordinates},
+                                   std::vector<std::vector<POSITION>*>{&positions},
+                                   workers);
+    }
+
+    /** How many bits are needed to write the value. */
+    inline unsigned BitsToRepresent(uint64_t value) {
+        unsigned bits = 0;
+        for (; value != 0; value >>= 1)
+            ++bits;
+        return bits;
+    }
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "gtest/gtest.h"
+
+#include "RadixSort.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <limits>
+
+namespace geoIndex {
+
+/* Deterministic pseudo random keys, with the given number of bits. */
+static std::vector<uint64_t> randomKeys(const size_t count, const unsigned bits) {
+    std::vector<uint64_t> keys;
+    uint64_t state = 42;
+    for (size_t i = 0; i < count; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        keys.push_back(bits == 64 ? state : (state >> 7) & ((static_cast<uint64_t>(1) << bits) - 1));
+    }
+    return keys;
+}
+
+/* Checks the result against std::stable_sort on (key, position) pairs. */
+static void sameAsStableSort(const std::vector<uint64_t>& original, const unsigned bits, WorkerPool& workers) {
+    std::vector<std::pair<uint64_t, size_t> > expected;
+    for (size_t i = 0; i < original.size(); ++i)
+        expected.push_back(std::make_pair(original[i], i));
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first < b.first; });
+    
+    std::vector<uint64_t> keys(original);
+    std::vector<size_t> values;
+    for (size_t i = 0; i < original.size(); ++i)
+        values.push_back(i);
+    RadixSortByKey(keys, values, bits, workers);
+    
+    ASSERT_EQ(expected.size(), keys.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(expected[i].first, keys[i]);
+        ASSERT_EQ(expected[i].second, values[i]);
+    }
+}
+
+TEST(RadixSortByKey, noElements) {
+    std::vector<uint64_t> keys;
+    std::vector<size_t> values;
+    RadixSortByKey(keys, values, 64);
+    ASSERT_TRUE(keys.empty());
+}
+
+TEST(RadixSortByKey, fewBits) {
+    WorkerPool oneThread(1);
+    sameAsStableSort(randomKeys(1000, 5), 5, oneThread);  // Many equal keys: stability matters.
+}
+
+TEST(RadixSortByKey, allBits) {
+    WorkerPool oneThread(1);
+    sameAsStableSort(randomKeys(1000, 64), 64, oneThread);
+}
+
+TEST(RadixSortByKey, sameDigitEverywhere) {
+    WorkerPool oneThread(1);
+    std::vector<uint64_t> keys = randomKeys(1000, 8);
+    for (auto& key : keys)
+        key |= static_cast<uint64_t>(0x5A5) << 11;  // The second digit is the same for all.
+    sameAsStableSort(keys, 22, oneThread);
+}
+
+TEST(RadixSortByKey, parallel) {
+    // Enough elements to have several chunks.
+    WorkerPool workers(4);
+    sameAsStableSort(randomKeys(300000, 30), 30, workers);
+    sameAsStableSort(randomKeys(300000, 3), 3, workers);
+}
+
+TEST(RadixSortOnBits, valueInTheLowestBits) {
+    // Key above, position below: the positions of equal keys stay in order.
+    WorkerPool workers(4);
+    const std::vector<uint64_t> original = randomKeys(300000, 6);
+    std::vector<uint64_t> combined;
+    for (size_t i = 0; i < original.size(); ++i)
+        combined.push_back((original[i] << 20) | i);
+    
+    RadixSortOnBits(combined, 20, 26, workers);
+    
+    for (size_t i = 1; i < combined.size(); ++i)
+        ASSERT_LT(combined[i - 1], combined[i]);
+}
+
+TEST(RadixSortEachOnBits, arraysOfDifferentSizes) {
+    // The arrays share the passes: one is empty, one has a single digit on the low bits, one needs several chunks.
+    WorkerPool workers(4);
+    const std::vector<uint64_t> big = randomKeys(300000, 30);
+    const std::vector<uint64_t> sameLowDigit(1000, 7);
+    std::vector<std::vector<uint64_t> > keys{std::vector<uint64_t>(), sameLowDigit, big};
+    std::vector<std::vector<size_t> > values(keys.size());
+    std::vector<std::vector<uint64_t>*> keysToSort;
+    std::vector<std::vector<size_t>*> valuesToSort;
+    for (size_t a = 0; a < keys.size(); ++a) {
+        for (size_t i = 0; i < keys[a].size(); ++i)
+            values[a].push_back(i);
+        keysToSort.push_back(&keys[a]);
+        valuesToSort.push_back(&values[a]);
+    }
+    
+    RadixSortEachOnBits(keysToSort, valuesToSort, 0, 30, workers);
+    
+    ASSERT_TRUE(keys[0].empty());
+    ASSERT_EQ(sameLowDigit, keys[1]);
+    for (size_t i = 0; i < sameLowDigit.size(); ++i)
+        ASSERT_EQ(i, values[1][i]);
+    for (size_t i = 0; i < big.size(); ++i)
+        ASSERT_EQ(big[values[2][i]], keys[2][i]);
+    for (size_t i = 1; i < big.size(); ++i)
+        ASSERT_TRUE(keys[2][i - 1] < keys[2][i] || (keys[2][i - 1] == keys[2][i] && values[2][i - 1] < values[2][i]));
+}
+
+TEST(SortableBits, sameOrderAsTheValues) {
+    const std::vector<double> doubles{-std::numeric_limits<double>::infinity(), -1e300, -2.5, -1, -1e-310, 0,
+                                      1e-310, 1, 2.5, 1e300, std::numeric_limits<double>::infinity()};
+    for (size_t i = 1; i < doubles.size(); ++i)
+        ASSERT_LT(SortableBits(doubles[i - 1]), SortableBits(doubles[i]));
+    
+    const std::vector<float> floats{-std::numeric_limits<float>::infinity(), -1e30f, -2.5f, -1, -1e-40f, 0,
+                                    1e-40f, 1, 2.5f, 1e30f, std::numeric_limits<float>::infinity()};
+    for (size_t i = 1; i < floats.size(); ++i)
+        ASSERT_LT(SortableBits(floats[i - 1]), SortableBits(floats[i]));
+}
+
+TEST(SortableBits, negativeZeroJustBeforeZero) {
+    ASSERT_EQ(SortableBits(-0.0) + 1, SortableBits(0.0));
+    ASSERT_EQ(SortableBits(-0.0f) + 1, SortableBits(0.0f));
+}
+
+/* Checks the positions against std::stable_sort of the coordinates. */
+template <typename COORDINATE>
+static void sortedPositionsSameAsStableSort(const std::vector<COORDINATE>& coordinates, WorkerPool& workers) {
+    std::vector<size_t> expected;
+    for (size_t i = 0; i < coordinates.size(); ++i)
+        expected.push_back(i);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&coordinates](const size_t a, const size_t b) { return coordinates[a] < coordinates[b]; });
+    
+    std::vector<size_t> positions;
+    RadixSortedPositions(coordinates, positions, workers);
+    
+    ASSERT_EQ(expected, positions);
+}
+
+TEST(RadixSortedPositions, noCoordinates) {
+    WorkerPool oneThread(1);
+    sortedPositionsSameAsStableSort(std::vector<double>(), oneThread);
+    sortedPositionsSameAsStableSort(std::vector<float>(), oneThread);
+}
+
+TEST(RadixSortedPositions, doubleAndFloat) {
+    WorkerPool workers(4);
+    std::vector<double> doubles;
+    std::vector<float> floats;
+    for (const uint64_t key : randomKeys(300000, 20)) {
+        const double coordinate = (static_cast<double>(key) - 500000) / 64;  // Negative and positive, some equal.
+        doubles.push_back(coordinate);
+        floats.push_back(static_cast<float>(coordinate));
+    }
+    sortedPositionsSameAsStableSort(doubles, workers);
+    sortedPositionsSameAsStableSort(floats, workers);
+}
+
+TEST(RadixSortedPositionsOfEach, threeAxes) {
+    WorkerPool workers(4);
+    std::vector<double> axes[3];
+    const std::vector<uint64_t> keys = randomKeys(300000, 20);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        axes[0].push_back(static_cast<double>(keys[i]) / 64);
+        axes[1].push_back(-static_cast<double>(keys[i] % 1000));
+        axes[2].push_back(static_cast<double>(keys[(i * 7) % keys.size()]) - 500000);
+    }
+    std::vector<size_t> positions[3];
+    RadixSortedPositionsOfEach(std::vector<const std::vector<double>*>{&axes[0], &axes[1], &axes[2]},
+                               std::vector<std::vector<size_t>*>{&positions[0], &positions[1], &positions[2]},
+                               workers);
+    
+    for (size_t axis = 0; axis < 3; ++axis) {
+        std::vector<size_t> single;
+        RadixSortedPositions(axes[axis], single, workers);
+        ASSERT_EQ(single, positions[axis]);
+        sortedPositionsSameAsStableSort(axes[axis], workers);
+    }
+}
+
+TEST(BitsToRepresent, someValues) {
+    ASSERT_EQ(0, BitsToRepresent(0));
+    ASSERT_EQ(1, BitsToRepresent(1));
+    ASSERT_EQ(2, BitsToRepresent(3));
+    ASSERT_EQ(3, BitsToRepresent(4));
+    ASSERT_EQ(64, BitsToRepresent(~static_cast<uint64_t>(0)));
+}
+
+}
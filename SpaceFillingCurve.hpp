@@ -0,0 +1,155 @@
+#ifndef GEOINDEX_SPACE_FILLING_CURVE
+#define GEOINDEX_SPACE_FILLING_CURVE
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#include "Common.hpp"
+#include "MortonCode.hpp"
+#include "RadixSort.hpp"
+
+namespace geoIndex {
+
+    /** Orders of the cells of a grid where cells close in the order are close in space. */
+    enum class SpaceFillingCurve {
+        morton,   ///< Z-order: just interleaves the bits, but jumps far at the borders of the octree nodes.
+        hilbert   ///< Every cell is next to the one before it: better locality, a little slower to compute.
+    };
+
+
+    /** 2^21 cells per axis over a bounding box, for the 63 bit codes of the curves. */
+    template <typename COORDINATE>
+    class CurveGrid {
+    public:
+        CurveGrid() :
+            lowestCoordinate{0, 0, 0},
+            highestCoordinate{0, 0, 0},
+            scale{0, 0, 0}
+        {}
+
+        /** The bounding box of the count points, coordinate(i, axis) giving the coordinates of point i
+         *  (axis 0 for x, 1 for y, 2 for z). At least one point. */
+        template <typename COORDINATES>
+        void fit(const size_t count, COORDINATES coordinate) {
+            for (unsigned axis = 0; axis < 3; ++axis) {
+                lowestCoordinate[axis] = highestCoordinate[axis] = coordinate(0, axis);
+                for (size_t i = 1; i < count; ++i) {
+                    lowestCoordinate[axis] = std::min(lowestCoordinate[axis], coordinate(i, axis));
+                    highestCoordinate[axis] = std::max(highestCoordinate[axis], coordinate(i, axis));
+                }
+                const COORDINATE extent = highestCoordinate[axis] - lowestCoordinate[axis];
+                scale[axis] = extent > 0 ? mortonMaximumCell / extent : 0;
+            }
+        }
+
+        /** The cell of a coordinate on an axis. Coordinates out of the grid go to the cell at its border. */
+        uint32_t cell(const unsigned axis, const COORDINATE value) const {
+            const COORDINATE scaled = (value - lowestCoordinate[axis]) * scale[axis];
+            if (! (scaled > 0))
+                return 0;
+            if (scaled >= mortonMaximumCell)
+                return mortonMaximumCell;
+            return static_cast<uint32_t>(scaled);
+        }
+
+        COORDINATE lowest(const unsigned axis) const {
+            return lowestCoordinate[axis];
+        }
+
+        COORDINATE highest(const unsigned axis) const {
+            return highestCoordinate[axis];
+        }
+
+    private:
+        COORDINATE lowestCoordinate[3];
+        COORDINATE highestCoordinate[3];
+        COORDINATE scale[3];
+    };
+
+
+    /** Position of a cell along the 3D Hilbert curve over a grid of 2^bits cells per axis (bits up to 21).
+     *
+     *  Skilling, "Programming the Hilbert curve", 2004: the cell coordinates are turned (by swaps and inversions
+     *  of their lower bits, level by level) into the "transpose" of the Hilbert index, whose bits interleaved
+     *  are the index. So the last step is a Morton code. */
+    inline uint64_t HilbertCode(const uint32_t x, const uint32_t y, const uint32_t z, const unsigned bits = mortonBitsPerAxis) {
+        uint32_t axes[3] = {x, y, z};
+        const uint32_t highestBit = static_cast<uint32_t>(1) << (bits - 1);
+
+        for (uint32_t bit = highestBit; bit > 1; bit >>= 1) {
+            const uint32_t lowerBits = bit - 1;
+            for (unsigned axis = 0; axis < 3; ++axis)
+                if ((axes[axis] & bit) != 0)
+                    axes[0] ^= lowerBits;  // Invert.
+                else {
+                    const uint32_t exchanged = (axes[0] ^ axes[axis]) & lowerBits;
+                    axes[0] ^= exchanged;
+                    axes[axis] ^= exchanged;
+                }
+        }
+
+        // Gray code.
+        axes[1] ^= axes[0];
+        axes[2] ^= axes[1];
+        uint32_t flips = 0;
+        for (uint32_t bit = highestBit; bit > 1; bit >>= 1)
+            if ((axes[2] & bit) != 0)
+                flips ^= bit - 1;
+        for (unsigned axis = 0; axis < 3; ++axis)
+            axes[axis] ^= flips;
+
+        return MortonCode(axes[0], axes[1], axes[2]);
+    }
+
+
+    /** The positions of the points in the order of the curve over their bounding box (on a grid of 2^21 cells
+     *  per axis). Points in the same cell keep their order.
+     *
+     *  Adding the points to an index in this order (see BuildIndex below) puts the points close in space close in
+     *  memory in the indexes that keep the points in the order they come: NoIndex, the points within each cube of
+     *  CubeIndex, the cubes themselves. Reordering the user's own arrays in the same way helps as much, when they
+     *  read them for the points found. */
+    template <typename POINT>
+    std::vector<size_t> SpaceFillingCurveOrder(const std::vector<POINT>& points,
+                                               const SpaceFillingCurve curve = SpaceFillingCurve::hilbert) {
+        std::vector<size_t> positions(points.size());
+        if (points.empty())
+            return positions;
+
+        CurveGrid<typename PointTraits<POINT>::coordinate> grid;
+        grid.fit(points.size(), [&points](const size_t i, const unsigned axis) {
+            return axis == 0 ? points[i].x : (axis == 1 ? points[i].y : points[i].z);
+        });
+
+        std::vector<uint64_t> codes(points.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+            const uint32_t x = grid.cell(0, points[i].x);
+            const uint32_t y = grid.cell(1, points[i].y);
+            const uint32_t z = grid.cell(2, points[i].z);
+            codes[i] = curve == SpaceFillingCurve::hilbert ? HilbertCode(x, y, z) : MortonCode(x, y, z);
+            positions[i] = i;
+        }
+        RadixSortByKey(codes, positions, 3 * mortonBitsPerAxis);
+        return positions;
+    }
+
+    /** Same as BuildIndex in NearestNeighbors.hpp (the index of each point is its position in the vector), but the
+     *  points are added in the order of the curve. */
+    template <typename POINT, typename GEOMETRY_INDEX>
+    void BuildIndex(const std::vector<POINT>& knownPoints,
+                    GEOMETRY_INDEX& resultingIndex,
+                    const SpaceFillingCurve curve) {
+        static_assert(std::is_unsigned<typename PointTraits<POINT>::index>::value,
+                      "BuildIndex can only deal with unsigned integral types as indexes.");
+
+        for (const size_t position : SpaceFillingCurveOrder(knownPoints, curve))
+            resultingIndex.index(knownPoints[position], static_cast<typename PointTraits<POINT>::index>(position));
+
+        resultingIndex.completed();
+    }
+
+}
+
+#endif
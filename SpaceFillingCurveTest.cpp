@@ -0,0 +1,133 @@
+#include "gtest/gtest.h"
+
+#include "SpaceFillingCurve.hpp"
+
+#include "NoIndex.hpp"
+#include "CubeIndex.hpp"
+#include "AabbIndex.hpp"
+#include "NearestNeighbors.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+namespace geoIndex {
+
+TEST(SpaceFillingCurve, hilbertCode_visitsEveryCellOnceThroughNeighbors) {
+    // 8 x 8 x 8 cells: the codes are 0 to 511, and consecutive codes are cells side by side.
+    const unsigned bits = 3;
+    const int side = 1 << bits;
+    std::vector<int> cellOfCode(side * side * side, -1);
+    for (uint32_t x = 0; x < static_cast<uint32_t>(side); ++x)
+        for (uint32_t y = 0; y < static_cast<uint32_t>(side); ++y)
+            for (uint32_t z = 0; z < static_cast<uint32_t>(side); ++z) {
+                const uint64_t code = HilbertCode(x, y, z, bits);
+                ASSERT_LT(code, cellOfCode.size());
+                ASSERT_EQ(-1, cellOfCode[code]);
+                cellOfCode[code] = (x * side + y) * side + z;
+            }
+
+    for (size_t code = 1; code < cellOfCode.size(); ++code) {
+        const int before = cellOfCode[code - 1];
+        const int after = cellOfCode[code];
+        const int steps = std::abs(before / (side * side) - after / (side * side)) +
+                          std::abs(before / side % side - after / side % side) +
+                          std::abs(before % side - after % side);
+        ASSERT_EQ(1, steps);
+    }
+}
+
+TEST(SpaceFillingCurve, hilbertCode_startsAtTheOrigin) {
+    ASSERT_EQ(0, HilbertCode(0, 0, 0));
+    ASSERT_EQ(0, HilbertCode(0, 0, 0, 4));
+}
+
+static std::vector<Point> scatteredPoints() {
+    std::vector<Point> points;
+    for (int i = 0; i < 3000; ++i)
+        points.push_back(Point{static_cast<double>((i * 7919) % 211) - 100,
+                               static_cast<double>((i * 104729) % 97) * 0.5,
+                               static_cast<double>((i * 31) % 53) - 20});
+    return points;
+}
+
+TEST(SpaceFillingCurve, order_isAPermutation) {
+    const std::vector<Point> points = scatteredPoints();
+    for (SpaceFillingCurve curve : {SpaceFillingCurve::morton, SpaceFillingCurve::hilbert}) {
+        std::vector<size_t> order = SpaceFillingCurveOrder(points, curve);
+        ASSERT_EQ(points.size(), order.size());
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); ++i)
+            ASSERT_EQ(i, order[i]);
+    }
+}
+
+TEST(SpaceFillingCurve, order_closePointsFirst) {
+    // Two clusters, interleaved in the input: the curve puts each together.
+    std::vector<Point> points;
+    for (int i = 0; i < 100; ++i) {
+        points.push_back(Point{static_cast<double>(i % 10) * 0.01, 0, 0});
+        points.push_back(Point{1000 + static_cast<double>(i % 10) * 0.01, 1000, 1000});
+    }
+    for (SpaceFillingCurve curve : {SpaceFillingCurve::morton, SpaceFillingCurve::hilbert}) {
+        const std::vector<size_t> order = SpaceFillingCurveOrder(points, curve);
+        for (size_t i = 0; i < order.size(); ++i)
+            ASSERT_EQ(i < 100 ? 0 : 1, order[i] % 2);
+    }
+}
+
+TEST(SpaceFillingCurve, order_emptyAndSinglePoint) {
+    ASSERT_TRUE(SpaceFillingCurveOrder(std::vector<Point>()).empty());
+    ASSERT_EQ(std::vector<size_t>{0}, SpaceFillingCurveOrder(std::vector<Point>{Point{1, 2, 3}}));
+}
+
+template <typename GEOMETRY_INDEX>
+static void buildIndex_sameAsInputOrder(GEOMETRY_INDEX& inputOrder, GEOMETRY_INDEX& curveOrder, const SpaceFillingCurve curve) {
+    const std::vector<Point> points = scatteredPoints();
+    BuildIndex(points, inputOrder);
+    BuildIndex(points, curveOrder, curve);
+
+    const std::vector<Point> references{{0, 0, 0}, {-50, 20, 10}, {100, 48, 32}, {500, 10, 10}};
+    for (const Point& referencePoint : references)
+        for (double d : {0.5, 3.0, 20.0, 300.0}) {  // The points span about 200.
+            std::vector<IndexAndSquaredDistance<Point>> expected;
+            std::vector<IndexAndSquaredDistance<Point>> result;
+            inputOrder.pointsWithinDistance(referencePoint, d, expected);
+            curveOrder.pointsWithinDistance(referencePoint, d, result);
+            std::sort(expected.begin(), expected.end(), SortByPointIndex<Point>);
+            std::sort(result.begin(), result.end(), SortByPointIndex<Point>);
+
+            ASSERT_EQ(expected.size(), result.size());
+            for (size_t i = 0; i < expected.size(); ++i) {
+                ASSERT_EQ(expected[i].pointIndex, result[i].pointIndex);
+                ASSERT_EQ(expected[i].geometricValue, result[i].geometricValue);
+            }
+        }
+}
+
+TEST(SpaceFillingCurve, buildIndex_noIndex) {
+    for (SpaceFillingCurve curve : {SpaceFillingCurve::morton, SpaceFillingCurve::hilbert}) {
+        NoIndex<Point> inputOrder;
+        NoIndex<Point> curveOrder;
+        buildIndex_sameAsInputOrder(inputOrder, curveOrder, curve);
+    }
+}
+
+TEST(SpaceFillingCurve, buildIndex_cubeIndex) {
+    for (SpaceFillingCurve curve : {SpaceFillingCurve::morton, SpaceFillingCurve::hilbert}) {
+        CubeIndex<Point> inputOrder(5);
+        CubeIndex<Point> curveOrder(5);
+        buildIndex_sameAsInputOrder(inputOrder, curveOrder, curve);
+    }
+}
+
+TEST(SpaceFillingCurve, buildIndex_aabbIndex) {
+    for (SpaceFillingCurve curve : {SpaceFillingCurve::morton, SpaceFillingCurve::hilbert}) {
+        AabbIndex<Point> inputOrder;
+        AabbIndex<Point> curveOrder;
+        buildIndex_sameAsInputOrder(inputOrder, curveOrder, curve);
+    }
+}
+
+}
@@ -136,6 +136,71 @@ void pointsWithinDistance_outputOrder(GEOMETRY_INDEX& redMesh) {
 }
 
 
+template <typename GEOMETRY_INDEX>
+void nearestPointsWithinDistance_closestK(GEOMETRY_INDEX& redMesh) {
+  const Point referencePoint{0, 0, 0};
+  
+  redMesh.index(Point{3, 0, 0}, 1);
+  redMesh.index(Point{0, -1, 0}, 2);
+  redMesh.index(Point{0, 0, 4}, 3);
+  redMesh.index(Point{2, 0, 0}, 4);
+  redMesh.index(Point{0, 5, 0}, 5);
+  redMesh.completed();
+  
+  std::vector<IndexAndSquaredDistance<Point>> result;
+  redMesh.nearestPointsWithinDistance(referencePoint, 10, 3, result);
+  
+  ASSERT_EQ(3, result.size());
+  ASSERT_EQ(2, result.at(0).pointIndex);
+  ASSERT_EQ(4, result.at(1).pointIndex);
+  ASSERT_EQ(1, result.at(2).pointIndex);
+  ASSERT_EQ(9, result.at(2).geometricValue);
+}
+
+
+template <typename GEOMETRY_INDEX>
+void nearestPointsWithinDistance_lessThanK(GEOMETRY_INDEX& redMesh) {
+  const Point referencePoint{0, 0, 0};
+  
+  redMesh.index(Point{1, 0, 0}, 1);
+  redMesh.index(Point{0, 2, 0}, 2);
+  redMesh.index(Point{0, 0, 3}, 3);  // Exactly on the limit: excluded.
+  redMesh.index(Point{30, 0, 0}, 4);
+  redMesh.completed();
+  
+  std::vector<IndexAndSquaredDistance<Point>> result;
+  redMesh.nearestPointsWithinDistance(referencePoint, 3, 10, result);
+  
+  ASSERT_EQ(2, result.size());
+  ASSERT_EQ(1, result.at(0).pointIndex);
+  ASSERT_EQ(2, result.at(1).pointIndex);
+}
+
+
+template <typename GEOMETRY_INDEX>
+void nearestPointsWithinDistance_sameAsPointsWithinDistance(GEOMETRY_INDEX& redMesh) {
+  // A small grid of points all around the reference, with distinct distances from it.
+  PointTraits<Point>::index index = 0;
+  for (int x = -4; x <= 4; ++x)
+    for (int y = -4; y <= 4; ++y)
+      for (int z = -4; z <= 4; ++z)
+        redMesh.index(Point{x * 1.0, y * 1.1, z * 1.21}, index++);
+  redMesh.completed();
+  
+  const Point referencePoint{0.3, 0.2, 0.1};
+  std::vector<IndexAndSquaredDistance<Point>> allPoints;
+  redMesh.pointsWithinDistance(referencePoint, 3, allPoints);
+  
+  const size_t k = 7;
+  std::vector<IndexAndSquaredDistance<Point>> nearest;
+  redMesh.nearestPointsWithinDistance(referencePoint, 3, k, nearest);
+  
+  ASSERT_EQ(k, nearest.size());
+  for (size_t i = 0; i < k; ++i)
+    ASSERT_EQ(allPoints.at(i).geometricValue, nearest.at(i).geometricValue);
+}
+
+
 /* Safety checks.*/
 template <typename GEOMETRY_INDEX>
 void index_duplicatedIndex(GEOMETRY_INDEX& redMesh) {
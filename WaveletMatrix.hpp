@@ -0,0 +1,241 @@
+#ifndef GEOINDEX_WAVELET_MATRIX
+#define GEOINDEX_WAVELET_MATRIX
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace geoIndex {
+
+/** A sequence of bits that counts the ones before any position in constant time (rank).
+ *  On top of the bits, one counter every 512 bits: 1/8 more memory. */
+class RankBitVector {
+public:
+    RankBitVector() :
+        length(0)
+    { }
+
+    explicit RankBitVector(const size_t length) :
+        length(length),
+        words((length + 63) / 64, 0)
+    { }
+
+    void set(const size_t position) {
+        words[position / 64] |= static_cast<uint64_t>(1) << (position % 64);
+    }
+
+    bool get(const size_t position) const {
+        return ((words[position / 64] >> (position % 64)) & 1) != 0;
+    }
+
+    /** Call it once all the bits are set, before rank1. */
+    void prepareRanks() {
+        blockRanks.assign(words.size() / wordsPerBlock + 1, 0);
+        uint64_t ones = 0;
+        for (size_t word = 0; word < words.size(); ++word) {
+            if (word % wordsPerBlock == 0)
+                blockRanks[word / wordsPerBlock] = ones;
+            ones += __builtin_popcountll(words[word]);
+        }
+        if (words.size() % wordsPerBlock == 0)
+            blockRanks.back() = ones;
+    }
+
+    /** How many ones in [0, position). */
+    size_t rank1(const size_t position) const {
+        const size_t word = position / 64;
+        size_t ones = blockRanks[word / wordsPerBlock];
+        for (size_t w = word - word % wordsPerBlock; w < word; ++w)
+            ones += __builtin_popcountll(words[w]);
+        const unsigned bitsInWord = position % 64;
+        if (bitsInWord != 0)
+            ones += __builtin_popcountll(words[word] & ((static_cast<uint64_t>(1) << bitsInWord) - 1));
+        return ones;
+    }
+
+    /** How many zeros in [0, position). */
+    size_t rank0(const size_t position) const {
+        return position - rank1(position);
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /** Bytes taken by the bits and the counters. */
+    size_t memoryUsage() const {
+        return words.size() * sizeof(uint64_t) + blockRanks.size() * sizeof(uint64_t);
+    }
+
+private:
+    static const size_t wordsPerBlock = 8;
+
+    size_t length;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> blockRanks;  ///< Ones before each block of wordsPerBlock words.
+};
+
+
+/** Wavelet matrix (Claude, Navarro, Ordóñez; see "Compact Data Structures", section 6.2.5) over a sequence of
+ *  unsigned integers of a known number of bits.
+ *
+ *  One bit vector per bit of the values, from the most significant: level l holds bit l of every value, in the
+ *  order they have at that level. The next level has the values with a 0 first, then those with a 1, both in the
+ *  same order as before. So every bit vector is just n bits (with ranks), and the values with the same top bits
+ *  are in a contiguous range at each level.
+ *
+ *  That gives, in O(bits) time:
+ *   - how many values in a range of positions are within a range of values (count);
+ *   - each value in a range of positions that is within a range of values (report, per reported value).
+ *  Seeing the sequence as points (position, value) on a grid, these are the 2D orthogonal range queries.
+ */
+class WaveletMatrix {
+public:
+    WaveletMatrix() :
+        length(0),
+        bitsPerValue(0)
+    { }
+
+    /** All the values must fit in valueBits bits. */
+    template <typename VALUE>
+    WaveletMatrix(const std::vector<VALUE>& values, const unsigned valueBits) :
+        length(values.size()),
+        bitsPerValue(valueBits)
+    {
+        std::vector<VALUE> current(values);
+        std::vector<VALUE> next(length);
+        levels.resize(bitsPerValue);
+        for (unsigned level = 0; level < bitsPerValue; ++level) {
+            const unsigned shift = bitsPerValue - 1 - level;
+            RankBitVector& levelBits = levels[level].bits;
+            levelBits = RankBitVector(length);
+
+            for (size_t i = 0; i < length; ++i)
+                if (((current[i] >> shift) & 1) != 0)
+                    levelBits.set(i);
+            levelBits.prepareRanks();
+            const size_t zeros = levelBits.rank0(length);
+            levels[level].zeros = zeros;
+
+            // Stable partition: zeros first.
+            size_t nextZero = 0;
+            size_t nextOne = zeros;
+            for (size_t i = 0; i < length; ++i)
+                next[((current[i] >> shift) & 1) == 0 ? nextZero++ : nextOne++] = current[i];
+            current.swap(next);
+        }
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /** The value at the position. */
+    uint64_t access(size_t position) const {
+        uint64_t value = 0;
+        for (unsigned level = 0; level < bitsPerValue; ++level) {
+            const Level& l = levels[level];
+            value <<= 1;
+            if (l.bits.get(position)) {
+                value |= 1;
+                position = l.zeros + l.bits.rank1(position);
+            } else
+                position = l.bits.rank0(position);
+        }
+        return value;
+    }
+
+    /** How many of the values in the positions [begin, end) are in [lowValue, highValue). */
+    size_t count(const size_t begin, const size_t end, const uint64_t lowValue, const uint64_t highValue) const {
+        if (begin >= end || lowValue >= highValue)
+            return 0;
+        return countInNode(0, begin, end, 0, lowValue, highValue);
+    }
+
+    /** Calls visitor(value, occurrences) for each value in [lowValue, highValue) present in the positions
+     *  [begin, end), in increasing order of value. */
+    template <typename VISITOR>
+    void report(const size_t begin,
+                const size_t end,
+                const uint64_t lowValue,
+                const uint64_t highValue,
+                VISITOR& visitor) const
+    {
+        if (begin >= end || lowValue >= highValue)
+            return;
+        reportInNode(0, begin, end, 0, lowValue, highValue, visitor);
+    }
+
+    /** Bytes taken by the bit vectors. */
+    size_t memoryUsage() const {
+        size_t bytes = 0;
+        for (const Level& level : levels)
+            bytes += level.bits.memoryUsage();
+        return bytes;
+    }
+
+private:
+    struct Level {
+        RankBitVector bits;
+        size_t zeros;  ///< Where the values with a 1 start, in the next level.
+    };
+
+    size_t length;
+    unsigned bitsPerValue;
+    std::vector<Level> levels;
+
+
+    /** The values of the node at this level go from nodeLow (included) to nodeLow + 2^(bitsPerValue - level). */
+    uint64_t nodeEnd(const unsigned level, const uint64_t nodeLow) const {
+        return nodeLow + (static_cast<uint64_t>(1) << (bitsPerValue - level));
+    }
+
+    size_t countInNode(const unsigned level,
+                       const size_t begin,
+                       const size_t end,
+                       const uint64_t nodeLow,
+                       const uint64_t lowValue,
+                       const uint64_t highValue) const
+    {
+        if (begin >= end || nodeLow >= highValue || nodeEnd(level, nodeLow) <= lowValue)
+            return 0;
+        if (lowValue <= nodeLow && nodeEnd(level, nodeLow) <= highValue)
+            return end - begin;  // The whole node is in the range.
+
+        // Not at the bottom level: a node at the bottom has a single value, and it is either in or out.
+        const Level& l = levels[level];
+        const size_t onesBefore = l.bits.rank1(begin);
+        const size_t onesToEnd = l.bits.rank1(end);
+        const uint64_t oneChildLow = nodeLow | (static_cast<uint64_t>(1) << (bitsPerValue - 1 - level));
+        return countInNode(level + 1, begin - onesBefore, end - onesToEnd, nodeLow, lowValue, highValue) +
+               countInNode(level + 1, l.zeros + onesBefore, l.zeros + onesToEnd, oneChildLow, lowValue, highValue);
+    }
+
+    template <typename VISITOR>
+    void reportInNode(const unsigned level,
+                      const size_t begin,
+                      const size_t end,
+                      const uint64_t nodeLow,
+                      const uint64_t lowValue,
+                      const uint64_t highValue,
+                      VISITOR& visitor) const
+    {
+        if (begin >= end || nodeLow >= highValue || nodeEnd(level, nodeLow) <= lowValue)
+            return;
+        if (level == bitsPerValue) {
+            visitor(nodeLow, end - begin);
+            return;
+        }
+
+        const Level& l = levels[level];
+        const size_t onesBefore = l.bits.rank1(begin);
+        const size_t onesToEnd = l.bits.rank1(end);
+        const uint64_t oneChildLow = nodeLow | (static_cast<uint64_t>(1) << (bitsPerValue - 1 - level));
+        reportInNode(level + 1, begin - onesBefore, end - onesToEnd, nodeLow, lowValue, highValue, visitor);
+        reportInNode(level + 1, l.zeros + onesBefore, l.zeros + onesToEnd, oneChildLow, lowValue, highValue, visitor);
+    }
+};
+
+}
+
+#endif
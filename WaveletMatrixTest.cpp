@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+
+#include "WaveletMatrix.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+namespace geoIndex {
+
+/* Deterministic pseudo random values below 2^bits. */
+static std::vector<uint32_t> randomValues(const size_t count, const unsigned bits) {
+    std::vector<uint32_t> values;
+    uint64_t state = 7;
+    for (size_t i = 0; i < count; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        values.push_back(static_cast<uint32_t>(state >> 33) & ((1u << bits) - 1));
+    }
+    return values;
+}
+
+
+TEST(RankBitVector, rankAcrossWordsAndBlocks) {
+    RankBitVector bits(1500);
+    for (size_t i = 0; i < 1500; i += 3)
+        bits.set(i);
+    bits.prepareRanks();
+
+    for (size_t position = 0; position <= 1500; ++position) {
+        ASSERT_EQ((position + 2) / 3, bits.rank1(position));
+        ASSERT_EQ(position - (position + 2) / 3, bits.rank0(position));
+    }
+}
+
+TEST(RankBitVector, fullBlocks) {
+    RankBitVector bits(1024);  // Exactly two blocks of 512 bits.
+    for (size_t i = 0; i < 1024; ++i)
+        bits.set(i);
+    bits.prepareRanks();
+
+    ASSERT_EQ(512, bits.rank1(512));
+    ASSERT_EQ(1024, bits.rank1(1024));
+}
+
+
+TEST(WaveletMatrix, noValues) {
+    const WaveletMatrix matrix(std::vector<uint32_t>(), 1);
+
+    ASSERT_EQ(0, matrix.size());
+    ASSERT_EQ(0, matrix.count(0, 0, 0, 2));
+}
+
+TEST(WaveletMatrix, access) {
+    const std::vector<uint32_t> values = randomValues(1000, 10);
+    const WaveletMatrix matrix(values, 10);
+
+    for (size_t i = 0; i < values.size(); ++i)
+        ASSERT_EQ(values[i], matrix.access(i));
+}
+
+TEST(WaveletMatrix, countSameAsScan) {
+    const std::vector<uint32_t> values = randomValues(700, 6);
+    const WaveletMatrix matrix(values, 6);
+
+    for (size_t begin = 0; begin < values.size(); begin += 97)
+        for (size_t end = begin; end <= values.size(); end += 131)
+            for (uint32_t low = 0; low < 64; low += 7)
+                for (uint32_t high = low; high <= 64; high += 11) {
+                    size_t expected = 0;
+                    for (size_t i = begin; i < end; ++i)
+                        if (low <= values[i] && values[i] < high)
+                            ++expected;
+                    ASSERT_EQ(expected, matrix.count(begin, end, low, high));
+                }
+}
+
+TEST(WaveletMatrix, reportSameAsScan) {
+    const std::vector<uint32_t> values = randomValues(700, 6);
+    const WaveletMatrix matrix(values, 6);
+
+    std::vector<size_t> expected(64);
+    std::vector<size_t> reported(64);
+    uint64_t previous = 0;
+    bool first = true;
+    bool increasing = true;
+    const auto visitor = [&](const uint64_t value, const size_t occurrences) {
+        increasing = increasing && (first || previous < value);
+        first = false;
+        previous = value;
+        reported[value] += occurrences;
+    };
+
+    for (size_t begin = 0; begin < values.size(); begin += 97)
+        for (size_t end = begin; end <= values.size(); end += 131)
+            for (uint32_t low = 0; low < 64; low += 13)
+                for (uint32_t high = low; high <= 64; high += 17) {
+                    std::fill(expected.begin(), expected.end(), 0);
+                    for (size_t i = begin; i < end; ++i)
+                        if (low <= values[i] && values[i] < high)
+                            ++expected[values[i]];
+                    std::fill(reported.begin(), reported.end(), 0);
+                    first = true;
+
+                    matrix.report(begin, end, low, high, visitor);
+
+                    ASSERT_EQ(expected, reported);
+                    ASSERT_TRUE(increasing);
+                }
+}
+
+TEST(WaveletMatrix, permutationAsAGrid) {
+    // One point per row and column: reverse diagonal. The rectangle [10, 20) x [985, 995) has the rows 10 to 14.
+    std::vector<uint32_t> columns;
+    for (uint32_t row = 0; row < 1000; ++row)
+        columns.push_back(999 - row);
+    const WaveletMatrix matrix(columns, 10);
+
+    ASSERT_EQ(5, matrix.count(10, 20, 985, 995));
+
+    std::vector<uint64_t> reported;
+    const auto visitor = [&reported](const uint64_t value, const size_t occurrences) {
+        ASSERT_EQ(1, occurrences);
+        reported.push_back(value);
+    };
+    matrix.report(10, 20, 985, 995, visitor);
+    ASSERT_EQ(std::vector<uint64_t>({985, 986, 987, 988, 989}), reported);
+}
+
+}
@@ -0,0 +1,145 @@
+#ifndef GEOINDEX_WORKER_POOL
+#define GEOINDEX_WORKER_POOL
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+
+namespace geoIndex {
+
+/** A small group of threads that can be reused for many parallel loops, to avoid paying for
+ *  thread creation at every query.
+ *
+ *  The user creates it once and passes it to the methods that can use it (e. g. NoIndex::pointsWithinDistance).
+ *  The indexes do not own it: they stay copyable and the same pool can serve all of them.
+ *
+ *  The thread that calls run() works too, so a pool of N threads starts only N - 1 new threads.
+ *  A pool of 1 thread just runs everything in the caller.
+ *
+ *  Only one run() at a time: calls from different threads are serialized.
+ */
+class WorkerPool {
+public:
+    /** By default uses all the cores the machine has. */
+    explicit WorkerPool(const size_t threads = std::thread::hardware_concurrency()) :
+        totalThreads(std::max<size_t>(threads, 1)),
+        taskFunction(nullptr),
+        taskCount(0),
+        generation(0),
+        busyWorkers(0),
+        stopping(false),
+        nextTask(0)
+    {
+        for (size_t i = 1; i < totalThreads; ++i)
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /** How many threads work on a run() call, the caller included. */
+    size_t size() const {
+        return totalThreads;
+    }
+
+    /** Calls task(0), task(1)... task(tasks - 1), spread over the threads. Returns when all are done.
+     *  If a task throws, the first exception is rethrown here (after all the other tasks are finished). */
+    void run(const size_t tasks, const std::function<void(size_t)>& task) {
+        std::lock_guard<std::mutex> oneRunAtATime(runMutex);
+
+        if (tasks == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            taskFunction = &task;
+            taskCount = tasks;
+            nextTask = 0;
+            failure = nullptr;
+            busyWorkers = workers.size();
+            ++generation;
+        }
+        workAvailable.notify_all();
+
+        executeTasks();
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        allWorkersDone.wait(lock, [this]() { return busyWorkers == 0; });
+        taskFunction = nullptr;
+
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+private:
+    const size_t totalThreads;
+    std::vector<std::thread> workers;
+
+    std::mutex runMutex;
+
+    // Protected by stateMutex.
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allWorkersDone;
+    const std::function<void(size_t)>* taskFunction;
+    size_t taskCount;
+    uint64_t generation;  ///< Tells the workers that a new run() started.
+    size_t busyWorkers;
+    bool stopping;
+    std::exception_ptr failure;
+
+    std::atomic<size_t> nextTask;  ///< Tasks are taken "first come, first served".
+
+
+    void workerLoop() {
+        uint64_t lastGeneration = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                workAvailable.wait(lock, [this, lastGeneration]() {
+                    return stopping || generation != lastGeneration; });
+                if (stopping)
+                    return;
+                lastGeneration = generation;
+            }
+
+            executeTasks();
+
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--busyWorkers == 0)
+                allWorkersDone.notify_one();
+        }
+    }
+
+    void executeTasks() {
+        for (size_t task = nextTask++; task < taskCount; task = nextTask++) {
+            try {
+                (*taskFunction)(task);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (! failure)
+                    failure = std::current_exception();
+            }
+        }
+    }
+};
+
+}
+
+#endif
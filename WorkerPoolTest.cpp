@@ -0,0 +1,67 @@
+#include "gtest/gtest.h"
+
+#include "WorkerPool.hpp"
+
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+
+namespace geoIndex {
+
+TEST(WorkerPool, atLeastOneThread) {
+    WorkerPool pool(0);
+    ASSERT_EQ(1, pool.size());
+}
+
+TEST(WorkerPool, runsAllTasks) {
+    WorkerPool pool(4);
+    std::vector<int> done(100, 0);
+    
+    pool.run(done.size(), [&done](const size_t task) { done[task] += 1; });
+    
+    ASSERT_EQ(std::vector<int>(100, 1), done);
+}
+
+TEST(WorkerPool, lessTasksThanThreads) {
+    WorkerPool pool(4);
+    std::atomic<int> calls(0);
+    
+    pool.run(2, [&calls](const size_t) { ++calls; });
+    
+    ASSERT_EQ(2, calls);
+}
+
+TEST(WorkerPool, noTasks) {
+    WorkerPool pool(4);
+    std::atomic<int> calls(0);
+    
+    pool.run(0, [&calls](const size_t) { ++calls; });
+    
+    ASSERT_EQ(0, calls);
+}
+
+TEST(WorkerPool, reusable) {
+    WorkerPool pool(3);
+    std::atomic<int> calls(0);
+    
+    for (int i = 0; i < 1000; ++i)
+        pool.run(5, [&calls](const size_t) { ++calls; });
+    
+    ASSERT_EQ(5000, calls);
+}
+
+TEST(WorkerPool, rethrows) {
+    WorkerPool pool(3);
+    
+    ASSERT_ANY_THROW(pool.run(10, [](const size_t task) {
+        if (task == 7)
+            throw std::runtime_error("Task failed");
+    }));
+    
+    // Still usable after the error.
+    std::atomic<int> calls(0);
+    pool.run(10, [&calls](const size_t) { ++calls; });
+    ASSERT_EQ(10, calls);
+}
+
+}